@@ -0,0 +1,226 @@
+#ifndef BENCH_HPP_
+#define BENCH_HPP_
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include "server/Metrics.hpp"
+
+/// @brief Minimal benchmark harness.
+/// A benchmark is a body running n iterations of what is measured. The
+/// harness grows n until a run lasts long enough to time, then keeps the
+/// fastest of a few runs, the figure least disturbed by the rest of the
+/// machine. Results are written as JSON, one benchmark per line, and
+/// compared against a baseline written the same way. A benchmark slower
+/// than its baseline is run again a few times before it is believed, as a
+/// busy machine easily slows a single run down by half, and can be run
+/// again later with retry(), as it also stays slow for seconds at a time.
+class Bench {
+ public:
+  struct Result {
+    std::string name;
+    double ns;
+    uint64_t iterations;
+  };
+
+  /// @brief Runs timed for the fastest one to be kept.
+  static const int REPEATS = 3;
+  /// @brief Further runs of a benchmark slower than its baseline.
+  static const int RETRIES = 6;
+
+ private:
+  std::vector<Result> _results;
+  const char *_filter;
+  /// @brief Names of the benchmarks retried, all selected ones if empty.
+  std::vector<std::string> _retried;
+  double _minSeconds;
+  std::vector<Result> _baseline;
+  /// @brief Slowdown in percent over the baseline that is a regression.
+  double _tolerance = 0;
+  /// @brief Where results are printed as they come.
+  FILE *_out = stdout;
+  /// @brief Time of the current run spent paused.
+  uint64_t _paused = 0;
+
+  // Delete copy constructor to prevent accidental copies
+  Bench(const Bench &) = delete;
+  Bench &operator=(const Bench &) = delete;
+
+ public:
+  /// @brief Leaves work done in its lifetime, such as setting up the next
+  /// iterations, out of the current run.
+  class Pause {
+   private:
+    Bench &_bench;
+    uint64_t _begin;
+
+   public:
+    Pause(Bench &bench) : _bench(bench), _begin(Metrics::now()) {}
+    ~Pause() { _bench._paused += Metrics::now() - _begin; }
+  };
+
+  /// @param filter Only benchmarks whose name contains it run, all if null.
+  /// @param minSeconds Shortest run timed.
+  Bench(const char *filter, double minSeconds)
+      : _filter(filter), _minSeconds(minSeconds) {}
+
+  /// @brief Prints results as they come to a file, stdout by default.
+  void output(FILE *out) { _out = out; }
+
+  /// @brief Sets the baseline results are compared against.
+  /// @param tolerance Slowdown in percent flagged as a regression.
+  void compareTo(const std::vector<Result> &baseline, double tolerance) {
+    _baseline = baseline;
+    _tolerance = tolerance;
+  }
+
+  /// @brief Keeps the compiler from optimizing a value away.
+  template <typename T>
+  static void keep(const T &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+  }
+
+  /// @return Whether a benchmark is to run, to skip its setup otherwise.
+  bool selected(const std::string &name) const {
+    if (_filter != nullptr && name.find(_filter) == std::string::npos)
+      return false;
+    return _retried.empty() || std::find(_retried.begin(), _retried.end(),
+                                         name) != _retried.end();
+  }
+
+  /// @return Whether any of a group of benchmarks is to run.
+  bool selected(std::initializer_list<std::string> names) const {
+    for (const std::string &name : names)
+      if (selected(name)) return true;
+    return false;
+  }
+
+  /// @brief Times a body.
+  /// @param body Runs its argument number of iterations.
+  void run(const std::string &name, const std::function<void(uint64_t)> &body) {
+    if (!selected(name)) return;
+    uint64_t n = 1, ns = 0;
+    while (true) {
+      ns = timed(body, n);
+      if (ns >= _minSeconds * 1e9) break;
+      // Aim past the minimum at once, without trusting very short runs.
+      double scale = ns > 0 ? _minSeconds * 1.2e9 / ns : 100;
+      n = std::max<uint64_t>(n + 1, n * std::min(scale, 100.0));
+    }
+    for (int r = 1; r < REPEATS; r++) ns = std::min(ns, timed(body, n));
+    for (int r = 0; r < RETRIES && regressed(name, (double)ns / n); r++)
+      ns = std::min(ns, timed(body, n));
+    record(name, (double)ns / n, n);
+  }
+
+  /// @brief Records a result measured by the caller, keeping the faster
+  /// of two results of the same benchmark.
+  void record(const std::string &name, double ns, uint64_t iterations) {
+    if (!selected(name)) return;
+    auto it = std::find_if(_results.begin(), _results.end(),
+                           [&](const Result &r) { return r.name == name; });
+    if (it == _results.end())
+      _results.push_back({name, ns, iterations});
+    else if (ns < it->ns)
+      *it = {name, ns, iterations};
+    fprintf(_out, "%-40s %12.1f ns/op %12lu ops\n", name.c_str(), ns,
+            (unsigned long)iterations);
+    fflush(_out);
+  }
+
+  const std::vector<Result> &results() const { return _results; }
+
+  /// @return Names of the results slower than the baseline allows.
+  std::vector<std::string> regressions() const {
+    std::vector<std::string> names;
+    for (const Result &r : _results)
+      if (regressed(r.name, r.ns)) names.push_back(r.name);
+    return names;
+  }
+
+  /// @brief Only selects the given benchmarks from now on, to run them
+  /// again.
+  void retry(const std::vector<std::string> &names) { _retried = names; }
+
+  /// @brief Writes the results as JSON.
+  /// @return Whether they were written.
+  bool write(const char *path) const {
+    FILE *f = fopen(path, "w");
+    if (f == nullptr) return false;
+    fprintf(f, "{\"benchmarks\": [\n");
+    for (size_t i = 0; i < _results.size(); i++)
+      fprintf(f, "  {\"name\": \"%s\", \"ns_per_op\": %.2f, \"ops\": %lu}%s\n",
+              _results[i].name.c_str(), _results[i].ns,
+              (unsigned long)_results[i].iterations,
+              i + 1 < _results.size() ? "," : "");
+    fprintf(f, "]}\n");
+    return fclose(f) == 0;
+  }
+
+  /// @brief Reads results written by write().
+  /// @return Results, empty if the file could not be read.
+  static std::vector<Result> read(const char *path) {
+    std::vector<Result> results;
+    FILE *f = fopen(path, "r");
+    if (f == nullptr) return results;
+    char line[512], name[256];
+    double ns;
+    unsigned long ops;
+    while (fgets(line, sizeof(line), f) != nullptr)
+      if (sscanf(line, " {\"name\": \"%255[^\"]\", \"ns_per_op\": %lf, "
+                 "\"ops\": %lu}", name, &ns, &ops) == 3)
+        results.push_back({name, ns, ops});
+    fclose(f);
+    return results;
+  }
+
+  /// @brief Prints the results next to the baseline.
+  /// @return Number of regressions.
+  int compare() const {
+    int regressions = 0;
+    printf("\n%-40s %12s %12s %9s\n", "Benchmark (ns/op)", "baseline",
+           "current", "change");
+    for (const Result &r : _results) {
+      const Result *b = baseline(r.name);
+      if (b == nullptr) {
+        printf("%-40s %12s %12.1f %9s\n", r.name.c_str(), "-", r.ns, "new");
+        continue;
+      }
+      bool slower = regressed(r.name, r.ns);
+      regressions += slower;
+      printf("%-40s %12.1f %12.1f %+8.1f%%%s\n", r.name.c_str(), b->ns, r.ns,
+             100.0 * (r.ns - b->ns) / b->ns, slower ? "  REGRESSED" : "");
+    }
+    return regressions;
+  }
+
+ private:
+  const Result *baseline(const std::string &name) const {
+    for (const Result &b : _baseline)
+      if (b.name == name) return &b;
+    return nullptr;
+  }
+
+  /// @return Whether a result is slower than the baseline allows.
+  bool regressed(const std::string &name, double ns) const {
+    const Result *b = baseline(name);
+    return b != nullptr && ns > b->ns * (1 + _tolerance / 100);
+  }
+
+  uint64_t timed(const std::function<void(uint64_t)> &body, uint64_t n) {
+    _paused = 0;
+    uint64_t begin = Metrics::now();
+    body(n);
+    uint64_t elapsed = Metrics::now() - begin;
+    return elapsed - std::min(_paused, elapsed);
+  }
+};
+
+#endif  // BENCH_HPP_
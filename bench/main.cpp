@@ -0,0 +1,1031 @@
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench/Bench.hpp"
+#include "common/Logger.hpp"
+#include "common/UDPSocket.hpp"
+#include "common/utils.hpp"
+#include "server/Archive.hpp"
+#include "server/Capture.hpp"
+#include "server/Cycles.hpp"
+#include "server/GameSession.hpp"
+#include "server/GameStorage.hpp"
+#include "server/Metrics.hpp"
+#include "server/Snapshot.hpp"
+#include "server/TCPServer.hpp"
+#include "server/TCPServerParser.hpp"
+#include "server/Tracer.hpp"
+#include "server/Trial.hpp"
+#include "server/UDPServer.hpp"
+#include "server/UDPServerParser.hpp"
+#include "server/WriteAheadLog.hpp"
+
+const char *DEFAULT_RESULTS = "bench/results.json";
+const char *DEFAULT_BASELINE = "bench/baseline.json";
+/// @brief Default slowdown in percent flagged as a regression.
+const double DEFAULT_TOLERANCE = 25;
+/// @brief Passes over the benchmarks still slower than the baseline,
+/// after the first one.
+const int PASSES = 3;
+
+/// @brief Table sizes storage benchmarks run at.
+const int SIZES[] = {1000, 100000, 1000000};
+/// @brief Players of the parser benchmarks, requests for all of them are
+/// rendered ahead.
+const int PLAYERS = 8192;
+
+std::mt19937 rng(1);
+
+/// @return Size in benchmark names, such as "100k".
+std::string sizeName(int n) {
+  return n >= 1000000 ? std::to_string(n / 1000000) + "M"
+         : n >= 1000  ? std::to_string(n / 1000) + "k"
+                      : std::to_string(n);
+}
+
+/// @return Distinct random codes.
+std::vector<Trial> distinctCodes(int n) {
+  std::vector<uint16_t> indices(Trial::CODES);
+  for (int i = 0; i < Trial::CODES; i++) indices[i] = i;
+  std::shuffle(indices.begin(), indices.end(), rng);
+  std::vector<Trial> codes;
+  for (int i = 0; i < n; i++) codes.push_back(Trial::fromIndex(indices[i]));
+  return codes;
+}
+
+/// @return Distinct codes, none of them R G B Y, the code of every debug
+/// game started by the benchmarks.
+std::vector<Trial> wrongCodes(int n) {
+  std::vector<Trial> codes = distinctCodes(n + 1);
+  std::erase(codes, Trial('R', 'G', 'B', 'Y'));
+  codes.resize(n);
+  return codes;
+}
+
+/// @return Won game, after a number of trials.
+GameSession wonGame(int trials) {
+  std::vector<Trial> codes = distinctCodes(trials);
+  GameSession s = GameSession::newDebugGame(600, codes[0]);
+  uint16_t nB, nW;
+  for (int nT = 1; nT <= trials; nT++) {
+    Trial t = codes[trials - nT];
+    s.executeTrial(t, nT, nB, nW);
+  }
+  return s;
+}
+
+std::string request(const char *fmt, int plid) {
+  char buf[BUFFER_SIZE];
+  snprintf(buf, sizeof(buf), fmt, plid);
+  return buf;
+}
+
+void benchTrial(Bench &bench) {
+  std::vector<Trial> codes(4096), trials(4096);
+  std::vector<std::array<char, 4>> colors(4096);
+  const char palette[] = "RGBYOPX";
+  for (int i = 0; i < 4096; i++) {
+    codes[i] = Trial::random();
+    trials[i] = Trial::random();
+    // One in seven colors is invalid.
+    for (char &c : colors[i]) c = palette[rng() % 7];
+  }
+  bench.run("trial/construct+isValid", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      const auto &c = colors[i % 4096];
+      Bench::keep(Trial(c[0], c[1], c[2], c[3]).isValid());
+    }
+  });
+  bench.run("trial/evaluateNumbers", [&](uint64_t n) {
+    uint16_t nB, nW;
+    for (uint64_t i = 0; i < n; i++) {
+      Bench::keep(trials[i % 4096].evaluateNumbers(codes[i % 4096], nB, nW));
+      Bench::keep(nB + nW);
+    }
+  });
+  GameSession played = wonGame(8);
+  bench.run("session/showTrials", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++)
+      Bench::keep(played.showTrials(i % 999999 + 1));
+  });
+}
+
+/// @brief Requests to the UDP parser, one opcode at a time.
+void benchUDPParser(Bench &bench) {
+  GameStorage store;
+  Metrics metrics;
+  UDPServerParser parser(store, metrics);
+  std::vector<std::string> sng, dbg, qut;
+  std::vector<std::string> tries[7];
+  std::vector<Trial> wrong = wrongCodes(8);
+  for (int p = 1; p <= PLAYERS; p++) {
+    sng.push_back(request("SNG %06d 600\n", p));
+    dbg.push_back(request("DBG %06d 600 R G B Y\n", p));
+    qut.push_back(request("QUT %06d\n", p));
+    for (int nT = 1; nT <= 7; nT++) {
+      const Trial &t = wrong[nT];
+      char buf[BUFFER_SIZE];
+      snprintf(buf, sizeof(buf), "TRY %06d %c %c %c %c %d\n", p, t.c1(), t.c2(),
+               t.c3(), t.c4(), nT);
+      tries[nT - 1].push_back(buf);
+    }
+  }
+  auto restart = [&] {
+    Bench::Pause pause(bench);
+    for (int p = 0; p < PLAYERS; p++) {
+      parser.executeRequest(qut[p].c_str());
+      parser.executeRequest(dbg[p].c_str());
+    }
+  };
+
+  bench.run("udp/SNG", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++)
+      Bench::keep(parser.executeRequest(sng[i % PLAYERS].c_str()));
+  });
+  bench.run("udp/DBG", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++)
+      Bench::keep(parser.executeRequest(dbg[i % PLAYERS].c_str()));
+  });
+  bench.run("udp/TRY", [&](uint64_t n) {
+    restart();
+    for (uint64_t i = 0; i < n; i++) {
+      uint64_t round = i / PLAYERS % 7;
+      if (i % PLAYERS == 0 && round == 0 && i > 0) restart();
+      Bench::keep(parser.executeRequest(tries[round][i % PLAYERS].c_str()));
+    }
+  });
+  bench.run("udp/QUT", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      if (i % PLAYERS == 0) restart();
+      Bench::keep(parser.executeRequest(qut[i % PLAYERS].c_str()));
+    }
+  });
+  bench.run("udp/invalid", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++)
+      Bench::keep(parser.executeRequest("TRY 12345 R G B Y 1\n"));
+  });
+}
+
+/// @brief The TRY that loses a game, with and without counting it in the
+/// player statistics, which is all the update costs on the TRY path.
+void benchStats(Bench &bench) {
+  std::vector<std::string> dbg, tries[8];
+  std::vector<Trial> wrong = wrongCodes(8);
+  for (int p = 1; p <= PLAYERS; p++) {
+    dbg.push_back(request("DBG %06d 600 R G B Y\n", p));
+    for (int nT = 1; nT <= 8; nT++) {
+      const Trial &t = wrong[nT - 1];
+      char buf[BUFFER_SIZE];
+      snprintf(buf, sizeof(buf), "TRY %06d %c %c %c %c %d\n", p, t.c1(), t.c2(),
+               t.c3(), t.c4(), nT);
+      tries[nT - 1].push_back(buf);
+    }
+  }
+  for (bool stats : {true, false}) {
+    std::string name = stats ? "udp/TRY loss" : "udp/TRY loss without stats";
+    if (!bench.selected(name)) continue;
+    GameStorage store;
+    store.countStats(stats);
+    Metrics metrics;
+    UDPServerParser parser(store, metrics);
+    bench.run(name, [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; i++) {
+        if (i % PLAYERS == 0) {
+          // Every game is one trial from its end.
+          Bench::Pause pause(bench);
+          for (int p = 0; p < PLAYERS; p++) {
+            parser.executeRequest(dbg[p].c_str());
+            for (int nT = 1; nT < 8; nT++)
+              parser.executeRequest(tries[nT - 1][p].c_str());
+          }
+        }
+        Bench::keep(parser.executeRequest(tries[7][i % PLAYERS].c_str()));
+      }
+    });
+  }
+}
+
+/// @brief Batches of TRY retransmissions over a million sessions, staged as
+/// UDPServer stages them.
+void benchBatch(Bench &bench) {
+  if (!bench.selected("udp/batch/1M")) return;
+  const int players = 999999;
+  GameStorage store;
+  Metrics metrics;
+  UDPServerParser parser(store, metrics);
+  // Every game made one wrong trial, which each request sends again.
+  Trial wrong = wrongCodes(1)[0];
+  char buf[BUFFER_SIZE];
+  for (int p = 1; p <= players; p++) {
+    parser.executeRequest(request("DBG %06d 600 R G B Y\n", p).c_str());
+    snprintf(buf, sizeof(buf), "TRY %06d %c %c %c %c 1\n", p, wrong.c1(),
+             wrong.c2(), wrong.c3(), wrong.c4());
+    parser.executeRequest(buf);
+  }
+  std::vector<std::string> tries(1 << 16);
+  for (std::string &t : tries) {
+    snprintf(buf, sizeof(buf), "TRY %06d %c %c %c %c 1\n",
+             (int)(rng() % players + 1), wrong.c1(), wrong.c2(), wrong.c3(),
+             wrong.c4());
+    t = buf;
+  }
+  UDPServerParser::Request batch[UDPServer::BATCH_SIZE];
+  bench.run("udp/batch/1M", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i += UDPServer::BATCH_SIZE) {
+      for (int k = 0; k < UDPServer::BATCH_SIZE; k++)
+        batch[k] = parser.parse(tries[(i + k) % tries.size()].c_str());
+      for (int k = 0; k < UDPServer::BATCH_SIZE; k++)
+        Bench::keep(parser.execute(batch[k]));
+    }
+  });
+}
+
+/// @brief Whole games, a DBG and a winning TRY, with the durability and
+/// history features on and off.
+void benchGames(Bench &bench) {
+  std::string wal = "/tmp/GSbench-" + std::to_string(getpid()) + ".wal";
+  std::string archive =
+      "/tmp/GSbench-" + std::to_string(getpid()) + ".archive";
+  std::vector<std::string> dbg, win;
+  for (int p = 1; p <= PLAYERS; p++) {
+    dbg.push_back(request("DBG %06d 600 R G B Y\n", p));
+    win.push_back(request("TRY %06d R G B Y 1\n", p));
+  }
+  for (const char *variant : {"", "+wal", "+archive"}) {
+    std::string name = std::string("udp/game") + variant;
+    if (!bench.selected(name)) continue;
+    GameStorage store;
+    Metrics metrics;
+    UDPServerParser parser(store, metrics);
+    std::unique_ptr<WriteAheadLog> log;
+    std::unique_ptr<Archive::Writer> writer;
+    if (strcmp(variant, "+wal") == 0) {
+      unlink(wal.c_str());
+      log = std::make_unique<WriteAheadLog>(wal.c_str(), 10);
+      store.recover(*log);
+    } else if (strcmp(variant, "+archive") == 0) {
+      unlink(archive.c_str());
+      writer = std::make_unique<Archive::Writer>(archive.c_str());
+      store.archiveTo(*writer);
+    }
+    bench.run(name, [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; i++) {
+        Bench::keep(parser.executeRequest(dbg[i % PLAYERS].c_str()));
+        Bench::keep(parser.executeRequest(win[i % PLAYERS].c_str()));
+        // As often as the event loop would get to it.
+        if (log && i % 1024 == 0) {
+          utils_clock.refresh();
+          log->tick();
+        }
+      }
+    });
+  }
+  unlink(wal.c_str());
+  unlink(archive.c_str());
+}
+
+/// @brief Queries of the TCP parser over 100k finished games.
+void benchTCPParser(Bench &bench) {
+  if (!bench.selected({"tcp/STR", "tcp/SSB", "tcp/SSB uncached",
+                       "tcp/SSB PAGE", "tcp/SSB PAGE uncached", "tcp/SSB RANK",
+                       "tcp/SPS"}))
+    return;
+  const int players = 100000;
+  GameStorage store;
+  Metrics metrics;
+  UDPServerParser udp(store, metrics);
+  TCPServerParser tcp(store, metrics);
+  std::vector<Trial> codes = wrongCodes(8);
+  for (int p = 1; p <= players; p++) {
+    udp.executeRequest(request("DBG %06d 600 R G B Y\n", p).c_str());
+    // Wins after 1 to 8 trials, so scores differ.
+    int trials = p % 8 + 1;
+    for (int nT = 1; nT <= trials; nT++) {
+      Trial t = nT == trials ? Trial('R', 'G', 'B', 'Y') : codes[nT];
+      char buf[BUFFER_SIZE];
+      snprintf(buf, sizeof(buf), "TRY %06d %c %c %c %c %d\n", p, t.c1(),
+               t.c2(), t.c3(), t.c4(), nT);
+      udp.executeRequest(buf);
+    }
+  }
+  std::vector<int> plids(4096);
+  for (int &p : plids) p = rng() % players + 1;
+  static char buf[TCPServer::MAX_REPLY];
+  auto query = [&](const char *name, const char *fmt) {
+    bench.run(name, [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; i++) {
+        snprintf(buf, sizeof(buf), fmt, plids[i % plids.size()]);
+        Bench::keep(tcp.executeRequest(buf, sizeof(buf)));
+      }
+    });
+  };
+  query("tcp/STR", "STR %06d\n");
+  // The same replies rendered every time, as without the render cache.
+  auto uncached = [&](const char *name, size_t first) {
+    bench.run(name, [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; i++) {
+        std::string page = store.getScoreboardString(first);
+        snprintf(buf, sizeof(buf), "RSS OK SCORES%14s.txt %lu %s\n",
+                 utils_clock.fileString(), page.size(), page.c_str());
+        Bench::keep(buf);
+      }
+    });
+  };
+  query("tcp/SSB", "SSB\n");
+  uncached("tcp/SSB uncached", 0);
+  query("tcp/SSB PAGE", "SSB PAGE 50\n");
+  uncached("tcp/SSB PAGE uncached", 49 * GameStorage::SCOREBOARD_PAGE);
+  query("tcp/SSB RANK", "SSB RANK %06d\n");
+  query("tcp/SPS", "SPS %06d\n");
+}
+
+/// @brief TRY and STR over a session table shared with forked processes,
+/// as with -x: TRY while other processes read STR, STR while another
+/// process plays. With fewer cores than processes, the cost includes the
+/// time the others take from the one measured.
+void benchShared(Bench &bench) {
+  if (!bench.selected({"shared/TRY", "shared/TRY+2 readers", "shared/STR",
+                       "shared/STR+writer"}))
+    return;
+  GameStorage store(true);
+  Metrics metrics;
+  UDPServerParser udp(store, metrics);
+  TCPServerParser tcp(store, metrics);
+  std::vector<std::string> dbg, qut, str;
+  std::vector<std::string> tries[7];
+  std::vector<Trial> wrong = wrongCodes(8);
+  for (int p = 1; p <= PLAYERS; p++) {
+    dbg.push_back(request("DBG %06d 600 R G B Y\n", p));
+    qut.push_back(request("QUT %06d\n", p));
+    str.push_back(request("STR %06d\n", p));
+    for (int nT = 1; nT <= 7; nT++) {
+      const Trial &t = wrong[nT];
+      char buf[BUFFER_SIZE];
+      snprintf(buf, sizeof(buf), "TRY %06d %c %c %c %c %d\n", p, t.c1(),
+               t.c2(), t.c3(), t.c4(), nT);
+      tries[nT - 1].push_back(buf);
+    }
+  }
+  auto restart = [&] {
+    for (int p = 0; p < PLAYERS; p++) {
+      udp.executeRequest(qut[p].c_str());
+      udp.executeRequest(dbg[p].c_str());
+    }
+  };
+  auto play = [&](uint64_t i) {
+    uint64_t round = i / PLAYERS % 7;
+    if (i % PLAYERS == 0 && round == 0 && i > 0) restart();
+    Bench::keep(udp.executeRequest(tries[round][i % PLAYERS].c_str()));
+  };
+  static char buf[TCPServer::MAX_REPLY];
+  auto read = [&](uint64_t i) {
+    strcpy(buf, str[i % PLAYERS].c_str());
+    Bench::keep(tcp.executeRequest(buf, sizeof(buf)));
+  };
+  restart();
+
+  // Other processes run until told to stop, between two requests.
+  std::atomic<bool> *stop = (std::atomic<bool> *)mmap(
+      nullptr, sizeof(std::atomic<bool>), PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (stop == MAP_FAILED) ERROR("Failed to map: %s\n", strerror(errno));
+  auto spawn = [&](int count, auto &&loop) {
+    std::vector<pid_t> children;
+    *stop = false;
+    fflush(stdout);
+    for (int c = 0; c < count; c++) {
+      pid_t pid = fork();
+      if (pid == -1) ERROR("Failed to fork: %s\n", strerror(errno));
+      if (pid == 0) {
+        for (uint64_t i = c; !*stop; i++) loop(i);
+        _exit(0);
+      }
+      children.push_back(pid);
+    }
+    return children;
+  };
+  auto join = [&](const std::vector<pid_t> &children) {
+    *stop = true;
+    for (pid_t pid : children) waitpid(pid, nullptr, 0);
+  };
+
+  uint64_t played = 0;
+  auto measurePlay = [&](const char *name, int readers) {
+    if (!bench.selected(name)) return;
+    std::vector<pid_t> children = spawn(readers, read);
+    bench.run(name, [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; i++) play(played++);
+    });
+    join(children);
+  };
+  measurePlay("shared/TRY", 0);
+  measurePlay("shared/TRY+2 readers", 2);
+
+  // Only one process may change the sessions: the parent reads alone.
+  auto measureRead = [&](const char *name, int writers) {
+    if (!bench.selected(name)) return;
+    std::vector<pid_t> children =
+        spawn(writers, [&](uint64_t i) { play(played + i); });
+    bench.run(name, [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; i++) read(i);
+    });
+    join(children);
+  };
+  measureRead("shared/STR", 0);
+  measureRead("shared/STR+writer", 1);
+  munmap(stop, sizeof(std::atomic<bool>));
+}
+
+/// @brief Runs of a benchmark timed by the caller, too slow to repeat
+/// until a run lasts long enough.
+const int SLOW_RUNS = 5;
+
+/// @brief Session lookups, scoreboard inserts, snapshots and restores at
+/// several table sizes.
+void benchStorage(Bench &bench) {
+  std::vector<GameSession> wins;
+  for (int i = 0; i < 1024; i++) wins.push_back(wonGame(i % 8 + 1));
+  for (int size : SIZES) {
+    std::string lookup = "storage/getSession/" + sizeName(size);
+    std::string insert = "storage/addToScoreboard/" + sizeName(size);
+    std::string rank = "storage/rank/" + sizeName(size);
+    std::string save = "storage/snapshot save/" + sizeName(size);
+    std::string restore = "storage/restore/" + sizeName(size);
+    if (!bench.selected({lookup, insert, rank, save, restore})) continue;
+
+    // Every session played and won once.
+    auto fill = [&] {
+      auto store = std::make_unique<GameStorage>();
+      for (int p = 1; p <= size; p++) {
+        GameSession &s =
+            store->newSession(p, wins[p % wins.size()]);
+        store->addToScoreboard(p, s);
+      }
+      return store;
+    };
+    std::unique_ptr<GameStorage> store = fill();
+    std::vector<int> plids(1 << 16);
+    for (int &p : plids) p = rng() % size + 1;
+
+    bench.run(lookup, [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; i++)
+        Bench::keep(&store->getSession(plids[i % plids.size()]));
+    });
+    bench.run(rank, [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; i++)
+        Bench::keep(store->getRankString(plids[i % plids.size()]));
+    });
+    // What a snapshot pauses the server for, and what a restart takes from
+    // the snapshot file to serving. Only a few of each are made, as every
+    // snapshot writes the whole table.
+    std::string path =
+        "/tmp/GSbench-" + std::to_string(getpid()) + ".snapshot";
+    if (bench.selected({save, restore})) {
+      Snapshot snapshot(path.c_str(), 3600);
+      double best = 0;
+      for (int r = 0; r < SLOW_RUNS; r++) {
+        uint64_t begin = Metrics::now();
+        snapshot.save(*store, nullptr);
+        uint64_t ns = Metrics::now() - begin;
+        if (r == 0 || ns < best) best = ns;
+        while (snapshot.running()) {
+          usleep(1000);
+          snapshot.tick(*store, nullptr);
+        }
+      }
+      bench.record(save, best, SLOW_RUNS);
+      for (int r = 0; r < SLOW_RUNS; r++) {
+        uint64_t begin = Metrics::now();
+        auto restored = std::make_unique<GameStorage>();
+        uint64_t walPosition;
+        if (!snapshot.load(*restored, walPosition))
+          ERROR("Failed to restore %s.\n", path.c_str());
+        restored->settle();
+        uint64_t ns = Metrics::now() - begin;
+        if (r == 0 || ns < best) best = ns;
+      }
+      bench.record(restore, best, SLOW_RUNS);
+      unlink(path.c_str());
+    }
+    // The scoreboard only grows, it is refilled before doubling.
+    uint64_t inserted = 0;
+    bench.run(insert, [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; i++) {
+        if (++inserted > (uint64_t)size) {
+          Bench::Pause pause(bench);
+          store.reset();
+          store = fill();
+          inserted = 1;
+        }
+        int p = plids[i % plids.size()];
+        store->addToScoreboard(p, wins[i % wins.size()]);
+      }
+    });
+  }
+}
+
+/// @brief Session lookups over a million won games with a memory budget of
+/// a quarter of the table, so most lookups read a page back from the spill
+/// file and evict another.
+void benchSpill(Bench &bench) {
+  const std::string name = "storage/getSession spilled/1M";
+  if (!bench.selected(name)) return;
+  const int size = 1000000;
+  std::string path = "/tmp/GSbench-" + std::to_string(getpid()) + ".spill";
+  {
+    GameStorage store;
+    SessionSpill spill(store.sessions(), path.c_str(), SessionTable::BYTES / 4);
+    store.spillTo(spill);
+    GameSession win = wonGame(4);
+    for (int p = 1; p <= size; p++) store.newSession(p, win);
+    std::vector<int> plids(1 << 16);
+    for (int &p : plids) p = rng() % size + 1;
+    bench.run(name, [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; i++)
+        Bench::keep(&store.getSession(plids[i % plids.size()]));
+    });
+  }
+  unlink(path.c_str());
+}
+
+/// @brief Whole games played by threads over disjoint players of a
+/// threaded storage. Also checks that no game was lost on the way.
+/// @return Whether the storage stayed consistent.
+bool benchThreads(Bench &bench) {
+  bool ok = true;
+  for (int threads : {1, 2, 4}) {
+    const int players = 50000;
+    GameStorage store(false, true);
+    Metrics metrics;
+    bench.run("storage/threads/" + std::to_string(threads), [&](uint64_t n) {
+      std::vector<std::thread> workers;
+      std::atomic<uint64_t> wins = 0;
+      for (int t = 0; t < threads; t++)
+        workers.emplace_back([&, t] {
+          UDPServerParser parser(store, metrics);
+          char buf[BUFFER_SIZE];
+          for (uint64_t g = t; g < n; g += threads) {
+            int plid = t * players + g / threads % players + 1;
+            snprintf(buf, sizeof(buf), "DBG %06d 600 R G B Y\n", plid);
+            parser.executeRequest(buf);
+            snprintf(buf, sizeof(buf), "TRY %06d R G B Y 1\n", plid);
+            if (strncmp(parser.executeRequest(buf), "RTR OK", 6) == 0) wins++;
+          }
+        });
+      for (auto &w : workers) w.join();
+      if (wins != n) {
+        fprintf(stderr, "%d threads won %lu of %lu games.\n", threads,
+                (unsigned long)wins.load(), (unsigned long)n);
+        ok = false;
+      }
+    });
+  }
+  return ok;
+}
+
+/// @brief Has threads start, play, win, lose and quit games of the same few
+/// players on a threaded storage, then checks that every game started is
+/// counted once: won games on the scoreboard, finished games in the
+/// statistics, and games still being played timed out by tick().
+/// @return Whether the storage stayed consistent.
+bool checkOverlapping() {
+  const int threads = 4, players = 64, requests = 20000;
+  GameStorage store(false, true);
+  Metrics metrics;
+  std::atomic<uint64_t> wins = 0, losses = 0, quits = 0;
+  std::atomic<bool> started[players + 1] = {};
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++)
+    workers.emplace_back([&, t] {
+      UDPServerParser parser(store, metrics);
+      std::mt19937 random(t);
+      // Trials of a thread start with its own color, so none is taken for
+      // the retry of another thread's and answered, and counted, twice.
+      // Only the first thread guesses the code.
+      const char colors[] = "RGBYOP";
+      char buf[BUFFER_SIZE], guess[8];
+      for (int i = 0; i < requests; i++) {
+        int plid = random() % players + 1;
+        const char *reply;
+        switch (random() % 4) {
+          case 0:
+            snprintf(buf, sizeof(buf), "DBG %06d 600 R G B Y\n", plid);
+            if (strcmp(parser.executeRequest(buf), "RDB OK\n") == 0)
+              started[plid] = true;
+            break;
+          case 1:
+            snprintf(buf, sizeof(buf), "SNG %06d 600\n", plid);
+            if (strcmp(parser.executeRequest(buf), "RSG OK\n") == 0)
+              started[plid] = true;
+            break;
+          case 2:
+            snprintf(buf, sizeof(buf), "QUT %06d\n", plid);
+            if (strncmp(parser.executeRequest(buf), "RQT OK", 6) == 0) quits++;
+            break;
+          default:
+            if (t == 0 && random() % 2 == 0)
+              strcpy(guess, "R G B Y");
+            else
+              snprintf(guess, sizeof(guess), "%c %c %c %c", colors[t],
+                       colors[random() % 6], colors[random() % 6],
+                       colors[random() % 6]);
+            // Another thread may take the trial first, which is then INV.
+            snprintf(buf, sizeof(buf), "TRY %06d %s %d\n", plid, guess,
+                     store.readSession(plid).nT());
+            reply = parser.executeRequest(buf);
+            if (strncmp(reply, "RTR OK", 6) == 0 && strstr(reply, " 4 0\n"))
+              wins++;
+            else if (strncmp(reply, "RTR ENT", 7) == 0)
+              losses++;
+        }
+      }
+    });
+  for (auto &w : workers) w.join();
+
+  bool ok = true;
+  // On a thread of its own, as its clock is moved past every deadline.
+  std::thread([&] {
+    uint64_t playing = 0, sessions = 0;
+    for (int p = 1; p <= players; p++) {
+      sessions += started[p];
+      playing += store.readSession(p).result() == GameSession::PLAYING;
+    }
+    utils_clock.set(utils_clock.now() + 601);
+    store.tick();
+    uint64_t games = 0;
+    for (int p = 1; p <= players; p++) games += store.stats()[p].games();
+    uint64_t ended = wins + losses + quits;
+    if (store.scoreboard().size() != wins) {
+      fprintf(stderr, "Scoreboard has %zu games of %lu won.\n",
+              store.scoreboard().size(), (unsigned long)wins.load());
+      ok = false;
+    }
+    if (games != ended + playing) {
+      fprintf(stderr, "Statistics count %lu games of %lu ended and %lu "
+              "timed out.\n", (unsigned long)games, (unsigned long)ended,
+              (unsigned long)playing);
+      ok = false;
+    }
+    if (store.sessionCount() != sessions) {
+      fprintf(stderr, "Storage counts %lu sessions of %lu started.\n",
+              (unsigned long)store.sessionCount(), (unsigned long)sessions);
+      ok = false;
+    }
+  }).join();
+  return ok;
+}
+
+/// @brief Sends stdout and stderr to /dev/null while alive, for benchmarks
+/// of logging: the log and the warnings of the records it drops are
+/// silenced, the results are printed on the original stdout.
+class Silence {
+ private:
+  Bench &_bench;
+  int _out, _err, _null;
+  FILE *_results;
+
+ public:
+  Silence(Bench &bench) : _bench(bench) {
+    fflush(stdout);
+    _out = dup(STDOUT_FILENO);
+    _err = dup(STDERR_FILENO);
+    _null = open("/dev/null", O_WRONLY);
+    _results = fdopen(dup(_out), "w");
+    _bench.output(_results);
+    dup2(_null, STDOUT_FILENO);
+    dup2(_null, STDERR_FILENO);
+  }
+
+  ~Silence() {
+    fflush(stdout);
+    dup2(_out, STDOUT_FILENO);
+    dup2(_err, STDERR_FILENO);
+    close(_out);
+    close(_err);
+    close(_null);
+    _bench.output(stdout);
+    fclose(_results);
+  }
+};
+
+/// @brief Requests through a UDP server on the loopback, batched and not.
+void benchNetwork(Bench &bench) {
+  if (!bench.selected({"net/udp batch 1", "net/udp batch 32",
+                       "net/udp batch 32+verbose sync",
+                       "net/udp batch 32+verbose", "net/udp batch 32+capture"}))
+    return;
+  GameStorage store;
+  Metrics metrics;
+  UDPServerParser parser(store, metrics);
+  UDPServer server("0", "127.0.0.1");
+  sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  getsockname(server.socket().fd(), (sockaddr *)&addr, &len);
+  UDPSocket client;
+  std::vector<std::string> sng;
+  for (int p = 1; p <= PLAYERS; p++) sng.push_back(request("SNG %06d 600\n", p));
+  // Runs may wait for the logger thread to take every record logged.
+  auto run = [&](const std::string &name, int batch, bool flushLog = false) {
+    bench.run(name, [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; i += batch) {
+        for (int k = 0; k < batch; k++)
+          client.sendto(sng[(i + k) % PLAYERS].c_str(), (sockaddr &)addr,
+                        len);
+        server.processRequest(parser);
+        for (int k = 0; k < batch; k++)
+          Bench::keep(client.recvfrom(nullptr, nullptr));
+      }
+      if (flushLog) utils_logger.flush();
+    });
+  };
+  for (int batch : {1, UDPServer::BATCH_SIZE})
+    run("net/udp batch " + std::to_string(batch), batch);
+  if (bench.selected({"net/udp batch 32+verbose sync",
+                      "net/udp batch 32+verbose"})) {
+    // With -v: first every request formatted and written by the thread
+    // serving it, as before the logger thread, then through the logger
+    // thread, waiting for it so the time spent formatting is counted too.
+    uint64_t dropped;
+    {
+      Silence silence(bench);
+      utils_verbose_flag = true;
+      run("net/udp batch 32+verbose sync", UDPServer::BATCH_SIZE);
+      utils_logger.start();
+      dropped = utils_logger.dropped();
+      run("net/udp batch 32+verbose", UDPServer::BATCH_SIZE, true);
+      utils_verbose_flag = false;
+    }
+    if (utils_logger.dropped() != dropped)
+      fprintf(stderr, "net/udp batch 32+verbose dropped %lu log records.\n",
+              (unsigned long)(utils_logger.dropped() - dropped));
+  }
+  if (!bench.selected("net/udp batch 32+capture")) return;
+  std::string path =
+      "/tmp/GSbench-" + std::to_string(getpid()) + ".capture";
+  {
+    Capture::Writer capture(path.c_str());
+    server.captureTo(capture);
+    run("net/udp batch 32+capture", UDPServer::BATCH_SIZE);
+  }
+  unlink(path.c_str());
+}
+
+/// @brief Has a forked TCP child answer a request that arrives in pieces
+/// while writers wait in their threads, as with GS -k and -a, and checks
+/// that it exits once it has replied.
+/// @return Whether the child exited.
+bool checkForkedChild() {
+  std::string path = "/tmp/GSbench-" + std::to_string(getpid()) + ".fork";
+  bool exited;
+  {
+    GameStorage store;
+    Archive::Writer archive((path + ".archive").c_str());
+    store.archiveTo(archive);
+    Metrics metrics;
+    TCPServerParser parser(store, metrics);
+    Capture::Writer capture((path + ".capture").c_str());
+    TCPServer server("0", "127.0.0.1");
+    server.captureTo(capture);
+    sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    getsockname(server.socket().fd(), (sockaddr *)&addr, &len);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (sockaddr *)&addr, len) == -1)
+      ERROR("Failed to connect to TCP server: %s\n", strerror(errno));
+    send(fd, "STR 00", 6, 0);
+    if (server.processRequest(parser)) TCPServer::exitChild();
+    send(fd, "0001\n", 5, 0);
+    // The reply, then the end of the stream once the child is gone.
+    timeval timeout = {.tv_sec = 5, .tv_usec = 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    char buf[BUFFER_SIZE];
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) continue;
+    exited = n == 0;
+    close(fd);
+  }
+  unlink((path + ".archive").c_str());
+  unlink((path + ".capture").c_str());
+  if (!exited) fprintf(stderr, "A forked TCP child did not exit.\n");
+  return exited;
+}
+
+/// @brief Asks for STATS, STATS PROM and CYCLES with a request buffer much
+/// smaller than their replies, and checks that each reply holds the whole
+/// body its status line announces.
+/// @return Whether every reply was whole.
+bool checkLargeReplies() {
+  GameStorage store;
+  Metrics metrics;
+  TCPServerParser parser(store, metrics);
+  bool ok = true;
+  for (const char *request : {"STATS\n", "STATS PROM\n", "CYCLES\n"}) {
+    char buf[BUFFER_SIZE];
+    strcpy(buf, request);
+    const char *reply = parser.executeRequest(buf, sizeof(buf));
+    const char *body = strchr(reply, '\n');
+    unsigned long size;
+    if (sscanf(reply, "%*s OK %lu\n", &size) != 1 || body == nullptr ||
+        strlen(body + 1) != size) {
+      fprintf(stderr, "Reply to %.*s is not whole.\n",
+              (int)strlen(request) - 1, request);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+/// @brief Commits log records to a file that can only hold some of them, as
+/// on a full disk, then again once it can hold them all, and checks that
+/// every record is replayed once and in order.
+/// @return Whether the log stayed whole.
+bool checkTornCommit(Bench &bench) {
+  std::string path = "/tmp/GSbench-" + std::to_string(getpid()) + ".wal";
+  const int records = 8;
+  std::vector<int> replayed;
+  {
+    WriteAheadLog wal(path.c_str(), 1000);
+    for (int p = 1; p <= records; p++)
+      wal.append(WriteAheadLog::START, p, wonGame(4));
+    // Room for the header and two and a half records.
+    rlimit limit, full;
+    getrlimit(RLIMIT_FSIZE, &full);
+    limit = full;
+    limit.rlim_cur = 16 + sizeof(WriteAheadLog::Record) * 5 / 2;
+    signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &limit);
+    {
+      Silence silence(bench);
+      wal.commit();
+    }
+    setrlimit(RLIMIT_FSIZE, &full);
+    signal(SIGXFSZ, SIG_DFL);
+    wal.commit();
+  }
+  {
+    WriteAheadLog wal(path.c_str(), 1000);
+    wal.replay(0, [&](WriteAheadLog::Operation, int plid, const GameSession &,
+                      time_t) { replayed.push_back(plid); });
+  }
+  unlink(path.c_str());
+  bool ok = replayed.size() == records;
+  for (int i = 0; ok && i < records; i++) ok = replayed[i] == i + 1;
+  if (!ok)
+    fprintf(stderr, "A log commit cut short replays %zu of %d records.\n",
+            replayed.size(), records);
+  return ok;
+}
+
+/// @brief Costs paid on every request whether the feature is used or not.
+void benchInstrumentation(Bench &bench) {
+  static Histogram histogram;
+  bench.run("metrics/histogram record", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) histogram.record(i * 2654435761u >> 12);
+  });
+  bench.run("metrics/histogram record alone", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++)
+      histogram.recordAlone(i * 2654435761u >> 12);
+  });
+  // All UDPServer records of a request: clock reads and traffic counters
+  // shared by a batch, opcode and result read from the texts, the batch
+  // tallied into the latency histograms, and its queueing times.
+  {
+    Metrics metrics;
+    const char *requests[] = {"TRY 123456 R G B Y 1\n", "SNG 123456 600\n"};
+    const char *replies[] = {"RTR OK 1 0 0\n", "RSG OK\n"};
+    uint64_t queued[UDPServer::BATCH_SIZE];
+    for (int k = 0; k < UDPServer::BATCH_SIZE; k++) queued[k] = 20000 + k;
+    bench.run("metrics/udp request", [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; i += UDPServer::BATCH_SIZE) {
+        uint64_t received = Metrics::now();
+        Metrics::Opcode opcodes[UDPServer::BATCH_SIZE];
+        for (int k = 0; k < UDPServer::BATCH_SIZE; k++)
+          opcodes[k] = Metrics::opcode(requests[k & 1]);
+        Metrics::Result results[UDPServer::BATCH_SIZE];
+        for (int k = 0; k < UDPServer::BATCH_SIZE; k++)
+          results[k] = Metrics::result(replies[k & 1]);
+        uint64_t latency = Metrics::now() - received;
+        metrics.record(UDPServer::BATCH_SIZE, opcodes, results, latency,
+                       queued);
+        metrics.count(Metrics::UDP, UDPServer::BATCH_SIZE, 640, 320, 0);
+      }
+    });
+  }
+  bench.run("tracer/stage off", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) Tracer::Stage stage("bench");
+  });
+  bench.run("cycles/timer off", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) Cycles::Timer timer(Cycles::PARSE);
+  });
+  bench.run("cycles/now", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) Bench::keep(Cycles::now());
+  });
+  if (!bench.selected({"logger/record", "logger/text"})) return;
+  // Only the calling thread's cost is measured: records the logger thread
+  // can not keep up with are dropped.
+  Silence silence(bench);
+  {
+    Logger logger;
+    logger.start();
+    sockaddr_in from = {};
+    UDPServerParser::Request r;
+    r.text = "TRY 123456 R G B Y 1\n";
+    bench.run("logger/record", [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; i++)
+        logger.record(Logger::VERBOSE_LOG, 0,
+                      UDPServerParser::RequestLog(from, r, "RTR OK 1 0 0\n"));
+    });
+    bench.run("logger/text", [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; i++)
+        logger.text(Logger::VERBOSE_LOG, 0, "Sending back: %s\n",
+                    "RTR OK 1 0 0\n");
+    });
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *filter = nullptr;
+  const char *resultsPath = DEFAULT_RESULTS;
+  const char *baselinePath = DEFAULT_BASELINE;
+  double tolerance = DEFAULT_TOLERANCE;
+  double minSeconds = 0.2;
+
+  // Handle CLI Flags
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+      filter = argv[++i];
+    else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+      resultsPath = argv[++i];
+    else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+      baselinePath = argv[++i];
+    else if (strcmp(argv[i], "-B") == 0)
+      baselinePath = nullptr;
+    else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+      tolerance = std::max(atof(argv[++i]), 0.0);
+    else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+      minSeconds = std::max(atof(argv[++i]), 0.01);
+    else {
+      fprintf(stderr, "Usage: %s [-f filter] [-o results] [-b baseline | -B] "
+              "[-t tolerance_percent] [-s min_seconds]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  utils_clock.refresh();
+  Bench bench(filter, minSeconds);
+  std::vector<Bench::Result> baseline;
+  if (baselinePath != nullptr) {
+    baseline = Bench::read(baselinePath);
+    if (baseline.empty())
+      WARN("No baseline in %s, nothing to compare.\n", baselinePath);
+    bench.compareTo(baseline, tolerance);
+  }
+  bool consistent = checkForkedChild();
+  consistent = checkOverlapping() && consistent;
+  consistent = checkTornCommit(bench) && consistent;
+  consistent = checkLargeReplies() && consistent;
+  for (int pass = 0; pass <= PASSES; pass++) {
+    if (pass > 0) {
+      std::vector<std::string> slower = bench.regressions();
+      if (slower.empty()) break;
+      printf("\nRunning %zu benchmarks slower than the baseline again\n",
+             slower.size());
+      bench.retry(slower);
+    }
+    benchTrial(bench);
+    benchUDPParser(bench);
+    benchStats(bench);
+    benchBatch(bench);
+    benchGames(bench);
+    benchTCPParser(bench);
+    benchShared(bench);
+    benchStorage(bench);
+    benchSpill(bench);
+    consistent = benchThreads(bench) && consistent;
+    benchNetwork(bench);
+    benchInstrumentation(bench);
+  }
+
+  if (!bench.write(resultsPath))
+    ERROR("Failed to write %s: %s\n", resultsPath, strerror(errno));
+  printf("\nResults written to %s\n", resultsPath);
+  int regressions = 0;
+  if (!baseline.empty()) {
+    regressions = bench.compare();
+    printf("\n%d regressions over %.0f%%\n", regressions, tolerance);
+  }
+  return regressions == 0 && consistent ? 0 : 1;
+}
@@ -0,0 +1,275 @@
+#ifndef ASYNCUDPCLIENT_HPP_
+#define ASYNCUDPCLIENT_HPP_
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <client/RetransmitTimer.hpp>
+#include <client/UDPClient.hpp>
+#include <common/UDPSocket.hpp>
+
+/// @brief UDP client with many requests in flight, for programs playing
+/// many games at once.
+/// Every player has a socket of its own, kept from its first request for
+/// the life of the client, so the server sees one address per player
+/// however its requests are spaced. A reply is matched to its player by the
+/// socket it arrives on and to the request by its reply code and, for
+/// trials, its trial number. Replies to earlier transmissions of a request
+/// already answered are dropped. A player has one request in flight at a
+/// time, the protocol being sequential, and later ones wait behind it.
+///
+/// Requests answered on their first transmission time the server, and the
+/// wait for replies follows its round trips (see RetransmitTimer).
+///
+/// Nothing happens outside poll(), which sends the retransmissions due and
+/// completes the requests answered, calling their callbacks.
+class AsyncUDPClient {
+ public:
+  /// @brief Max number of retries for commands
+  static const int MAX_RETRIES = 3;
+
+  /// @brief Outcome of a request.
+  struct Completion {
+    /// @brief Reply, null if none came after MAX_RETRIES retries. Only
+    /// valid during the callback.
+    const char *reply;
+    /// @brief Transmissions made, every one after the first a retry.
+    int sends;
+    /// @brief Nanoseconds from the first transmission to the reply.
+    uint64_t latency;
+  };
+  using Callback = std::function<void(const Completion &)>;
+
+ private:
+  struct Request {
+    std::string text;
+    /// @brief Code replies to the request start with.
+    const char *code;
+    /// @brief Trial number of a TRY, replies with another are stale.
+    int nT;
+    int sends = 0;
+    /// @brief Time of the first transmission.
+    uint64_t first = 0;
+    Callback done;
+  };
+
+  struct Peer {
+    UDPSocket socket;
+    std::deque<Request> queue;
+    /// @brief Timer of the transmission in flight, 0 if none.
+    uint64_t sequence = 0;
+  };
+
+  struct Timer {
+    uint64_t deadline;
+    int plid;
+    uint64_t sequence;
+    bool operator>(const Timer &t) const { return deadline > t.deadline; }
+  };
+
+  struct addrinfo *_res = nullptr;
+  int _epoll;
+  /// @brief Wait for replies, estimated from those of all players.
+  RetransmitTimer _timer;
+  std::unordered_map<int, std::unique_ptr<Peer>> _peers;
+  std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> _timers;
+  size_t _pending = 0;
+  /// @brief Percentage of transmissions dropped on purpose.
+  int _loss = 0;
+  std::minstd_rand _rng;
+  /// @brief Last timer made. Never reused, so the timers of transmissions
+  /// answered are told apart from the one in flight.
+  uint64_t _sequence = 0;
+  char _buf[BUFFER_SIZE];
+
+  // Delete copy constructor to prevent accidental copies
+  AsyncUDPClient(const AsyncUDPClient &) = delete;
+  AsyncUDPClient &operator=(const AsyncUDPClient &) = delete;
+
+  /// @brief (Re)transmits the request in flight of a player.
+  void transmit(int plid, Peer &p, uint64_t at) {
+    Request &r = p.queue.front();
+    if (r.sends++ == 0) r.first = at;
+    DEBUG("Sending via UDP: %s", r.text.c_str());
+    bool lost = _loss > 0 && (int)(_rng() % 100) < _loss;
+    if (!lost && ::sendto(p.socket.fd(), r.text.data(), r.text.size(), 0,
+                          _res->ai_addr, _res->ai_addrlen) == -1)
+      DEBUG("UDP Failed to send %zu bytes: %s\n", r.text.size(),
+            strerror(errno));
+    _timers.push(
+        {at + _timer.timeout(r.sends - 1), plid, p.sequence = ++_sequence});
+  }
+
+  /// @brief Completes the request in flight of a player, and sends the next
+  /// one if queued.
+  void complete(int plid, const char *reply, uint64_t at) {
+    Peer *p = _peers.at(plid).get();
+    Request r = std::move(p->queue.front());
+    p->queue.pop_front();
+    p->sequence = 0;
+    _pending--;
+    if (reply != nullptr && r.sends == 1) _timer.sample(at - r.first);
+    // The callback may queue the player's next request.
+    r.done({reply, r.sends, at - r.first});
+    if (!p->queue.empty() && p->queue.front().sends == 0)
+      transmit(plid, *p, at);
+  }
+
+  void receive(int plid, uint64_t at) {
+    Peer &p = *_peers.at(plid);
+    ssize_t n = recv(p.socket.fd(), _buf, sizeof(_buf) - 1, MSG_DONTWAIT);
+    if (n < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        DEBUG("UDP Failed to receive bytes: %s\n", strerror(errno));
+      return;
+    }
+    _buf[n] = '\0';
+    DEBUG("Received via UDP: %s", _buf);
+    if (p.queue.empty() || p.queue.front().sends == 0 ||
+        !UDPClient::answers(p.queue.front().code, p.queue.front().nT, _buf))
+      return;
+    complete(plid, _buf, at);
+  }
+
+  /// @brief Retransmits the requests left unanswered, giving up on those
+  /// retried MAX_RETRIES times.
+  void expire(uint64_t at) {
+    while (!_timers.empty() && _timers.top().deadline <= at) {
+      Timer t = _timers.top();
+      _timers.pop();
+      auto it = _peers.find(t.plid);
+      if (it == _peers.end() || it->second->sequence != t.sequence) continue;
+      Peer &p = *it->second;
+      if (p.queue.front().sends <= MAX_RETRIES) {
+        DEBUG("Timed out waiting for UDP server response, retrying...\n");
+        transmit(t.plid, p, at);
+      } else {
+        DEBUG("Could not get reply from server: Maximum retries (%d) "
+              "exceeded.\n",
+              MAX_RETRIES);
+        complete(t.plid, nullptr, at);
+      }
+    }
+  }
+
+ public:
+  /// @brief Creates a client of the provided server.
+  /// @param ip Ip of the server. Can be null.
+  /// @param port Port of the server. Must not be null.
+  /// @param timeoutMs Wait for a reply until a round trip is measured.
+  /// @param maxTimeoutMs Longest wait for a reply, however far backed off.
+  AsyncUDPClient(const char *ip, const char *port, int timeoutMs = 1000,
+                 int maxTimeoutMs = 8000)
+      : _timer(timeoutMs * RetransmitTimer::MS,
+               maxTimeoutMs * RetransmitTimer::MS) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;       // IPv4
+    hints.ai_socktype = SOCK_DGRAM;  // UDP socket
+
+    int errcode = getaddrinfo(ip, port, &hints, &_res);
+    if (errcode != 0)
+      ERROR("Failed to translate address %s:%s: %s\n",
+            ip != nullptr ? ip : "0.0.0.0", port, gai_strerror(errcode));
+    _epoll = epoll_create1(0);
+    if (_epoll == -1) ERROR("Failed to create epoll: %s\n", strerror(errno));
+  }
+
+  /// @brief Queues a request, sent once the player's earlier ones are
+  /// answered.
+  /// @param plid Player the request is made for.
+  /// @param req Null terminated request.
+  /// @param done Called from poll() once the request is answered or given
+  /// up on.
+  void send(int plid, const char *req, Callback done) {
+    auto &slot = _peers[plid];
+    if (slot == nullptr) {
+      slot = std::make_unique<Peer>();
+      epoll_event ev = {.events = EPOLLIN, .data = {.u32 = (uint32_t)plid}};
+      if (epoll_ctl(_epoll, EPOLL_CTL_ADD, slot->socket.fd(), &ev) == -1)
+        ERROR("Failed to watch socket: %s\n", strerror(errno));
+    }
+    Request r = {.text = req, .code = UDPClient::replyCode(req),
+                 .nT = UDPClient::trialNumber(req), .done = std::move(done)};
+    slot->queue.push_back(std::move(r));
+    _pending++;
+    if (slot->queue.size() == 1)
+      transmit(plid, *slot, RetransmitTimer::now());
+  }
+
+  /// @brief Queues a request.
+  /// @return Future of the reply, ERR_RESPONSE if none came. Only set from
+  /// poll().
+  std::future<std::string> send(int plid, const char *req) {
+    auto promise = std::make_shared<std::promise<std::string>>();
+    send(plid, req, [promise](const Completion &c) {
+      promise->set_value(c.reply != nullptr ? c.reply : ERR_RESPONSE);
+    });
+    return promise->get_future();
+  }
+
+  /// @brief Waits for replies and retransmissions due, and handles them.
+  /// @param timeoutMs Longest wait, -1 for as long as requests are pending.
+  /// @return Number of requests still pending.
+  size_t poll(int timeoutMs) {
+    uint64_t at = RetransmitTimer::now();
+    expire(at);
+    if (!_timers.empty()) {
+      uint64_t wait = _timers.top().deadline > at
+                          ? (_timers.top().deadline - at + 999999) / 1000000
+                          : 0;
+      if (timeoutMs < 0 || (uint64_t)timeoutMs > wait) timeoutMs = wait;
+    } else if (timeoutMs < 0) {
+      return _pending;
+    }
+    epoll_event events[64];
+    int n = epoll_wait(_epoll, events, 64, timeoutMs);
+    if (n == -1 && errno != EINTR)
+      WARN("Failed to wait for replies: %s\n", strerror(errno));
+    at = RetransmitTimer::now();
+    for (int k = 0; k < n; k++) receive(events[k].data.u32, at);
+    expire(at);
+    return _pending;
+  }
+
+  /// @brief Drops a share of the transmissions before they are sent, to
+  /// see how retransmission copes with a lossy path.
+  /// @param percent Percentage of transmissions dropped.
+  /// @param seed Seed of the drops, the same seed drops the same ones.
+  void setLoss(int percent, unsigned seed) {
+    _loss = percent;
+    _rng.seed(seed);
+  }
+
+  /// @return Requests queued or in flight.
+  size_t pending() const { return _pending; }
+
+  /// @return Descriptor readable when a reply arrives, to wait on along
+  /// with others before calling poll(0).
+  int fd() const { return _epoll; }
+
+  ~AsyncUDPClient() {
+    close(_epoll);
+    freeaddrinfo(_res);
+  }
+};
+
+#endif  // ASYNCUDPCLIENT_HPP_
@@ -31,6 +31,8 @@ class ClientPrompt {
     static constexpr const char *St = "st";
     static constexpr const char *Scoreboard = "scoreboard";
     static constexpr const char *Sb = "sb";
+    static constexpr const char *Rank = "rank";
+    static constexpr const char *Stats = "stats";
     static constexpr const char *Quit = "quit";
     static constexpr const char *Exit = "exit";
     static constexpr const char *Debug = "debug";
@@ -46,6 +48,8 @@ class ClientPrompt {
     St = csum(CommandStr::St),
     Scoreboard = csum(CommandStr::Scoreboard),
     Sb = csum(CommandStr::Sb),
+    Rank = csum(CommandStr::Rank),
+    Stats = csum(CommandStr::Stats),
     Quit = csum(CommandStr::Quit),
     Exit = csum(CommandStr::Exit),
     Debug = csum(CommandStr::Debug),
@@ -64,8 +68,10 @@ class ClientPrompt {
   int _nT;
 
  public:
-  ClientPrompt(const char *ip, const char *port)
-      : _udpClient(ip, port), _tcpClient(ip, port) {}
+  /// @param maxTimeoutMs Longest wait for a reply, however far backed off.
+  ClientPrompt(const char *ip, const char *port, int maxTimeoutMs = 8000)
+      : _udpClient(ip, port, maxTimeoutMs),
+        _tcpClient(ip, port, maxTimeoutMs) {}
 
   /* ------------------------------- Start -------------------------------- */
   void printStartUsage() {
@@ -357,13 +363,63 @@ class ClientPrompt {
   /* --------------------------- Scoreboard ------------------------------ */
   int handleSb(const char *args) { return handleScoreboard(args); }
 
+  void printScoreboardUsage() {
+    printf(
+        "Invalid syntax for \"scoreboard\" command.\n\n"
+        "Usage: scoreboard [page]\n"
+        "\tpage - Page of the scoreboard, the top scores by default.\n");
+  }
+
   int handleScoreboard(const char *args) {
     char req[32];
 
-    snprintf(req, sizeof(req), "SSB\n");
+    int page;
+    char newLine;
+    if (args[0] == '\0') {
+      snprintf(req, sizeof(req), "SSB\n");
+    } else if (sscanf(args, "%d%c", &page, &newLine) == 2 && page >= 1 &&
+               newLine == '\n') {
+      snprintf(req, sizeof(req), "SSB PAGE %d\n", page);
+    } else {
+      printScoreboardUsage();
+      return -1;
+    }
+
+    return showScoreboard(_tcpClient.runCommand(req));
+  }
 
-    const char *resp = _tcpClient.runCommand(req);
+  /* ------------------------------ Rank --------------------------------- */
 
+  void printRankUsage() {
+    printf(
+        "Invalid syntax for \"rank\" command.\n\n"
+        "Usage: rank [PLID]\n"
+        "\tPLID - 6 digit Player Identification number, the current player "
+        "by default.\n");
+  }
+
+  int handleRank(const char *args) {
+    char req[32];
+
+    int plid = _plid;
+    char newLine;
+    if (args[0] != '\0' &&
+        (sscanf(args, "%6d%c", &plid, &newLine) != 2 || newLine != '\n')) {
+      printRankUsage();
+      return -1;
+    }
+    if (plid < 1 || plid > 999999) {
+      printRankUsage();
+      return -1;
+    }
+
+    snprintf(req, sizeof(req), "SSB RANK %06d\n", plid);
+
+    return showScoreboard(_tcpClient.runCommand(req));
+  }
+
+  /// @brief Prints and saves a scoreboard response.
+  int showScoreboard(const char *resp) {
     char fname[32];
     int pos, fsize;
     if (sscanf(resp, "RSS OK %s %d %n", fname, &fsize, &pos) == 2) {
@@ -390,6 +446,61 @@ class ClientPrompt {
     return -1;
   }
 
+  /* ------------------------------ Stats -------------------------------- */
+
+  void printStatsUsage() {
+    printf(
+        "Invalid syntax for \"stats\" command.\n\n"
+        "Usage: stats [PLID]\n"
+        "\tPLID - 6 digit Player Identification number, the current player "
+        "by default.\n");
+  }
+
+  int handleStats(const char *args) {
+    char req[32];
+
+    int plid = _plid;
+    char newLine;
+    if (args[0] != '\0' &&
+        (sscanf(args, "%6d%c", &plid, &newLine) != 2 || newLine != '\n')) {
+      printStatsUsage();
+      return -1;
+    }
+    if (plid < 1 || plid > 999999) {
+      printStatsUsage();
+      return -1;
+    }
+
+    snprintf(req, sizeof(req), "SPS %06d\n", plid);
+
+    const char *resp = _tcpClient.runCommand(req);
+
+    char fname[32];
+    int pos, fsize;
+    if (sscanf(resp, "RPS OK %s %d %n", fname, &fsize, &pos) == 2) {
+      FILE *f;
+      // Files on parent directories are not to be touched
+      if (strstr(fname, "..") != nullptr ||
+          (f = fopen(fname, "w")) == nullptr) {
+        WARN("Failed to open file \"%s\" for saving: %s\n", fname,
+             strerror(errno));
+        return -1;
+      }
+      fprintf(f, "%.*s", fsize, resp + pos);
+      fclose(f);
+      fprintf(stdout, "%s", resp + pos);
+      fprintf(stdout, "Statistics (%d bytes) written to file: %s\n", fsize,
+              fname);
+      return 0;
+    }
+    if (strcmp(resp, "RPS EMPTY\n") == 0) {
+      printf("Player %06d has not finished any game.\n", plid);
+      return 0;
+    }
+    printf("Could not show statistics for plid: \"%06d\"\n", plid);
+    return -1;
+  }
+
   int handleExit(const char *args) {
     quit();
     return 1;
@@ -433,6 +544,8 @@ class ClientPrompt {
       return handleExit(nullptr);
     }
 
+    utils_clock.refresh();
+
     // Get first command before whitespace or newline
     int e = strcspn(buffer, " \n");
     buffer[e] = '\0';
@@ -446,6 +559,8 @@ class ClientPrompt {
       CASE(St)
       CASE(Scoreboard)
       CASE(Sb)
+      CASE(Rank)
+      CASE(Stats)
       CASE(Quit)
       CASE(Exit)
       CASE(Debug)
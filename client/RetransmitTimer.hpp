@@ -0,0 +1,85 @@
+#ifndef RETRANSMITTIMER_HPP_
+#define RETRANSMITTIMER_HPP_
+
+#include <time.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+
+/// @brief Retransmission timeout of a server, estimated from the round trip
+/// times of its replies as in RFC 6298.
+/// Retries back off exponentially from the estimate, up to a ceiling, with
+/// some jitter so that clients which lost their requests together do not
+/// retry together. All times are in nanoseconds.
+class RetransmitTimer {
+ public:
+  static constexpr uint64_t MS = 1000000;
+  /// @brief Timeout until a round trip is measured.
+  static constexpr uint64_t DEFAULT_INITIAL = 1000 * MS;
+  static constexpr uint64_t DEFAULT_MAX = 8000 * MS;
+  /// @brief Floor of the timeout. RFC 6298 asks for a second, which costs
+  /// about as much per lost packet on a LAN, so the floor is Linux's.
+  static constexpr uint64_t DEFAULT_MIN = 200 * MS;
+  /// @brief Clock granularity.
+  static constexpr uint64_t G = 1 * MS;
+
+ private:
+  uint64_t _srtt = 0;
+  uint64_t _rttvar = 0;
+  uint64_t _rto;
+  uint64_t _min;
+  uint64_t _max;
+  bool _measured = false;
+  std::minstd_rand _rng;
+
+ public:
+  /// @param initial Timeout until a round trip is measured.
+  /// @param max Ceiling of the timeout, backed off or not.
+  /// @param min Floor of the timeout.
+  RetransmitTimer(uint64_t initial = DEFAULT_INITIAL,
+                  uint64_t max = DEFAULT_MAX, uint64_t min = DEFAULT_MIN)
+      : _rto(std::min(initial, max)), _min(std::min(min, max)), _max(max),
+        _rng(now() ^ (uintptr_t)this) {}
+
+  /// @return Monotonic time in nanoseconds.
+  static uint64_t now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  }
+
+  /// @brief Updates the estimate with a round trip.
+  /// @note Only requests answered on their first transmission may be
+  /// measured, a reply to a retransmitted one could answer any of them
+  /// (Karn's algorithm).
+  void sample(uint64_t rtt) {
+    if (!_measured) {
+      _srtt = rtt;
+      _rttvar = rtt / 2;
+      _measured = true;
+    } else {
+      uint64_t err = rtt > _srtt ? rtt - _srtt : _srtt - rtt;
+      _rttvar = (3 * _rttvar + err) / 4;
+      _srtt = (7 * _srtt + rtt) / 8;
+    }
+    _rto = std::clamp(_srtt + std::max(G, 4 * _rttvar), _min, _max);
+  }
+
+  /// @return Wait for a reply to a transmission, doubled for every retry
+  /// and give or take a tenth.
+  /// @param retries Transmissions of the request before this one.
+  uint64_t timeout(int retries) {
+    uint64_t t = std::min(_rto << std::min(retries, 16), _max);
+    t = t - t / 10 + _rng() % (t / 5 + 1);
+    return std::min(t, _max);
+  }
+
+  /// @return Timeout of a first transmission, without jitter.
+  uint64_t rto() const { return _rto; }
+
+  /// @return Smoothed round trip time, 0 until one is measured.
+  uint64_t srtt() const { return _srtt; }
+};
+
+#endif  // RETRANSMITTIMER_HPP_
@@ -8,12 +8,14 @@
 #include <string.h>
 #include <sys/socket.h>
 
+#include <client/RetransmitTimer.hpp>
 #include <common/TCPSocket.hpp>
 
 class TCPClient {
  private:
   struct addrinfo *_res = nullptr;
   char _buf[4096];
+  RetransmitTimer _timer;
 
  public:
   /// @brief Max number of retries for commands
@@ -22,7 +24,13 @@ class TCPClient {
   /// @brief Creates a TCP Client associated with the provided server.
   /// @param ip Ip of the server. Can be null.
   /// @param port Port of the srver. Must not be null.
-  TCPClient(const char *ip, const char *port) {
+  /// @param maxTimeoutMs Longest wait for a reply, however far backed off.
+  /// @note Replies may take the server a while to write out, so the wait
+  /// for them never drops under a second.
+  TCPClient(const char *ip, const char *port, int maxTimeoutMs = 8000)
+      : _timer(RetransmitTimer::DEFAULT_INITIAL,
+               maxTimeoutMs * RetransmitTimer::MS,
+               RetransmitTimer::DEFAULT_INITIAL) {
     struct addrinfo hints;
     int errcode;
 
@@ -47,15 +55,16 @@ class TCPClient {
     TCPConnection con = TCPSocket().connect(*_res->ai_addr, _res->ai_addrlen);
 
     fd_set set;
-    FD_ZERO(&set);
-    FD_SET(con.fd(), &set);
-
     int retries = 0;
     while (retries <= MAX_RETRIES) {
-      timeval timeout = {.tv_sec = 1, .tv_usec = 0};
-      // Add 400ms of timeout for every retry.
-      timeout.tv_usec += retries * 400000;
+      // select() clears the set when it times out.
+      FD_ZERO(&set);
+      FD_SET(con.fd(), &set);
+      uint64_t wait = _timer.timeout(retries), sent = RetransmitTimer::now();
+      timeval timeout = {.tv_sec = (time_t)(wait / 1000000000),
+                         .tv_usec = (suseconds_t)(wait % 1000000000 / 1000)};
 
+      utils_clock.refresh();
       DEBUG("Sending via TCP: %s", req);
 
       // Send command to server.
@@ -76,6 +85,7 @@ class TCPClient {
             return ERR_RESPONSE;
           }
           DEBUG("Received via TCP: %s", _buf);
+          if (retries == 0) _timer.sample(RetransmitTimer::now() - sent);
           return _buf;
       }
     }
@@ -8,21 +8,57 @@
 #include <string.h>
 #include <sys/socket.h>
 
+#include <client/RetransmitTimer.hpp>
 #include <common/UDPSocket.hpp>
 
 class UDPClient {
  private:
   UDPSocket _socket;
   struct addrinfo *_res = nullptr;
+  RetransmitTimer _timer;
 
  public:
   /// @brief Max number of retries for commands
   static const int MAX_RETRIES = 3;
 
+  /// @return Code replies to a request start with, null if unknown.
+  static const char *replyCode(const char *req) {
+    static const char *codes[][2] = {{"SNG ", "RSG "}, {"TRY ", "RTR "},
+                                     {"QUT ", "RQT "}, {"DBG ", "RDB "}};
+    for (auto &c : codes)
+      if (strncmp(req, c[0], 4) == 0) return c[1];
+    return nullptr;
+  }
+
+  /// @return Trial number of a TRY, 0 for other requests.
+  static int trialNumber(const char *req) {
+    char c;
+    int nT;
+    if (sscanf(req, "TRY %*d %c %c %c %c %d", &c, &c, &c, &c, &nT) != 5)
+      return 0;
+    return nT;
+  }
+
+  /// @return Whether a reply answers a request, rather than an earlier
+  /// one: it has the request's reply code and, for trials, trial number.
+  /// @param code Reply code of the request, see replyCode().
+  /// @param nT Trial number of the request, see trialNumber().
+  static bool answers(const char *code, int nT, const char *reply) {
+    int replyNT;
+    if (strcmp(reply, ERR_RESPONSE) == 0 || code == nullptr) return true;
+    if (strncmp(reply, code, 4) != 0) return false;
+    return nT == 0 || sscanf(reply, "RTR OK %d", &replyNT) != 1 ||
+           replyNT == nT;
+  }
+
   /// @brief Creates a UDP Client associated with the provided server.
   /// @param ip Ip of the server. Can be null.
   /// @param port Port of the srver. Must not be null.
-  UDPClient(const char *ip, const char *port) : _socket() {
+  /// @param maxTimeoutMs Longest wait for a reply, however far backed off.
+  UDPClient(const char *ip, const char *port, int maxTimeoutMs = 8000)
+      : _socket(),
+        _timer(RetransmitTimer::DEFAULT_INITIAL,
+               maxTimeoutMs * RetransmitTimer::MS) {
     struct addrinfo hints;
     int errcode;
 
@@ -39,45 +75,66 @@ class UDPClient {
   }
 
   /// @brief Sends command to server and returns response.
+  /// Late replies to retransmissions of earlier commands are discarded,
+  /// both those already waiting and those that arrive while waiting.
   /// @param req Null terminated request to be sent.
   /// @return The buffer in which the socket will write the server's response.
   /// Returns "ERR\\n" if Maximum retries is exceeded.
   /// @note Returned Buffer will be overwritten if socket is read from again.
   const char *runCommand(const char *req) {
     fd_set set;
-    FD_ZERO(&set);
-    FD_SET(_socket.fd(), &set);
-
     int retries = 0;
+    const char *code = replyCode(req);
+    int nT = trialNumber(req);
+
+    char stale[BUFFER_SIZE];
+    while (recv(_socket.fd(), stale, sizeof(stale), MSG_DONTWAIT) >= 0)
+      DEBUG("Discarding a late UDP reply.\n");
 
     while (retries <= MAX_RETRIES) {
-      timeval timeout = {.tv_sec = 1, .tv_usec = 0};
-      // Add 200ms of timeout for every retry.
-      timeout.tv_usec += retries * 200000;
+      uint64_t sent = RetransmitTimer::now();
+      uint64_t deadline = sent + _timer.timeout(retries);
 
+      utils_clock.refresh();
       DEBUG("Sending via UDP: %s", req);
 
       // Send command to server.
       _socket.sendto(req, *_res->ai_addr, _res->ai_addrlen);
 
-      // Wait for socket to be readable.
-      switch (select(_socket.fd() + 1, &set, nullptr, nullptr, &timeout)) {
-        case 0:  // Timed out
-          DEBUG("Timed out waiting for UDP server response, retrying...\n");
-          retries++;
-          continue;
-        case -1:  // Unexpected Error
+      // Wait for a reply to this command, until the deadline.
+      char *resp = nullptr;
+      while (resp == nullptr) {
+        uint64_t now = RetransmitTimer::now();
+        if (now >= deadline) break;
+        uint64_t wait = deadline - now;
+        timeval timeout = {.tv_sec = (time_t)(wait / 1000000000),
+                           .tv_usec = (suseconds_t)(wait % 1000000000 / 1000)};
+        // select() clears the set when it times out.
+        FD_ZERO(&set);
+        FD_SET(_socket.fd(), &set);
+        int ready = select(_socket.fd() + 1, &set, nullptr, nullptr, &timeout);
+        if (ready == 0) break;
+        if (ready == -1) {  // Unexpected Error
           DEBUG("Could not get reply from server: %s\n", strerror(errno));
           return ERR_RESPONSE;
-        default:  // Handle message
-          char *resp = _socket.recvfrom(nullptr, nullptr);
-          if (resp == nullptr) {  // Unexpected Error
-            DEBUG("Could not get reply from server: %s\n", strerror(errno));
-            return ERR_RESPONSE;
-          }
-          DEBUG("Received via UDP: %s", resp);
-          return resp;
+        }
+        resp = _socket.recvfrom(nullptr, nullptr);
+        if (resp == nullptr) {  // Unexpected Error
+          DEBUG("Could not get reply from server: %s\n", strerror(errno));
+          return ERR_RESPONSE;
+        }
+        DEBUG("Received via UDP: %s", resp);
+        if (!answers(code, nT, resp)) {
+          DEBUG("Discarding a reply to an earlier request.\n");
+          resp = nullptr;
+        }
+      }
+      if (resp != nullptr) {
+        if (retries == 0) _timer.sample(RetransmitTimer::now() - sent);
+        return resp;
       }
+      DEBUG("Timed out waiting for UDP server response, retrying...\n");
+      retries++;
     }
     WARN("Could not get reply from server: Maximum retries (%d) exceeded.\n",
          MAX_RETRIES);
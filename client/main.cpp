@@ -2,6 +2,8 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <algorithm>
+
 #include <client/ClientPrompt.hpp>
 #include <client/UDPClient.hpp>
 #include <common/utils.hpp>
@@ -11,6 +13,7 @@ const char *DEFAULT_PORT = "58071";
 
 int main(int argc, char **argv) {
   const char *ip = DEFAULT_IP, *port = DEFAULT_PORT;
+  int maxTimeoutMs = 8000;
 
   // Handle CLI Flags
   for (int i = 1; i < argc; i++) {
@@ -18,10 +21,12 @@ int main(int argc, char **argv) {
       ip = argv[++i];
     else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
       port = argv[++i];
+    else if (strcmp(argv[i], "-W") == 0 && i + 1 < argc)
+      maxTimeoutMs = std::max(atoi(argv[++i]), 1);
     else if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--debug") == 0)
       utils_debug_flag = true;
     else {
-      fprintf(stderr, "Usage: %s [-n GSip] [-p GSport] [-d]\n", argv[0]);
+      fprintf(stderr, "Usage: %s [-n GSip] [-p GSport] [-W max_timeout_ms] [-d]\n", argv[0]);
       exit(1);
     }
   }
@@ -29,7 +34,7 @@ int main(int argc, char **argv) {
   DEBUG("GSPort is %s\n", port);
   DEBUG("GSIp is %s\n", ip);
 
-  ClientPrompt prompt = ClientPrompt(ip, port);
+  ClientPrompt prompt = ClientPrompt(ip, port, maxTimeoutMs);
 
   while (prompt.processCommand() != 1);
 
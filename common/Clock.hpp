@@ -0,0 +1,92 @@
+#ifndef CLOCK_HPP_
+#define CLOCK_HPP_
+
+#include <stdint.h>
+#include <time.h>
+
+/// @brief Coarse clock, one per thread.
+/// Each event loop calls refresh() once per iteration, every other read is
+/// served from cached values, so the hot path never calls time(), localtime()
+/// or strftime(). Formatted strings are only rebuilt when the second changes.
+class Clock {
+ private:
+  /// @brief Cached wall clock time in seconds.
+  time_t _now = 0;
+  /// @brief Cached monotonic time in nanoseconds.
+  uint64_t _monotonic = 0;
+  /// @brief Second for which the strings below were formatted.
+  time_t _formatted = -1;
+  /// @brief If true, time only moves through set()/advance().
+  bool _fake = false;
+
+  /// @brief "%Y-%m-%dT%H:%M:%S", used by log macros.
+  char _logStr[24] = "";
+  /// @brief "%Y%m%d%H%M%S", used in scoreboard file names.
+  char _fileStr[16] = "";
+  /// @brief "%c %Z", used in trials files.
+  char _longStr[64] = "";
+
+  void format() {
+    if (_formatted == _now) return;
+    _formatted = _now;
+    struct tm tm_info;
+    localtime_r(&_now, &tm_info);
+    strftime(_logStr, sizeof(_logStr), "%Y-%m-%dT%H:%M:%S", &tm_info);
+    strftime(_fileStr, sizeof(_fileStr), "%Y%m%d%H%M%S", &tm_info);
+    strftime(_longStr, sizeof(_longStr), "%c %Z", &tm_info);
+  }
+
+ public:
+  Clock() { refresh(); }
+
+  /// @brief Reads the coarse kernel clocks. Does nothing on a fake clock.
+  void refresh() {
+    if (_fake) return;
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    _now = ts.tv_sec;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    _monotonic = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  }
+
+  /// @brief Turns this into a fake clock frozen at the given time.
+  /// @param now Epoch time in seconds.
+  void set(time_t now) {
+    _monotonic = _fake ? _monotonic + (now - _now) * 1000000000ull : 0;
+    _fake = true;
+    _now = now;
+  }
+
+  /// @brief Moves a fake clock forward.
+  /// @param seconds Seconds to advance.
+  void advance(time_t seconds) { set(_now + seconds); }
+
+  /// @return Whether the clock is fake.
+  bool fake() const { return _fake; }
+
+  /// @return Cached epoch time in seconds.
+  time_t now() const { return _now; }
+
+  /// @return Cached monotonic time in nanoseconds.
+  uint64_t monotonic() const { return _monotonic; }
+
+  /// @return Current time formatted for logs.
+  const char *logString() {
+    format();
+    return _logStr;
+  }
+
+  /// @return Current time formatted for file names.
+  const char *fileString() {
+    format();
+    return _fileStr;
+  }
+
+  /// @return Current time in the locale's long format.
+  const char *longString() {
+    format();
+    return _longStr;
+  }
+};
+
+#endif  // CLOCK_HPP_
@@ -0,0 +1,307 @@
+#ifndef LOGGER_HPP_
+#define LOGGER_HPP_
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/// @brief Asynchronous logger.
+/// Each thread appends binary records to a ring of its own, which only that
+/// thread writes and only the logger thread reads, so logging takes no lock
+/// and makes no system call. The logger thread formats the records and
+/// writes them to stdout in batches.
+///
+/// Records are either text, formatted by the caller, or raw copies of a
+/// structure that formats itself on the logger thread, so the hot path only
+/// copies a few bytes. A record that does not fit in a full ring is dropped
+/// and counted, logging never blocks.
+///
+/// Until start() is called, and in forked children, records are written
+/// directly instead.
+class Logger {
+ public:
+  enum Level : uint8_t {
+    // "[time] Info:  "
+    INFO_LOG,
+    // "[time]: Verbose - "
+    VERBOSE_LOG,
+    // Continues a verbose message, no prefix.
+    APPEND_LOG,
+    // "[time]: Debug - "
+    DEBUG_LOG,
+  };
+
+  /// @brief Bytes of the ring of each thread.
+  static const size_t RING_SIZE = 1 << 20;
+  /// @brief Longest text record, longer ones are truncated.
+  static const size_t MAX_TEXT = 16384;
+
+ private:
+  enum Kind : uint8_t {
+    // Skips to the start of the ring.
+    PAD,
+    // Text follows.
+    TEXT,
+    // Formatter pointer and structure follow.
+    RECORD,
+  };
+
+  /// @brief Records are aligned to ALIGN bytes, so a pad always has room for
+  /// a header.
+  static const size_t ALIGN = 16;
+
+  struct Header {
+    uint32_t size;
+    Kind kind;
+    Level level;
+    uint16_t length;
+    int64_t time;
+  };
+  static_assert(sizeof(Header) == ALIGN, "Header must fill one alignment");
+
+  using Formatter = void (*)(std::string &, const void *);
+
+  struct Ring {
+    /// @brief Bytes ever written, by the owning thread.
+    alignas(64) std::atomic<uint64_t> head = 0;
+    /// @brief Bytes ever read, by the logger thread.
+    alignas(64) std::atomic<uint64_t> tail = 0;
+    alignas(64) char buf[RING_SIZE];
+  };
+
+  /// @brief Logger running on a thread, if any. Forked children reset it.
+  inline static std::atomic<Logger *> _running = nullptr;
+  inline static thread_local Ring *_ring = nullptr;
+  /// @brief Logger that _ring belongs to, a thread logging to another one
+  /// registers a new ring with it.
+  inline static thread_local uint64_t _ringLogger = 0;
+  inline static std::atomic<uint64_t> _lastId = 0;
+
+  /// @brief Tells apart loggers that reuse the memory of earlier ones.
+  const uint64_t _id = ++_lastId;
+
+  std::mutex _mutex;
+  std::vector<std::unique_ptr<Ring>> _rings;
+  std::atomic<uint64_t> _dropped = 0;
+  std::atomic<bool> _stop = false;
+  std::unique_ptr<std::thread> _thread;
+  pid_t _owner = 0;
+
+  // Delete copy constructor to prevent accidental copies
+  Logger(const Logger &) = delete;
+  Logger &operator=(const Logger &) = delete;
+
+  template <typename T>
+  static void formatRecord(std::string &out, const void *p) {
+    ((const T *)p)->format(out);
+  }
+
+  /// @brief Appends the prefix of a level.
+  static void prefix(std::string &out, Level level, time_t time) {
+    if (level == APPEND_LOG) return;
+    char buf[24];
+    struct tm tm_info;
+    localtime_r(&time, &tm_info);
+    strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm_info);
+    out += '[';
+    out += buf;
+    out += level == INFO_LOG      ? "] Info:  "
+           : level == DEBUG_LOG   ? "]: Debug - "
+                                  : "]: Verbose - ";
+  }
+
+  /// @return Ring of the calling thread, registered on first use.
+  Ring *ring() {
+    if (_ringLogger != _id) {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _rings.push_back(std::make_unique<Ring>());
+      _ring = _rings.back().get();
+      _ringLogger = _id;
+    }
+    return _ring;
+  }
+
+  /// @brief Appends a record to the ring of the calling thread.
+  /// @return Whether it fit.
+  bool push(Kind kind, Level level, time_t time, const void *a, size_t aLen,
+            const void *b, size_t bLen) {
+    Ring *r = ring();
+    size_t size = (sizeof(Header) + aLen + bLen + ALIGN - 1) / ALIGN * ALIGN;
+    uint64_t head = r->head.load(std::memory_order_relaxed);
+    size_t offset = head % RING_SIZE;
+    // A record never wraps, the end of the ring is padded instead.
+    size_t pad = offset + size > RING_SIZE ? RING_SIZE - offset : 0;
+    if (head + pad + size - r->tail.load(std::memory_order_acquire) >
+        RING_SIZE) {
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    if (pad) {
+      Header *h = (Header *)(r->buf + offset);
+      h->size = pad;
+      h->kind = PAD;
+      offset = 0;
+    }
+    Header *h = (Header *)(r->buf + offset);
+    h->size = size;
+    h->kind = kind;
+    h->level = level;
+    h->length = aLen + bLen;
+    h->time = time;
+    memcpy(r->buf + offset + sizeof(Header), a, aLen);
+    if (bLen) memcpy(r->buf + offset + sizeof(Header) + aLen, b, bLen);
+    r->head.store(head + pad + size, std::memory_order_release);
+    return true;
+  }
+
+  /// @brief Formats every record written so far.
+  /// @return Number of records formatted.
+  size_t drain(std::string &out) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    size_t n = 0;
+    for (auto &r : _rings) {
+      uint64_t tail = r->tail.load(std::memory_order_relaxed);
+      uint64_t head = r->head.load(std::memory_order_acquire);
+      while (tail < head) {
+        const Header *h = (const Header *)(r->buf + tail % RING_SIZE);
+        const char *payload = (const char *)(h + 1);
+        if (h->kind == TEXT) {
+          prefix(out, h->level, h->time);
+          out.append(payload, h->length);
+          n++;
+        } else if (h->kind == RECORD) {
+          Formatter format;
+          memcpy(&format, payload, sizeof(format));
+          prefix(out, h->level, h->time);
+          format(out, payload + sizeof(format));
+          n++;
+        }
+        tail += h->size;
+      }
+      r->tail.store(tail, std::memory_order_release);
+    }
+    return n;
+  }
+
+  void run() {
+    std::string out;
+    uint64_t reported = 0;
+    while (true) {
+      bool stop = _stop.load();
+      size_t n = drain(out);
+      if (!out.empty()) {
+        fwrite(out.data(), 1, out.size(), stdout);
+        fflush(stdout);
+        out.clear();
+      }
+      uint64_t dropped = _dropped.load(std::memory_order_relaxed);
+      if (dropped != reported) {
+        fprintf(stderr, "[Warn]: Dropped %lu log records, the log is full.\n",
+                (unsigned long)(dropped - reported));
+        reported = dropped;
+      }
+      if (stop) return;
+      if (n == 0) std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+  }
+
+  static void forked() { _running = nullptr; }
+
+ public:
+  Logger() {}
+
+  /// @brief Starts the logger thread, records are written directly before.
+  void start() {
+    if (_thread) return;
+    _owner = getpid();
+    _thread = std::make_unique<std::thread>(&Logger::run, this);
+    _running = this;
+    pthread_atfork(nullptr, nullptr, &Logger::forked);
+  }
+
+  /// @brief Logs formatted text.
+  /// @param time Epoch time of the message.
+  __attribute__((format(printf, 4, 5))) void text(Level level, time_t time,
+                                                  const char *fmt, ...) {
+    char buf[MAX_TEXT];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    len = std::min<int>(std::max(len, 0), sizeof(buf) - 1);
+    if (_running.load(std::memory_order_relaxed) != this) {
+      std::string out;
+      prefix(out, level, time);
+      out.append(buf, len);
+      fwrite(out.data(), 1, out.size(), stdout);
+      return;
+    }
+    push(TEXT, level, time, buf, len, nullptr, 0);
+  }
+
+  /// @brief Logs a structure, formatted later by its format(std::string&)
+  /// method on the logger thread.
+  /// @param time Epoch time of the message.
+  template <typename T>
+  void record(Level level, time_t time, const T &value) {
+    static_assert(std::is_trivially_copyable_v<T> &&
+                      alignof(T) <= alignof(Formatter),
+                  "Records are copied as raw bytes after the formatter");
+    if (_running.load(std::memory_order_relaxed) != this) {
+      std::string out;
+      prefix(out, level, time);
+      value.format(out);
+      fwrite(out.data(), 1, out.size(), stdout);
+      return;
+    }
+    Formatter format = &formatRecord<T>;
+    push(RECORD, level, time, &format, sizeof(format), &value, sizeof(T));
+  }
+
+  /// @brief Waits until the logger thread took every record logged so far.
+  void flush() {
+    if (_running.load() != this) return;
+    while (true) {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        bool empty = true;
+        for (auto &r : _rings)
+          empty = empty && r->tail.load(std::memory_order_acquire) ==
+                               r->head.load(std::memory_order_acquire);
+        if (empty) return;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  /// @return Records dropped because their ring was full.
+  uint64_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+  ~Logger() {
+    if (!_thread) return;
+    if (getpid() != _owner) {
+      // The thread object belongs to the parent, leave it alone.
+      (void)_thread.release();
+      return;
+    }
+    _stop = true;
+    _thread->join();
+    _running = nullptr;
+  }
+};
+
+#endif  // LOGGER_HPP_
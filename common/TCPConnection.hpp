@@ -82,6 +82,14 @@ class TCPConnection {
   /// @return Socket's file descriptor.
   int fd() { return _fd; }
 
+  /// @brief Gives up the socket, which is no longer closed by this object.
+  /// @return Socket's file descriptor.
+  int release() {
+    int fd = _fd;
+    _fd = -1;
+    return fd;
+  }
+
   ~TCPConnection() {
     if (_fd != -1) {
       close(_fd);
@@ -6,8 +6,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <cstdint>
+
 #include <common/utils.hpp>
 
 class UDPSocket {
@@ -54,6 +57,51 @@ class UDPSocket {
     return _buf;
   }
 
+  /// @brief Receives up to n messages without blocking, wrapper for recvmmsg
+  /// from <sys/socket.h>.
+  /// @return Number of messages received, or -1 for errors.
+  int recvmmsg(mmsghdr *msgs, unsigned int n) {
+    int n_recv = ::recvmmsg(_fd, msgs, n, MSG_DONTWAIT, nullptr);
+    if (n_recv == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+      DEBUG("UDP Failed to receive messages: %s\n", strerror(errno));
+    return n_recv;
+  }
+
+  /// @brief Sends n messages, wrapper for sendmmsg from <sys/socket.h>.
+  /// @return Number of messages sent, or -1 for errors.
+  int sendmmsg(mmsghdr *msgs, unsigned int n) {
+    int n_sent = ::sendmmsg(_fd, msgs, n, 0);
+    if (n_sent == -1)
+      DEBUG("UDP Failed to send %u messages: %s\n", n, strerror(errno));
+    return n_sent;
+  }
+
+  /// @brief Has the kernel stamp every datagram with its arrival time, read
+  /// with receivedAt().
+  /// @return Whether timestamps were enabled.
+  bool timestamp() {
+    int one = 1;
+    return setsockopt(_fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)) ==
+           0;
+  }
+
+  /// @brief Space for the control message of a timestamped datagram.
+  static constexpr size_t TIMESTAMP_CONTROL = CMSG_SPACE(sizeof(timespec));
+
+  /// @return Kernel arrival time of a datagram, in CLOCK_REALTIME
+  /// nanoseconds, or 0 if it carries none.
+  static uint64_t receivedAt(msghdr &msg) {
+    for (cmsghdr *c = CMSG_FIRSTHDR(&msg); c != nullptr;
+         c = CMSG_NXTHDR(&msg, c)) {
+      if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_TIMESTAMPNS)
+        continue;
+      timespec ts;
+      memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+      return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+    return 0;
+  }
+
   /// @brief Wrapper for bind from <sys/socket.h>
   /// @param addr Address struct
   /// @param len Address length
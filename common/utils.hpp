@@ -4,12 +4,28 @@
 #include <stdio.h>
 #include <time.h>
 
+#include <common/Clock.hpp>
+#include <common/Logger.hpp>
+
+/// @brief Most detailed log level compiled in: 0 for none, 1 for INFO, 2 for
+/// VERBOSE and 3 for DEBUG. Calls of higher levels are type checked but
+/// compile to nothing.
+#ifndef LOG_LEVEL
+#define LOG_LEVEL 3
+#endif
+
 /// @todo Revisit this value
 const int BUFFER_SIZE = 128;
 
 bool utils_debug_flag = false;
 bool utils_verbose_flag = false;
 
+/// @brief Clock of each thread, refreshed once per event loop iteration.
+thread_local Clock utils_clock;
+
+/// @brief Logger of INFO, VERBOSE and DEBUG messages.
+Logger utils_logger;
+
 const char* ERR_RESPONSE = "ERR\n";
 
 /// @brief This macro is for fatal errors that cannot be recovered from.
@@ -23,39 +39,57 @@ const char* ERR_RESPONSE = "ERR\n";
 #define WARN(...) fprintf(stderr, "[Warn]: " __VA_ARGS__)
 
 /// @brief This macro is for verbose information.
-#define DEBUG(...)                                     \
-  if (utils_debug_flag) {                              \
-    time_t my_time = time(NULL);                       \
-    char _buf_[24];                                    \
-    struct tm* tm_info = localtime(&my_time);          \
-    strftime(_buf_, 24, "%Y-%m-%dT%H:%M:%S", tm_info); \
-    fprintf(stdout, "[%s]: ", _buf_);                  \
-    fprintf(stdout, "Debug - " __VA_ARGS__);           \
+#if LOG_LEVEL >= 3
+#define DEBUG(...)                                                       \
+  if (utils_debug_flag) {                                                \
+    utils_logger.text(Logger::DEBUG_LOG, utils_clock.now(), __VA_ARGS__); \
+  }
+#else
+#define DEBUG(...)                                                       \
+  if (0) {                                                               \
+    utils_logger.text(Logger::DEBUG_LOG, utils_clock.now(), __VA_ARGS__); \
   }
+#endif
 
-#define VERBOSE(...)                                   \
-  if (utils_verbose_flag) {                            \
-    time_t my_time = time(NULL);                       \
-    char _buf_[24];                                    \
-    struct tm* tm_info = localtime(&my_time);          \
-    strftime(_buf_, 24, "%Y-%m-%dT%H:%M:%S", tm_info); \
-    fprintf(stdout, "[%s]: ", _buf_);                  \
-    fprintf(stdout, "Verbose - " __VA_ARGS__);         \
+#if LOG_LEVEL >= 2
+#define VERBOSE(...)                                                       \
+  if (utils_verbose_flag) {                                                \
+    utils_logger.text(Logger::VERBOSE_LOG, utils_clock.now(), __VA_ARGS__); \
   };
 
-#define VERBOSE_APPEND(...)       \
-  if (utils_verbose_flag) {       \
-    fprintf(stdout, __VA_ARGS__); \
+#define VERBOSE_APPEND(...)                                               \
+  if (utils_verbose_flag) {                                               \
+    utils_logger.text(Logger::APPEND_LOG, utils_clock.now(), __VA_ARGS__); \
   };
 
-#define INFO(...)                                      \
-  {                                                    \
-    time_t my_time = time(NULL);                       \
-    char _buf_[24];                                    \
-    struct tm* tm_info = localtime(&my_time);          \
-    strftime(_buf_, 24, "%Y-%m-%dT%H:%M:%S", tm_info); \
-    fprintf(stdout, "[%s]", _buf_);                    \
-    fprintf(stdout, " Info:  " __VA_ARGS__);           \
+/// @brief Logs a structure with a format(std::string&) method, which only
+/// runs on the logger thread.
+#define VERBOSE_RECORD(value)                                            \
+  if (utils_verbose_flag) {                                              \
+    utils_logger.record(Logger::VERBOSE_LOG, utils_clock.now(), value); \
+  };
+#else
+#define VERBOSE(...)                                                       \
+  if (0) {                                                                 \
+    utils_logger.text(Logger::VERBOSE_LOG, utils_clock.now(), __VA_ARGS__); \
+  };
+#define VERBOSE_APPEND(...) VERBOSE(__VA_ARGS__)
+#define VERBOSE_RECORD(value)                                            \
+  if (0) {                                                               \
+    utils_logger.record(Logger::VERBOSE_LOG, utils_clock.now(), value); \
+  };
+#endif
+
+#if LOG_LEVEL >= 1
+#define INFO(...)                                                       \
+  {                                                                     \
+    utils_logger.text(Logger::INFO_LOG, utils_clock.now(), __VA_ARGS__); \
+  }
+#else
+#define INFO(...)                                                       \
+  if (0) {                                                              \
+    utils_logger.text(Logger::INFO_LOG, utils_clock.now(), __VA_ARGS__); \
   }
+#endif
 
 #endif  // UTILS_HPP_
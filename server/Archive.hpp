@@ -0,0 +1,322 @@
+#ifndef ARCHIVE_HPP_
+#define ARCHIVE_HPP_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common/utils.hpp"
+#include "server/GameSession.hpp"
+#include "server/Trial.hpp"
+
+/// @brief Append-only archive of finished games.
+/// Games are stored in blocks of up to BLOCK_GAMES games, each column of a
+/// block compressed on its own, so a scan only inflates the columns it needs.
+///
+/// File layout: FileHeader, then blocks of BlockHeader followed by the
+/// compressed columns in Column order.
+class Archive {
+ public:
+  /// @brief Columns of a block and their element types.
+  enum Column {
+    // int32_t
+    PLID,
+    // uint32_t, epoch time the game ended
+    END,
+    // uint16_t, code index
+    CODE,
+    // uint16_t, seconds
+    DURATION,
+    // uint16_t, seconds
+    MAX_TIME,
+    // uint8_t, number of trials made
+    TRIALS_MADE,
+    // uint8_t, GameSession::TrialResult
+    RESULT,
+    // uint8_t
+    DEBUG_MODE,
+    // uint16_t[MAX_TRIALS], code indices, Trial::CODES if not made
+    TRIALS,
+    // uint8_t[MAX_TRIALS], nB * 5 + nW
+    FEEDBACK,
+    COLUMNS
+  };
+
+  static constexpr int MAX_TRIALS = 8;
+  static constexpr uint32_t BLOCK_GAMES = 65536;
+
+  /// @brief Size in bytes of one game in each column.
+  static constexpr uint32_t COLUMN_WIDTH[COLUMNS] = {
+      4, 4, 2, 2, 2, 1, 1, 1, 2 * MAX_TRIALS, MAX_TRIALS};
+
+  struct FileHeader {
+    char magic[4];
+    uint32_t version;
+  };
+  static constexpr char FILE_MAGIC[4] = {'G', 'S', 'A', 'R'};
+  static const uint32_t VERSION = 1;
+
+  struct BlockHeader {
+    char magic[4];
+    uint32_t games;
+    /// @brief Compressed size of each column.
+    uint32_t size[COLUMNS];
+  };
+  static constexpr char BLOCK_MAGIC[4] = {'B', 'L', 'K', '0'};
+
+  /// @brief Block of games being built, one buffer per column.
+  struct Block {
+    uint32_t games = 0;
+    std::vector<uint8_t> columns[COLUMNS];
+
+    template <typename T>
+    const T *column(Column c) const {
+      return (const T *)columns[c].data();
+    }
+
+    template <typename T>
+    void put(Column c, T value) {
+      const uint8_t *p = (const uint8_t *)&value;
+      columns[c].insert(columns[c].end(), p, p + sizeof(T));
+    }
+
+    /// @brief Appends a finished game.
+    void add(int plid, time_t end, const GameSession &s) {
+      put<int32_t>(PLID, plid);
+      put<uint32_t>(END, end);
+      put<uint16_t>(CODE, s.getCode().index());
+      put<uint16_t>(DURATION, s.duration());
+      put<uint16_t>(MAX_TIME, s.maxTime());
+      put<uint8_t>(TRIALS_MADE, s.nT() - 1);
+      put<uint8_t>(RESULT, s.result());
+      put<uint8_t>(DEBUG_MODE, s.debug());
+      for (int i = 1; i <= MAX_TRIALS; i++) {
+        uint16_t nB = 0, nW = 0;
+        if (i < s.nT()) s.getnBW(i, nB, nW);
+        put<uint16_t>(TRIALS, s.getTrial(i).index());
+        put<uint8_t>(FEEDBACK, nB * 5 + nW);
+      }
+      games++;
+    }
+
+    void clear() {
+      games = 0;
+      for (auto &c : columns) c.clear();
+    }
+  };
+
+  /// @brief Background writer of finished games.
+  /// push() only appends to a queue, a thread builds, compresses and writes
+  /// the blocks. Partial blocks are written every FLUSH_INTERVAL, so games do
+  /// not wait in memory for a block to fill. Processes forked from the
+  /// owner must leave with _exit(), see TCPServer::exitChild(), and never
+  /// destroy it.
+  class Writer {
+   private:
+    /// @brief Seconds a partial block may wait to be written.
+    static const int FLUSH_INTERVAL = 10;
+
+    int _fd;
+    /// @brief Only the process that opened the archive may write to it.
+    pid_t _owner;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    Block _queue;
+    bool _stop = false;
+    std::unique_ptr<std::thread> _thread;
+
+    // Delete copy constructor to prevent accidental copies
+    Writer(const Writer &) = delete;
+    Writer &operator=(const Writer &) = delete;
+
+    void writeBlock(const Block &block) {
+      BlockHeader header;
+      memcpy(header.magic, BLOCK_MAGIC, sizeof(BLOCK_MAGIC));
+      header.games = block.games;
+      std::vector<uint8_t> out;
+      for (int c = 0; c < COLUMNS; c++) {
+        const std::vector<uint8_t> &in = block.columns[c];
+        size_t offset = out.size();
+        uLongf len = compressBound(in.size());
+        out.resize(offset + len);
+        if (compress2(out.data() + offset, &len, in.data(), in.size(),
+                      Z_BEST_SPEED) != Z_OK) {
+          WARN("Failed to compress archive block.\n");
+          return;
+        }
+        out.resize(offset + len);
+        header.size[c] = len;
+      }
+      if (::write(_fd, &header, sizeof(header)) != sizeof(header) ||
+          ::write(_fd, out.data(), out.size()) != (ssize_t)out.size())
+        WARN("Failed to write archive block: %s\n", strerror(errno));
+    }
+
+    void run() {
+      using clock = std::chrono::steady_clock;
+      const auto interval = std::chrono::seconds(FLUSH_INTERVAL);
+      auto lastWrite = clock::now();
+      Block block, incoming;
+      std::unique_lock<std::mutex> lock(_mutex);
+      while (true) {
+        _cond.wait_for(lock, interval, [this] {
+          return _stop || _queue.games >= BLOCK_GAMES;
+        });
+        std::swap(incoming, _queue);
+        bool stop = _stop;
+        lock.unlock();
+
+        for (int c = 0; c < COLUMNS; c++)
+          block.columns[c].insert(block.columns[c].end(),
+                                  incoming.columns[c].begin(),
+                                  incoming.columns[c].end());
+        block.games += incoming.games;
+        incoming.clear();
+        // Whole blocks are written as they fill, partial ones periodically.
+        bool due = clock::now() - lastWrite >= interval;
+        while (block.games >= BLOCK_GAMES || ((due || stop) && block.games)) {
+          Block full;
+          uint32_t n = std::min(block.games, BLOCK_GAMES);
+          for (int c = 0; c < COLUMNS; c++) {
+            auto &col = block.columns[c];
+            auto end = col.begin() + n * COLUMN_WIDTH[c];
+            full.columns[c].assign(col.begin(), end);
+            col.erase(col.begin(), end);
+          }
+          full.games = n;
+          block.games -= n;
+          writeBlock(full);
+          lastWrite = clock::now();
+        }
+        if (stop) return;
+        lock.lock();
+      }
+    }
+
+   public:
+    /// @brief Opens (or creates) an archive. Will exit(1) if unsuccessful.
+    /// @param path Archive file path.
+    Writer(const char *path) : _owner(getpid()) {
+      _fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+      if (_fd == -1)
+        ERROR("Failed to open archive %s: %s\n", path, strerror(errno));
+      FileHeader header;
+      ssize_t n = pread(_fd, &header, sizeof(header), 0);
+      if (n == 0) {
+        memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+        header.version = VERSION;
+        if (::write(_fd, &header, sizeof(header)) != sizeof(header))
+          ERROR("Failed to initialize archive %s: %s\n", path, strerror(errno));
+      } else if (n != sizeof(header) ||
+                 memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 ||
+                 header.version != VERSION) {
+        ERROR("File %s is not a compatible archive.\n", path);
+      }
+      _thread = std::make_unique<std::thread>(&Writer::run, this);
+    }
+
+    /// @brief Queues a finished game to be archived.
+    void push(int plid, const GameSession &s) {
+      // Forked children do not have the writer thread.
+      if (getpid() != _owner) return;
+      std::lock_guard<std::mutex> lock(_mutex);
+      _queue.add(plid, utils_clock.now(), s);
+      if (_queue.games >= BLOCK_GAMES) _cond.notify_one();
+    }
+
+    ~Writer() {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+      }
+      _cond.notify_one();
+      _thread->join();
+      close(_fd);
+    }
+  };
+
+  /// @brief Reads blocks of an archive, possibly from many threads.
+  class Reader {
+   private:
+    int _fd;
+    std::vector<off_t> _offsets;
+    std::vector<BlockHeader> _headers;
+
+    // Delete copy constructor to prevent accidental copies
+    Reader(const Reader &) = delete;
+    Reader &operator=(const Reader &) = delete;
+
+   public:
+    /// @brief Opens an archive and indexes its blocks. Will exit(1) if
+    /// unsuccessful. A torn block at the end is ignored.
+    Reader(const char *path) {
+      _fd = open(path, O_RDONLY);
+      if (_fd == -1)
+        ERROR("Failed to open archive %s: %s\n", path, strerror(errno));
+      FileHeader header;
+      if (pread(_fd, &header, sizeof(header), 0) != sizeof(header) ||
+          memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 ||
+          header.version != VERSION)
+        ERROR("File %s is not a compatible archive.\n", path);
+
+      struct stat st;
+      fstat(_fd, &st);
+      off_t offset = sizeof(header);
+      BlockHeader block;
+      while (pread(_fd, &block, sizeof(block), offset) == sizeof(block) &&
+             memcmp(block.magic, BLOCK_MAGIC, sizeof(BLOCK_MAGIC)) == 0) {
+        off_t size = sizeof(block);
+        for (uint32_t s : block.size) size += s;
+        if (offset + size > st.st_size) break;
+        _offsets.push_back(offset);
+        _headers.push_back(block);
+        offset += size;
+      }
+    }
+
+    /// @return Number of blocks.
+    size_t blocks() const { return _offsets.size(); }
+
+    /// @return Number of games in a block.
+    uint32_t games(size_t i) const { return _headers[i].games; }
+
+    /// @brief Inflates some columns of a block. Thread safe.
+    /// @param i Block index.
+    /// @param mask Bit mask of the columns to be read.
+    /// @param out Where the columns are written.
+    /// @return Whether the block was read.
+    bool read(size_t i, uint32_t mask, Block &out) const {
+      const BlockHeader &header = _headers[i];
+      out.games = header.games;
+      off_t offset = _offsets[i] + sizeof(header);
+      std::vector<uint8_t> in;
+      for (int c = 0; c < COLUMNS; offset += header.size[c++]) {
+        out.columns[c].clear();
+        if (!(mask & (1u << c))) continue;
+        in.resize(header.size[c]);
+        uLongf len = header.games * COLUMN_WIDTH[c];
+        out.columns[c].resize(len);
+        if (pread(_fd, in.data(), in.size(), offset) != (ssize_t)in.size() ||
+            uncompress(out.columns[c].data(), &len, in.data(), in.size()) !=
+                Z_OK)
+          return false;
+      }
+      return true;
+    }
+
+    ~Reader() { close(_fd); }
+  };
+};
+
+#endif  // ARCHIVE_HPP_
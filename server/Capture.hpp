@@ -0,0 +1,218 @@
+#ifndef CAPTURE_HPP_
+#define CAPTURE_HPP_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/utils.hpp"
+
+/// @brief Capture of the requests served and their replies, to be replayed
+/// against another server.
+///
+/// File layout: FileHeader, then one Record per request followed by the
+/// request bytes and the reply bytes.
+class Capture {
+ public:
+  enum Transport : uint8_t { UDP, TCP };
+
+  struct FileHeader {
+    char magic[4];
+    uint32_t version;
+  };
+  static constexpr char MAGIC[4] = {'G', 'S', 'C', 'P'};
+  static const uint32_t VERSION = 1;
+
+  /// @brief One request, 24 bytes followed by requestSize + replySize.
+  struct Record {
+    /// @brief Epoch time in nanoseconds the request arrived.
+    uint64_t time;
+    /// @brief Peer address and port, in network order.
+    uint32_t addr;
+    uint16_t port;
+    Transport transport;
+    uint8_t _pad;
+    uint16_t requestSize;
+    uint16_t replySize;
+  };
+
+  /// @return Epoch time in nanoseconds, the time records carry.
+  static uint64_t now() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  }
+
+  /// @brief Appends a record to a buffer, to be pushed to a Writer later
+  /// with others.
+  static void append(std::vector<uint8_t> &out, Transport transport,
+                     uint64_t time, const sockaddr_in &peer,
+                     const char *request, size_t requestSize,
+                     const char *reply, size_t replySize) {
+    Record r = {};
+    r.time = time;
+    r.addr = peer.sin_addr.s_addr;
+    r.port = peer.sin_port;
+    r.transport = transport;
+    r.requestSize = std::min<size_t>(requestSize, UINT16_MAX);
+    r.replySize = std::min<size_t>(replySize, UINT16_MAX);
+    const uint8_t *p = (const uint8_t *)&r;
+    out.insert(out.end(), p, p + sizeof(r));
+    out.insert(out.end(), request, request + r.requestSize);
+    out.insert(out.end(), reply, reply + r.replySize);
+  }
+
+  /// @brief Background writer of captured records.
+  /// push() only appends to a buffer, a thread writes it out every
+  /// FLUSH_INTERVAL or as soon as FLUSH_SIZE bytes wait. Servers are never
+  /// held back by the disk: past MAX_PENDING bytes records are dropped.
+  /// Processes forked from the owner must leave with _exit(), see
+  /// TCPServer::exitChild(), and never destroy it.
+  class Writer {
+   private:
+    /// @brief Milliseconds records may wait to be written.
+    static const int FLUSH_INTERVAL = 1000;
+    static const size_t FLUSH_SIZE = 1 << 20;
+    static const size_t MAX_PENDING = 64 << 20;
+
+    int _fd;
+    /// @brief Only the process that opened the capture may write to it.
+    pid_t _owner;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::vector<uint8_t> _pending;
+    bool _stop = false;
+    std::atomic<uint64_t> _dropped = 0;
+    std::unique_ptr<std::thread> _thread;
+
+    // Delete copy constructor to prevent accidental copies
+    Writer(const Writer &) = delete;
+    Writer &operator=(const Writer &) = delete;
+
+    void run() {
+      const auto interval = std::chrono::milliseconds(FLUSH_INTERVAL);
+      std::vector<uint8_t> out;
+      uint64_t reported = 0;
+      std::unique_lock<std::mutex> lock(_mutex);
+      while (true) {
+        _cond.wait_for(lock, interval, [this] {
+          return _stop || _pending.size() >= FLUSH_SIZE;
+        });
+        std::swap(out, _pending);
+        bool stop = _stop;
+        lock.unlock();
+
+        if (!out.empty() &&
+            ::write(_fd, out.data(), out.size()) != (ssize_t)out.size())
+          WARN("Failed to write capture: %s\n", strerror(errno));
+        out.clear();
+        uint64_t dropped = _dropped.load();
+        if (dropped != reported) {
+          WARN("Dropped %lu capture batches, the disk fell behind.\n",
+               (unsigned long)(dropped - reported));
+          reported = dropped;
+        }
+        if (stop) return;
+        lock.lock();
+      }
+    }
+
+   public:
+    /// @brief Creates a capture, truncating any file at the path. Will
+    /// exit(1) if unsuccessful.
+    /// @param path Capture file path.
+    Writer(const char *path) : _owner(getpid()) {
+      _fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (_fd == -1)
+        ERROR("Failed to open capture %s: %s\n", path, strerror(errno));
+      FileHeader header;
+      memcpy(header.magic, MAGIC, sizeof(MAGIC));
+      header.version = VERSION;
+      if (::write(_fd, &header, sizeof(header)) != sizeof(header))
+        ERROR("Failed to initialize capture %s: %s\n", path, strerror(errno));
+      _thread = std::make_unique<std::thread>(&Writer::run, this);
+    }
+
+    /// @brief Queues records built with append(), and clears them.
+    void push(std::vector<uint8_t> &records) {
+      // Forked children do not have the writer thread.
+      if (getpid() != _owner || records.empty()) return;
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_pending.size() + records.size() > MAX_PENDING) {
+          _dropped++;
+        } else {
+          _pending.insert(_pending.end(), records.begin(), records.end());
+          if (_pending.size() >= FLUSH_SIZE) _cond.notify_one();
+        }
+      }
+      records.clear();
+    }
+
+    /// @return Batches of records dropped as the disk fell behind.
+    uint64_t dropped() const { return _dropped; }
+
+    ~Writer() {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+      }
+      _cond.notify_one();
+      _thread->join();
+      close(_fd);
+    }
+  };
+
+  /// @brief Reads the records of a capture in order.
+  class Reader {
+   private:
+    FILE *_file;
+
+    // Delete copy constructor to prevent accidental copies
+    Reader(const Reader &) = delete;
+    Reader &operator=(const Reader &) = delete;
+
+   public:
+    /// @brief Opens a capture. Will exit(1) if unsuccessful.
+    Reader(const char *path) {
+      _file = fopen(path, "rb");
+      if (_file == nullptr)
+        ERROR("Failed to open capture %s: %s\n", path, strerror(errno));
+      FileHeader header;
+      if (fread(&header, sizeof(header), 1, _file) != 1 ||
+          memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+          header.version != VERSION)
+        ERROR("File %s is not a compatible capture.\n", path);
+    }
+
+    /// @brief Reads the next record. A torn record at the end is ignored.
+    /// @return Whether a record was read.
+    bool next(Record &r, std::string &request, std::string &reply) {
+      if (fread(&r, sizeof(r), 1, _file) != 1) return false;
+      request.resize(r.requestSize);
+      reply.resize(r.replySize);
+      return fread(request.data(), 1, r.requestSize, _file) ==
+                 r.requestSize &&
+             fread(reply.data(), 1, r.replySize, _file) == r.replySize;
+    }
+
+    ~Reader() { fclose(_file); }
+  };
+};
+
+#endif  // CAPTURE_HPP_
@@ -0,0 +1,205 @@
+#ifndef CYCLES_HPP_
+#define CYCLES_HPP_
+
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "server/Metrics.hpp"
+
+/// @brief Cycle accounting of requests by opcode and stage.
+/// Stages are bracketed with the time stamp counter and their cycles added
+/// to counters of the calling thread, so accounting takes no lock and
+/// shares no cache line. Stages nest and are exclusive: a stage inside
+/// another is not counted again in the outer one.
+///
+/// Off unless enable() is called, a stage then costs a load and a branch.
+class Cycles {
+ public:
+  enum Stage {
+    RECV,
+    DISPATCH,
+    PARSE,
+    LOOKUP,
+    EVALUATE,
+    SCOREBOARD,
+    FORMAT,
+    SEND,
+    STAGES
+  };
+
+  static constexpr const char *STAGE_NAMES[STAGES] = {
+      "recv", "dispatch", "parse", "lookup", "evaluate", "scoreboard",
+      "format", "send"};
+
+  /// @return Time stamp counter, or nanoseconds where there is none.
+  static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+  }
+
+ private:
+  /// @brief Counters of a thread, only written by it. Plain loads and
+  /// stores of relaxed atomics, so readers on other threads are safe.
+  struct alignas(64) Counters {
+    std::atomic<uint64_t> cycles[Metrics::OPCODES][STAGES] = {};
+    std::atomic<uint64_t> requests[Metrics::OPCODES] = {};
+  };
+
+  static void add(std::atomic<uint64_t> &counter, uint64_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+  }
+
+  inline static std::atomic<bool> _enabled = false;
+  /// @brief Counter ticks per nanosecond, measured by enable().
+  inline static double _ghz = 0;
+  inline static std::mutex _mutex;
+  inline static std::vector<std::unique_ptr<Counters>> _threads;
+  inline static thread_local Counters *_counters = nullptr;
+  /// @brief Opcode of the request being handled on this thread.
+  inline static thread_local Metrics::Opcode _opcode = Metrics::OTHER_OPCODE;
+
+  /// @return Counters of the calling thread, registered on first use.
+  static Counters &counters() {
+    if (_counters == nullptr) {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _threads.push_back(std::make_unique<Counters>());
+      _counters = _threads.back().get();
+    }
+    return *_counters;
+  }
+
+ public:
+  /// @brief Makes an opcode current on this thread while it lives.
+  class Scope {
+   private:
+    Metrics::Opcode _previous;
+
+   public:
+    Scope(Metrics::Opcode opcode) : _previous(_opcode) { _opcode = opcode; }
+    ~Scope() { _opcode = _previous; }
+  };
+
+  /// @brief Counts its lifetime, less that of the stages inside it, to a
+  /// stage of the current opcode.
+  class Timer {
+   private:
+    inline static thread_local Timer *_open = nullptr;
+
+    Stage _stage;
+    Timer *_parent = nullptr;
+    uint64_t _begin = 0;
+    uint64_t _inner = 0;
+
+    // Delete copy constructor to prevent accidental copies
+    Timer(const Timer &) = delete;
+    Timer &operator=(const Timer &) = delete;
+
+   public:
+    Timer(Stage stage) : _stage(stage) {
+      if (!enabled()) return;
+      _parent = _open;
+      _open = this;
+      _begin = now();
+    }
+    ~Timer() {
+      if (_begin == 0) return;
+      uint64_t elapsed = now() - _begin;
+      Cycles::add(_opcode, _stage, elapsed - std::min(_inner, elapsed));
+      if (_parent != nullptr) _parent->_inner += elapsed;
+      _open = _parent;
+    }
+  };
+
+  /// @brief Turns accounting on, measuring the counter frequency first.
+  static void enable() {
+    timespec a, b;
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    uint64_t begin = now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    uint64_t end = now();
+    clock_gettime(CLOCK_MONOTONIC, &b);
+    _ghz = (end - begin) /
+           ((b.tv_sec - a.tv_sec) * 1e9 + (b.tv_nsec - a.tv_nsec));
+    _enabled = true;
+  }
+
+  /// @brief Turns accounting off in a forked child: its counters die with
+  /// it, and another thread may have held their lock at the fork.
+  static void forked() { _enabled = false; }
+
+  /// @return Whether cycles are counted.
+  static bool enabled() {
+    return _enabled.load(std::memory_order_relaxed);
+  }
+
+  /// @brief Counts cycles measured by the caller, such as a share of those
+  /// spent receiving a batch.
+  static void add(Metrics::Opcode opcode, Stage stage, uint64_t cycles) {
+    if (enabled()) Cycles::add(counters().cycles[opcode][stage], cycles);
+  }
+
+  /// @brief Counts a request handled.
+  static void request(Metrics::Opcode opcode) {
+    if (enabled()) Cycles::add(counters().requests[opcode], 1);
+  }
+
+  /// @brief Renders cycles per request of every opcode seen, by stage,
+  /// summed over all threads.
+  static std::string toString() {
+    if (!enabled()) return "Cycle accounting is off, start GS with -C.\n";
+    uint64_t cycles[Metrics::OPCODES][STAGES] = {};
+    uint64_t requests[Metrics::OPCODES] = {};
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      for (const auto &t : _threads)
+        for (int o = 0; o < Metrics::OPCODES; o++) {
+          requests[o] += t->requests[o].load(std::memory_order_relaxed);
+          for (int s = 0; s < STAGES; s++)
+            cycles[o][s] += t->cycles[o][s].load(std::memory_order_relaxed);
+        }
+    }
+    std::stringstream str;
+    str << "Cycles per request, counter at " << std::fixed
+        << std::setprecision(2) << _ghz << " GHz\n"
+        << std::left << std::setw(6) << "" << std::right << std::setw(10)
+        << "requests";
+    for (int s = 0; s < STAGES; s++) str << std::setw(11) << STAGE_NAMES[s];
+    str << std::setw(11) << "total"
+        << "\n";
+    for (int o = 0; o < Metrics::OPCODES; o++) {
+      if (requests[o] == 0) continue;
+      str << std::left << std::setw(6) << Metrics::OPCODE_NAMES[o]
+          << std::right << std::setw(10) << requests[o];
+      uint64_t total = 0;
+      for (int s = 0; s < STAGES; s++) {
+        str << std::setw(11) << cycles[o][s] / requests[o];
+        total += cycles[o][s];
+      }
+      str << std::setw(11) << total / requests[o] << "\n";
+    }
+    return str.str();
+  }
+};
+
+#endif  // CYCLES_HPP_
@@ -3,6 +3,7 @@
 
 #include <time.h>
 
+#include <algorithm>
 #include <cstdlib>
 #include <ctime>
 #include <iomanip>
@@ -10,7 +11,12 @@
 
 #include "Trial.hpp"
 
-/// @brief Class that represents a Game Session in 32 bytes.
+/// @brief Class that represents a Game Session in 16 bytes.
+/// Codes are stored as 11-bit indices and their feedback is recomputed when
+/// needed. While a game is played only its start time modulo TIME_WINDOW is
+/// kept, which is enough since every game is settled (see inProgress())
+/// within its time limit, well inside the window. Once it ends the same bits
+/// hold its duration.
 class GameSession {
  public:
   /// @brief Result of a trial.
@@ -32,26 +38,59 @@ class GameSession {
     // OK
     PLAYING
   };
+  static constexpr const char *RESULT_NAMES[] = {
+      "ERROR", "QUIT", "DUPLICATE", "INVALID",
+      "TIMEOUT", "LOSS", "WIN", "PLAYING"};
+
+  /// @brief Period of the stored start time in seconds, must exceed the
+  /// longest game by the time it may take to settle it.
+  static constexpr uint32_t TIME_WINDOW = 1024;
+  /// @brief Longest time limit of a game in seconds.
+  static constexpr uint32_t MAX_TIME = 600;
 
  private:
   /// @brief Maximum number of guesses that can be made in a game.
   static constexpr int TRIALS_NUMBER = 8;
-  /// @brief Epoch time in seconds of game start.
-  time_t _startTime = 0;
+
+  // First word: the code, trials 1 to 4 and the state.
+  uint64_t _code : 11 = 0;
+  uint64_t _trials1 : 44 = 0;
+  uint64_t _nT : 4 = 1;
+  uint64_t _lastResult : 3 = ERROR;
+  uint64_t _debug : 1 = false;
+  // Second word: trials 5 to 8 and the time.
+  uint64_t _trials2 : 44 = 0;
   /// @brief Provided time limit of game in seconds.
-  uint32_t _maxTime : 10 = 0;
-  /// @brief Time from start to end in seconds.
-  uint32_t _duration : 10 = 0;
-  uint32_t _nT : 4 = 1;
-  uint32_t _debug : 1 = false;
-  TrialResult _lastResult = ERROR;
-  Trial _code;
-  Trial _trials[TRIALS_NUMBER];
+  uint64_t _maxTime : 10 = 0;
+  /// @brief Start time modulo TIME_WINDOW while playing, duration after.
+  uint64_t _time : 10 = 0;
 
-  /// @brief Getter for trial
+  /// @brief Code index of a trial.
   /// @param nT Trial number
-  /// @return Trial
-  Trial &getTrial(int nT) { return _trials[nT - 1]; }
+  uint16_t trialIndex(int nT) const {
+    uint64_t word = nT <= 4 ? _trials1 : _trials2;
+    return word >> ((nT - 1) % 4 * 11) & 0x7ff;
+  }
+
+  void setTrial(int nT, const Trial &t) {
+    int shift = (nT - 1) % 4 * 11;
+    uint64_t index = t.index();
+    if (nT <= 4)
+      _trials1 = (_trials1 & ~(0x7ffull << shift)) | index << shift;
+    else
+      _trials2 = (_trials2 & ~(0x7ffull << shift)) | index << shift;
+  }
+
+  /// @brief Seconds played at a given time, only meaningful while playing.
+  uint32_t elapsed(time_t at) const {
+    return (uint32_t)(at - _time) % TIME_WINDOW;
+  }
+
+  /// @brief Ends the game, keeping its duration in place of its start.
+  void end(TrialResult result) {
+    _time = std::min<uint32_t>(elapsed(utils_clock.now()), _maxTime);
+    _lastResult = result;
+  }
 
  public:
   /// @brief Default constructor. Resets seed on random number generator.
@@ -63,11 +102,11 @@ class GameSession {
   /// @return New Session.
   static GameSession newDebugGame(int maxTime, Trial code) {
     GameSession session;
-    session._startTime = time(NULL);
+    session._time = utils_clock.now() % TIME_WINDOW;
     session._maxTime = maxTime;
     session._debug = true;
     session._lastResult = PLAYING;
-    session._code = code;
+    session._code = code.index();
     return session;
   }
 
@@ -82,10 +121,18 @@ class GameSession {
 
   /// @brief Getter for trial
   /// @param nT Trial number
-  /// @return Trial
-  const Trial &getTrial(int nT) const { return _trials[nT - 1]; }
+  /// @return Trial, invalid if not made yet.
+  Trial getTrial(int nT) const {
+    return nT < _nT ? Trial::fromIndex(trialIndex(nT)) : Trial();
+  }
+
+  /// @brief Recomputes the feedback of a trial already made.
+  /// @param nT Trial number
+  void getnBW(int nT, uint16_t &nB, uint16_t &nW) const {
+    getTrial(nT).evaluate(getCode(), nB, nW);
+  }
 
-  const Trial &getCode() const { return _code; }
+  Trial getCode() const { return Trial::fromIndex(_code); }
 
   /// @brief Attempts to execute a trial
   /// @param trial To be executed.
@@ -101,15 +148,14 @@ class GameSession {
     }
 
     DEBUG(
-        "Attemping trial %c %c %c %c, nT=%d, _lastResult=%d, Secret (%c %c %c "
-        "%c)\n",
-        trial.c1(), trial.c2(), trial.c3(), trial.c4(), nT, _lastResult,
-        _code.c1(), _code.c2(), _code.c3(), _code.c4());
+        "Attemping trial %c %c %c %c, nT=%d, _lastResult=%d, Secret (%s)\n",
+        trial.c1(), trial.c2(), trial.c3(), trial.c4(), nT, result(),
+        getCode().toString().c_str());
 
     // Check if trial is a retry.
     if (nT == _nT - 1 && trial == getTrial(nT)) {
-      getTrial(_nT - 1).getnBW(nB, nW);
-      return _lastResult;
+      getnBW(nT, nB, nW);
+      return result();
     }
 
     // If game has already ended, handling should be a bit different.
@@ -124,31 +170,30 @@ class GameSession {
         return QUIT;
       }
       // Cases: TIMEOUT/QUIT/ERROR
-      return _lastResult;
+      return result();
     } else if (inProgress()) {  // Check if there is still time left
       // If not retry, trial must be next trial.
       if (nT != _nT) {
         return INVALID;
       }
       // Check if trial was not attempted before.
-      for (const Trial &t : _trials) {
-        if (trial == t) return DUPLICATE;
+      for (int i = 1; i < _nT; i++) {
+        if (trial == getTrial(i)) return DUPLICATE;
       }
       // Calculate numbers of blacks and whites
-      bool victory = trial.evaluateNumbers(_code, nB, nW);
+      bool victory = trial.evaluateNumbers(getCode(), nB, nW);
       // Register trial
-      getTrial(_nT++) = trial;
-      // Check if limit of trials was exceeded.
-      if (_nT > TRIALS_NUMBER) {
-        _lastResult = LOSS;
-      }
+      setTrial(_nT++, trial);
       // Or if it was a victory
       if (victory) {
-        _lastResult = WIN;
+        end(WIN);
+      } else if (_nT > TRIALS_NUMBER) {
+        // Check if limit of trials was exceeded.
+        end(LOSS);
       }
     }
     // Cases: WIN/LOSS/PLAYING/TIMEOUT
-    return _lastResult;
+    return result();
   }
 
   /// @brief Set game to no longer be in progress.
@@ -156,7 +201,7 @@ class GameSession {
   /// progress.
   int endGame() {
     if (inProgress()) {
-      _lastResult = QUIT;
+      end(QUIT);
       return true;
     }
     return false;
@@ -165,28 +210,27 @@ class GameSession {
   /// @brief Get game score.
   int score() const { return 
     (TRIALS_NUMBER - _nT + 2) * 
-    (600 - _duration + 1) / 6; 
+    (600 - duration() + 1) / 6; 
   }
 
   /// @brief Generates string representation of played trials.
   /// @return String representation of played trials.
   std::string showTrials(int plid) const {
     std::stringstream res;
-    std::time_t result = std::time(nullptr);
     if (_lastResult == PLAYING) {
       res << "Ongoing";
     } else {
       res << "Finalized";
     }
     res << " game found for player " + std::to_string(plid) + "\n";
-    res << std::put_time(std::localtime(&result), "%c %Z");
+    res << utils_clock.longString();
     res << "\n";
     if (_lastResult == WIN) {
       res << "Congratulations! You won in " + std::to_string(_nT) + " trials!\n";
     } else if (_lastResult == PLAYING) {
       res << "Currently playing trial " + std::to_string(_nT) + "!\n";
     } else {
-      res << "You lost! The secret code was " + _code.toString() + "\n";
+      res << "You lost! The secret code was " + getCode().toString() + "\n";
     }
 
     res << "\n" << " Trial " << " Code " << " nB nW" << "\n";
@@ -195,7 +239,7 @@ class GameSession {
       Trial t = getTrial(i);
       res << std::setw(6) << std::to_string(i) << "  " << t.toString() << "  ";
       if (i < _nT) {
-        t.getnBW(nB, nW);
+        getnBW(i, nB, nW);
         res << std::setw(2) << std::to_string(nB) << " " << std::setw(2) << std::to_string(nW) << "\n";
       } else {
         res << "\n";
@@ -213,29 +257,43 @@ class GameSession {
 
   /// @return Remaining playing time in seconds.
   time_t getRemaining() const {
-    return static_cast<time_t>(_maxTime - _duration);
+    return static_cast<time_t>(_maxTime - duration());
   }
 
+  /// @return Seconds played so far, or until the game ended.
   uint32_t duration() const {
-    return _duration;
+    if (_lastResult != PLAYING) return _time;
+    return std::min<uint32_t>(elapsed(utils_clock.now()), _maxTime);
+  }
+
+  uint32_t maxTime() const { return _maxTime; }
+
+  /// @brief Epoch time a game being played runs out of time.
+  /// @param ref Time at which the game was known to be in progress.
+  time_t deadline(time_t ref) const { return ref - elapsed(ref) + _maxTime; }
+
+  /// @brief Ends a game being played for running out of time.
+  void expire() {
+    _time = _maxTime;
+    _lastResult = TIMEOUT;
   }
 
   /// @return Whether game is in progress. (Playing and not out of time)
   bool inProgress() {
-    if (_lastResult == PLAYING) {
-      _duration = std::clamp(time(NULL) - _startTime, static_cast<time_t>(0),
-                             static_cast<time_t>(_maxTime));
-      if (getRemaining() <= 0) _lastResult = TIMEOUT;
-    }
+    if (_lastResult == PLAYING && elapsed(utils_clock.now()) >= _maxTime)
+      expire();
     return _lastResult == PLAYING;
   }
 
   uint16_t nT() const { return _nT; }
+
+  TrialResult result() const { return (TrialResult)_lastResult; }
   
   bool debug() const { return _debug; }
 
   bool exists() { return _lastResult != ERROR; }
 };
-static constexpr int e = sizeof(GameSession);
+static_assert(sizeof(GameSession) == 16,
+              "Four sessions must fit in a cache line");
 
 #endif  // GAMESESSION_HPP_
\ No newline at end of file
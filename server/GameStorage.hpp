@@ -2,71 +2,701 @@
 #define GAMESTORAGE_HPP
 
 #include <algorithm>
+#include <atomic>
+#include <functional>
 #include <iostream>
-#include <optional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "server/Archive.hpp"
+#include "server/Cycles.hpp"
 #include "server/GameSession.hpp"
+#include "server/Leaderboard.hpp"
+#include "server/PlayerStats.hpp"
+#include "server/Probes.hpp"
+#include "server/SeqLock.hpp"
+#include "server/SessionSpill.hpp"
+#include "server/SessionTable.hpp"
+#include "server/Tracer.hpp"
+#include "server/WriteAheadLog.hpp"
+
+/// @brief Statistics of each player, indexed directly by PLID.
+using StatsTable = PlidTable<PlayerStats>;
 
 class GameStorage {
+ public:
+  /// @brief Number of games in a scoreboard page.
+  static constexpr size_t SCOREBOARD_PAGE = 10;
+  /// @brief Scoreboard pages kept rendered.
+  static const size_t MAX_CACHED_PAGES = 64;
+  /// @brief Number of session locks of a threaded storage.
+  static const size_t SHARDS = 1024;
+
+  /// @brief Top page of the scoreboard, never changed once published.
+  struct TopScores {
+    uint64_t version = 0;
+    std::vector<Leaderboard::Entry> entries;
+  };
+
  private:
-  std::unordered_map<int, GameSession> _sessions;
-  std::vector<std::pair<int, GameSession>> _scoreboard;
+  /// @brief Lock of the sessions in some cache lines of the table, alone in
+  /// its own cache line so threads taking neighbouring locks do not contend.
+  struct alignas(64) Shard {
+    std::mutex mutex;
+  };
+
+  /// @brief Games started and won by one thread of a threaded storage, kept
+  /// until collect() moves them to the deadline queue and the scoreboard, so
+  /// threads serving requests share no lock but their sessions'.
+  struct alignas(64) Inbox {
+    std::mutex mutex;
+    std::vector<std::pair<time_t, int>> deadlines;
+    std::vector<std::pair<int, GameSession>> wins;
+  };
+
+  SessionTable _sessions;
+  /// @brief Guards each cache line of a shared session table.
+  std::unique_ptr<SeqLock> _locks;
+  /// @brief Guards the sessions of a storage used by many threads.
+  std::unique_ptr<Shard[]> _shards;
+  /// @brief Inbox of each thread that changed a threaded storage.
+  std::vector<std::unique_ptr<Inbox>> _inboxes;
+  std::mutex _inboxesMutex;
+  inline static thread_local Inbox* _inbox = nullptr;
+  /// @brief Storage that _inbox belongs to, a thread changing another one
+  /// registers a new inbox with it.
+  inline static thread_local uint64_t _inboxStorage = 0;
+  inline static std::atomic<uint64_t> _lastId = 0;
+  /// @brief Tells apart storages that reuse the memory of earlier ones.
+  const uint64_t _id = ++_lastId;
+  StatsTable _stats;
+  /// @brief Whether finished games are counted in _stats.
+  bool _countStats = true;
+  Leaderboard _scoreboard;
+  /// @brief Serializes scoreboard insertions and the reads of the whole
+  /// tree. The top page is read from _top instead, without locking.
+  std::mutex _scoreboardMutex;
+  /// @brief Latest top page, replaced whole when a win makes it stale. Old
+  /// pages are freed by the last reader still holding them.
+  std::atomic<std::shared_ptr<const TopScores>> _top;
+  /// @brief Log of state changes, if durability is enabled.
+  WriteAheadLog* _wal = nullptr;
+  /// @brief Keeps the session table within a memory budget, if any.
+  SessionSpill* _spill = nullptr;
+  /// @brief Number of sessions ever started, one per PLID.
+  std::atomic<uint64_t> _sessionCount = 0;
+  /// @brief Archive of finished games, if history is kept.
+  Archive::Writer* _archive = nullptr;
+  /// @brief Number of state changes so far.
+  std::atomic<uint64_t> _changes = 0;
+  /// @brief Incremented whenever the scoreboard changes.
+  std::atomic<uint64_t> _scoreboardVersion = 0;
+
+  /// @brief Rendered scoreboard page.
+  struct CachedPage {
+    uint64_t version;
+    std::string text;
+  };
+  /// @brief Rendered scoreboard pages by first index, dropped when the
+  /// scoreboard changes.
+  std::unordered_map<size_t, CachedPage> _pageCache;
+
+  /// @brief Rendered trials of a session. The session image itself is the
+  /// version: any change to it, or a new second, makes the text stale.
+  struct CachedTrials {
+    int plid = 0;
+    time_t second = 0;
+    GameSession session;
+    std::string text;
+  };
+  static const size_t TRIALS_CACHE_SIZE = 1024;
+  /// @brief Direct-mapped by PLID.
+  std::vector<CachedTrials> _trialsCache;
+  /// @brief Epoch time the storage was created, for rates.
+  time_t _started;
+
+  /// @brief When each game being played runs out of time, earliest first.
+  /// Entries of games that ended early are skipped when they come up. Games
+  /// started by threads are only queued when their inboxes are collected.
+  std::priority_queue<std::pair<time_t, int>,
+                      std::vector<std::pair<time_t, int>>,
+                      std::greater<std::pair<time_t, int>>>
+      _deadlines;
+  std::mutex _deadlinesMutex;
+  /// @brief Epoch time of the snapshot the storage was restored from.
+  time_t _restoredAt = 0;
+  /// @brief Games being played in the snapshot, until settled.
+  std::vector<int> _restoredPlaying;
+  /// @brief Time of the last replayed record of each session, until settled.
+  std::unordered_map<int, time_t> _replayedAt;
+
+  /// @return Session of a player, brought back to memory if evicted.
+  GameSession& session(int plid) {
+    if (_spill != nullptr) _spill->touch(plid);
+    return _sessions[plid];
+  }
+
+  /// @return Lock of the sessions of a threaded storage, nullptr otherwise.
+  std::mutex* shardMutex(int plid) {
+    if (_shards == nullptr) return nullptr;
+    return &_shards[plid * sizeof(GameSession) / STRIPE % SHARDS].mutex;
+  }
+
+  /// @return Inbox of the calling thread, registered on first use, nullptr
+  /// unless the storage is threaded.
+  Inbox* inbox() {
+    if (_shards == nullptr) return nullptr;
+    if (_inboxStorage != _id) {
+      std::lock_guard<std::mutex> lock(_inboxesMutex);
+      _inboxes.push_back(std::make_unique<Inbox>());
+      _inbox = _inboxes.back().get();
+      _inboxStorage = _id;
+    }
+    return _inbox;
+  }
+
+  /// @brief Moves the games started and won by every thread to the deadline
+  /// queue and the scoreboard. Session locks may be held, the queue and
+  /// scoreboard locks may not.
+  void collect() {
+    if (_shards == nullptr) return;
+    std::vector<std::pair<time_t, int>> deadlines;
+    std::vector<std::pair<int, GameSession>> wins;
+    {
+      std::lock_guard<std::mutex> lock(_inboxesMutex);
+      for (auto& in : _inboxes) {
+        std::lock_guard<std::mutex> inLock(in->mutex);
+        deadlines.insert(deadlines.end(), in->deadlines.begin(),
+                         in->deadlines.end());
+        wins.insert(wins.end(), in->wins.begin(), in->wins.end());
+        in->deadlines.clear();
+        in->wins.clear();
+      }
+    }
+    if (!deadlines.empty()) {
+      std::lock_guard<std::mutex> lock(_deadlinesMutex);
+      for (const auto& d : deadlines) _deadlines.push(d);
+    }
+    if (wins.empty()) return;
+    std::lock_guard<std::mutex> lock(_scoreboardMutex);
+    bool top = false;
+    for (const auto& [plid, s] : wins) top |= insert(plid, s);
+    if (top) publishTop();
+  }
+
+  /// @brief Adds a won game to the scoreboard. Must hold _scoreboardMutex.
+  /// @return Whether it made the top page.
+  bool insert(int plid, const GameSession& s) {
+    Cycles::Timer timer(Cycles::SCOREBOARD);
+    _scoreboard.insert(plid, s);
+    _scoreboardVersion++;
+    return _scoreboard.rank(_scoreboard.nodes().back().entry) < SCOREBOARD_PAGE;
+  }
+
+  /// @brief Finishes a restored game if it ran out of time, or schedules its
+  /// timeout otherwise.
+  /// @param ref Time at which the game was known to be in progress.
+  void settle(int plid, time_t ref) {
+    Writing writing(*this, plid);
+    GameSession& s = session(plid);
+    if (s.result() != GameSession::PLAYING) return;
+    time_t deadline = s.deadline(ref);
+    if (deadline > utils_clock.now()) {
+      _deadlines.emplace(deadline, plid);
+      return;
+    }
+    // The game ended at its deadline, not when the server came back.
+    s.expire();
+    log(WriteAheadLog::TIMEOUT, plid, deadline);
+    finished(plid, deadline);
+  }
+
+  /// @brief Replaces the top page of the scoreboard. Must hold
+  /// _scoreboardMutex.
+  void publishTop() {
+    auto top = std::make_shared<TopScores>();
+    top->version = _scoreboardVersion;
+    size_t n = std::min(_scoreboard.size(), SCOREBOARD_PAGE);
+    for (size_t i = 0; i < n; i++) top->entries.push_back(_scoreboard.at(i));
+    _top.store(std::move(top));
+  }
 
   // Delete copy constructor to prevent accidental copies
   GameStorage(const GameStorage&) = delete;
   GameStorage& operator=(const GameStorage&) = delete;
 
  public:
-  GameStorage() {}
+  /// @brief Bytes of the session table guarded by one sequence lock.
+  static const size_t STRIPE = 64;
+
+  /// @param shared Whether forked processes read the live session table,
+  /// instead of a copy-on-write snapshot of it.
+  /// @param threaded Whether sessions are changed from many threads.
+  GameStorage(bool shared = false, bool threaded = false)
+      : _sessions(shared),
+        _top(std::make_shared<TopScores>()),
+        _trialsCache(TRIALS_CACHE_SIZE),
+        _started(utils_clock.now()) {
+    if (shared) _locks = std::make_unique<SeqLock>(SessionTable::BYTES / STRIPE);
+    if (threaded) _shards = std::make_unique<Shard[]>(SHARDS);
+  }
+
+  /// @brief Marks a session as being changed for as long as it lives, so
+  /// other threads wait for it and processes sharing the table do not read
+  /// it half written. Its page is not spilled meanwhile, so references to
+  /// it stay valid whatever other sessions are touched.
+  class Writing {
+   private:
+    SeqLock* _locks;
+    std::mutex* _mutex;
+    SessionSpill* _spill;
+    int _plid;
+    size_t _stripe;
+
+   public:
+    Writing(GameStorage& store, int plid)
+        : _locks(store._locks.get()),
+          _mutex(store.shardMutex(plid)),
+          _spill(store._spill),
+          _plid(plid),
+          _stripe(plid * sizeof(GameSession) / STRIPE) {
+      if (_mutex != nullptr) _mutex->lock();
+      if (_locks != nullptr) _locks->writeBegin(_stripe);
+      if (_spill != nullptr) _spill->pin(_plid);
+    }
+    ~Writing() {
+      if (_spill != nullptr) _spill->unpin(_plid);
+      if (_locks != nullptr) _locks->writeEnd(_stripe);
+      if (_mutex != nullptr) _mutex->unlock();
+    }
+  };
+
+  /// @brief Keeps every session from changing for as long as it lives, so a
+  /// process forked meanwhile gets a consistent table, the games of every
+  /// inbox collected and no lock taken. Does nothing unless the storage is
+  /// threaded.
+  class Pause {
+   private:
+    GameStorage& _store;
+
+   public:
+    Pause(GameStorage& store) : _store(store) {
+      if (_store._shards == nullptr) return;
+      for (size_t i = 0; i < SHARDS; i++) _store._shards[i].mutex.lock();
+      _store.collect();
+    }
+    ~Pause() {
+      if (_store._shards == nullptr) return;
+      for (size_t i = SHARDS; i-- > 0;) _store._shards[i].mutex.unlock();
+    }
+  };
+
+  /// @brief Copies a session, safe from any process. Games that ran out of
+  /// time are only shown as such in the copy.
+  GameSession readSession(int plid) {
+    GameSession s;
+    if (_locks == nullptr) {
+      std::mutex* mutex = shardMutex(plid);
+      if (mutex != nullptr) mutex->lock();
+      s = session(plid);
+      if (mutex != nullptr) mutex->unlock();
+    } else {
+      size_t stripe = plid * sizeof(GameSession) / STRIPE;
+      uint32_t seq;
+      do {
+        seq = _locks->readBegin(stripe);
+        s = _sessions[plid];
+      } while (_locks->readRetry(stripe, seq));
+    }
+    s.inProgress();
+    return s;
+  }
+
+  /// @brief Reads a page of the session table as a whole, for snapshots.
+  /// @param p Page index.
+  /// @param buf Where the page is copied to, if it can not be read in place.
+  /// @return Page contents, nullptr if unreadable.
+  const char* readSessionPage(size_t p, char* buf) {
+    if (_spill != nullptr) return _spill->read(p, buf);
+    const char* page = _sessions.data() + p * SessionTable::PAGE_SIZE;
+    if (_locks == nullptr) return page;
+    GameSession* out = (GameSession*)buf;
+    int first = p * SessionSpill::PAGE_SESSIONS;
+    for (size_t i = 0; i < SessionSpill::PAGE_SESSIONS; i++) {
+      size_t stripe = (first + i) * sizeof(GameSession) / STRIPE;
+      uint32_t seq;
+      do {
+        seq = _locks->readBegin(stripe);
+        out[i] = _sessions[first + i];
+      } while (_locks->readRetry(stripe, seq));
+    }
+    return buf;
+  }
 
   GameSession& newSession(int plid, GameSession s) {
-    return (_sessions[plid] = s);
+    GameSession& slot = session(plid);
+    if (!slot.exists()) _sessionCount++;
+    if (s.result() == GameSession::PLAYING) {
+      time_t deadline = s.deadline(utils_clock.now());
+      if (Inbox* in = inbox()) {
+        std::lock_guard<std::mutex> lock(in->mutex);
+        in->deadlines.emplace_back(deadline, plid);
+      } else {
+        std::lock_guard<std::mutex> lock(_deadlinesMutex);
+        _deadlines.emplace(deadline, plid);
+      }
+    }
+    GS_PROBE4(game__start, plid, s.debug() ? "DBG" : "SNG",
+              GameSession::RESULT_NAMES[s.result()], s.maxTime());
+    return (slot = s);
+  }
+
+  /// @brief Getter for a session. Games that ran out of time are finished
+  /// here, if they are looked up before tick() finds them.
+  GameSession& getSession(int plid) {
+    Tracer::Stage stage("session lookup");
+    Cycles::Timer timer(Cycles::LOOKUP);
+    GameSession& s = session(plid);
+    if (s.result() == GameSession::PLAYING && !s.inProgress()) {
+      log(WriteAheadLog::TIMEOUT, plid);
+      finished(plid);
+    }
+    return s;
+  }
+
+  /// @brief Finishes the games that ran out of time. Must be called at
+  /// least every few minutes, sessions only keep their start time modulo
+  /// GameSession::TIME_WINDOW.
+  void tick() {
+    collect();
+    while (true) {
+      int plid;
+      {
+        std::lock_guard<std::mutex> lock(_deadlinesMutex);
+        if (_deadlines.empty() || _deadlines.top().first > utils_clock.now())
+          return;
+        plid = _deadlines.top().second;
+        _deadlines.pop();
+      }
+      // Sessions are locked before the queue, never while holding it.
+      Writing writing(*this, plid);
+      getSession(plid);
+    }
+  }
+
+  /// @return Microseconds until a game runs out of time, -1 if none is
+  /// being played.
+  long timeout() {
+    collect();
+    std::lock_guard<std::mutex> lock(_deadlinesMutex);
+    if (_deadlines.empty()) return -1;
+    time_t due = _deadlines.top().first;
+    return utils_clock.now() >= due ? 0 : (due - utils_clock.now()) * 1000000;
+  }
+
+  /// @brief Must be called once when a game ends, by win, loss, quit or
+  /// timeout.
+  /// @param plid Player ID associated with the session.
+  /// @param end Epoch time the game ended, 0 for now.
+  void finished(int plid, time_t end = 0) {
+    Tracer::Stage stage("finish game");
+    GameSession& s = session(plid);
+    // Games are won or lost by TRY, quit by QUT and timed out by the clock.
+    GS_PROBE4(game__end, plid,
+              s.result() == GameSession::QUIT      ? "QUT"
+              : s.result() == GameSession::TIMEOUT ? "TIMER"
+                                                   : "TRY",
+              GameSession::RESULT_NAMES[s.result()], s.duration());
+    if (_countStats) _stats[plid].add(s, end != 0 ? end : utils_clock.now());
+    if (_archive != nullptr) _archive->push(plid, s);
   }
 
-  GameSession& getSession(int plid) { return _sessions[plid]; }
+  /// @brief Starts or stops counting finished games in the player
+  /// statistics, on by default. Off only to measure what they cost.
+  void countStats(bool on) { _countStats = on; }
+
+  /// @brief Starts archiving finished games.
+  void archiveTo(Archive::Writer& archive) { _archive = &archive; }
+
+  /// @brief Starts keeping the session table within a memory budget.
+  void spillTo(SessionSpill& spill) { _spill = &spill; }
+
+  /// @return Spill of the session table, nullptr if memory is unbounded.
+  SessionSpill* spill() { return _spill; }
+
+  /// @return Number of sessions ever started, one per PLID.
+  uint64_t sessionCount() const { return _sessionCount; }
+
+  /// @brief Marks the storage as restored from a snapshot.
+  /// @param sessionCount Number of sessions in the snapshot.
+  /// @param time Epoch time the snapshot was taken.
+  /// @param playing Players with a game being played in the snapshot.
+  void restored(uint64_t sessionCount, time_t time, std::vector<int> playing) {
+    _sessionCount = sessionCount;
+    _restoredAt = time;
+    _restoredPlaying = std::move(playing);
+    if (_spill != nullptr) _spill->restored();
+    std::lock_guard<std::mutex> lock(_scoreboardMutex);
+    publishTop();
+  }
+
+  /// @brief Renders the memory usage of the session table.
+  std::string getMemoryString() {
+    std::stringstream str;
+    size_t pages = _spill != nullptr ? _spill->residentPages() : 0;
+    str << "Sessions:              " << _sessionCount << "\n"
+        << "Bytes per session:     " << sizeof(GameSession) << "\n";
+    if (_spill == nullptr) {
+      str << "Memory budget:         unlimited\n";
+      return str.str();
+    }
+    time_t uptime = std::max<time_t>(utils_clock.now() - _started, 1);
+    str << "Resident per session:  "
+        << (_sessionCount ? pages * SessionTable::PAGE_SIZE / _sessionCount
+                          : 0)
+        << "\n"
+        << "Resident pages:        " << pages << " of " << _spill->maxPages()
+        << " (" << pages * SessionTable::PAGE_SIZE / 1024 << " KiB)\n"
+        << "Evictions:             " << _spill->evictions() << " ("
+        << std::fixed << std::setprecision(2)
+        << (double)_spill->evictions() / uptime << "/s)\n"
+        << "Faults:                " << _spill->faults() << " ("
+        << (double)_spill->faults() / uptime << "/s)\n";
+    return str.str();
+  }
+
+  /// @brief Restores the state recorded in a log and starts logging to it.
+  /// @param wal Log to be replayed and appended to.
+  /// @param from Position of the first record not covered by a snapshot.
+  /// @return Number of records replayed.
+  size_t recover(WriteAheadLog& wal, uint64_t from = 0) {
+    size_t n = wal.replay(
+        from,
+        [this](WriteAheadLog::Operation op, int plid, const GameSession& s,
+               time_t time) {
+          if (plid < 1 || plid >= SessionTable::SIZE) return;
+          GameSession& prev = session(plid);
+          if (!prev.exists()) _sessionCount++;
+          // A game replaced by the next one had run out of time if the
+          // records say so, whatever the clock says now. Its timeout is
+          // normally logged on its own, before the next game starts.
+          if ((op == WriteAheadLog::START ||
+               op == WriteAheadLog::DEBUG_START) &&
+              prev.result() == GameSession::PLAYING) {
+            auto it = _replayedAt.find(plid);
+            time_t deadline = prev.deadline(
+                it != _replayedAt.end() ? it->second : _restoredAt);
+            if (deadline <= time) {
+              prev.expire();
+              _stats[plid].add(prev, deadline);
+            }
+          }
+          prev = s;
+          _replayedAt[plid] = time;
+          if (op == WriteAheadLog::TRY && s.result() == GameSession::WIN)
+            addToScoreboard(plid, s);
+          if ((op == WriteAheadLog::TRY && (s.result() == GameSession::WIN ||
+                                            s.result() == GameSession::LOSS)) ||
+              op == WriteAheadLog::QUIT || op == WriteAheadLog::TIMEOUT)
+            _stats[plid].add(s, time);
+        });
+    _wal = &wal;
+    return n;
+  }
+
+  /// @brief Brings the games being played in a restored storage up to date,
+  /// finishing those that ran out of time while the server was down. Must be
+  /// called once, after restoring from a snapshot and replaying the log.
+  /// Only the games the snapshot lists as being played and the sessions
+  /// replayed are looked at, the rest of the table is not read.
+  void settle() {
+    for (int plid : _restoredPlaying)
+      if (!_replayedAt.contains(plid)) settle(plid, _restoredAt);
+    for (const auto& [plid, time] : _replayedAt) settle(plid, time);
+    _restoredPlaying = {};
+    _replayedAt = {};
+  }
+
+  /// @brief Records the current state of a session in the log, if any.
+  /// @param op Request that changed the session.
+  /// @param plid Player ID associated with the session.
+  /// @param time Epoch time of the change, 0 for now.
+  void log(WriteAheadLog::Operation op, int plid, time_t time = 0) {
+    Tracer::Stage stage("wal append");
+    _changes++;
+    if (_wal != nullptr) _wal->append(op, plid, session(plid), time);
+  }
+
+  /// @return Number of state changes so far.
+  uint64_t changes() const { return _changes; }
+
+  /// @return Session table, for snapshots.
+  SessionTable& sessions() { return _sessions; }
+
+  /// @return Player statistics, for snapshots.
+  StatsTable& stats() { return _stats; }
+
+  /// @return Scoreboard, for snapshots.
+  Leaderboard& scoreboard() { return _scoreboard; }
 
   /// @brief Add a session to the scoreboard.
   /// @param plid Player ID associated with the session.
   /// @param s Session to be added.
-  /// @note Remember, score means nT, lower is better!
-  void addToScoreboard(int plid, GameSession s) {
-    if (_scoreboard.size() < 10) {
-      _scoreboard.push_back(std::make_pair(plid, s));
-    } else {
-      if (s.score() < _scoreboard.back().second.score()) {
-        _scoreboard.back() = std::make_pair(plid, s);
+  /// @note Every won game is kept, higher score is better. Games won on a
+  /// threaded storage only show once collected, by the next tick() or read
+  /// of the scoreboard.
+  void addToScoreboard(int plid, const GameSession& s) {
+    Tracer::Stage stage("scoreboard insert");
+    GS_PROBE4(scoreboard__insert, plid, "TRY",
+              GameSession::RESULT_NAMES[s.result()], s.score());
+    if (Inbox* in = inbox()) {
+      std::lock_guard<std::mutex> lock(in->mutex);
+      in->wins.emplace_back(plid, s);
+      return;
+    }
+    std::lock_guard<std::mutex> lock(_scoreboardMutex);
+    // Most wins rank too low to change the top page.
+    if (insert(plid, s)) publishTop();
+  }
+
+  /// @return Version of the scoreboard, changes on every insertion.
+  uint64_t scoreboardVersion() const { return _scoreboardVersion; }
+
+  /// @brief Renders a range of the scoreboard, reusing the text rendered for
+  /// the same range until the scoreboard changes.
+  /// @param first Index of the first game.
+  /// @return Scoreboard table, empty if there are no games in range.
+  const std::string& getCachedScoreboardString(size_t first = 0) {
+    collect();
+    if (_pageCache.size() > MAX_CACHED_PAGES) _pageCache.clear();
+    CachedPage& page = _pageCache[first];
+    if (first == 0) {
+      // The top page only changes when it is published again.
+      std::shared_ptr<const TopScores> top = _top.load();
+      if (page.version != top->version || page.text.empty()) {
+        page.version = top->version;
+        page.text = getTopString(*top);
       }
+      return page.text;
+    }
+    if (page.version != _scoreboardVersion || page.text.empty()) {
+      page.version = _scoreboardVersion;
+      page.text = getScoreboardString(first);
     }
-    std::stable_sort(_scoreboard.begin(), _scoreboard.end(),
-                     [](const std::pair<int, GameSession>& a,
-                        const std::pair<int, GameSession>& b) {
-                       return a.second.score() > b.second.score();
-                     });
+    return page.text;
   }
 
-  std::string getScoreboardString() {
-    if (_scoreboard.empty()) return "";
+  /// @brief Renders the trials of a session, reusing the text rendered for
+  /// the same session state within the same second.
+  /// @param plid Player ID associated with the session.
+  /// @param s Copy of the session, see readSession().
+  /// @return String representation of played trials.
+  const std::string& getTrialsString(int plid, const GameSession& s) {
+    CachedTrials& c = _trialsCache[plid % TRIALS_CACHE_SIZE];
+    if (c.plid != plid || c.second != utils_clock.now() ||
+        memcmp(&c.session, &s, sizeof(GameSession)) != 0) {
+      c.plid = plid;
+      c.second = utils_clock.now();
+      c.session = s;
+      c.text = s.showTrials(plid);
+    }
+    return c.text;
+  }
+
+  /// @brief Renders the statistics of a player.
+  /// @param plid Player ID.
+  /// @return Statistics, empty if the player never finished a game.
+  std::string getStatsString(int plid) {
+    PlayerStats s;
+    {
+      std::mutex* mutex = shardMutex(plid);
+      if (mutex != nullptr) mutex->lock();
+      s = _stats[plid];
+      if (mutex != nullptr) mutex->unlock();
+    }
+    return s.games() == 0 ? "" : s.toString(plid);
+  }
+
+  /// @brief Renders a range of the scoreboard.
+  /// @param first Index of the first game.
+  /// @param count Maximum number of games.
+  /// @return Scoreboard table, empty if there are no games in range.
+  std::string getScoreboardString(size_t first = 0,
+                                  size_t count = SCOREBOARD_PAGE) {
+    collect();
+    std::lock_guard<std::mutex> lock(_scoreboardMutex);
+    if (first >= _scoreboard.size()) return "";
+    size_t last = std::min(first + count, _scoreboard.size());
+    std::string title = first == 0 ? "TOP " + padLeft(last, 2) + " SCORES"
+                                   : "SCORES " + std::to_string(first + 1) +
+                                         "-" + std::to_string(last);
     std::stringstream str;
+    writeHeader(str, title);
+    for (size_t i = first; i < last; i++)
+      writeRow(str, i + 1, _scoreboard.at(i));
+    str << "+----+-------+--------+------+-----------+-------+----------+\n";
+    return str.str();
+  }
+
+  /// @brief Renders the best game of a player with its rank.
+  /// @param plid Player ID.
+  /// @return Scoreboard table, empty if the player never won.
+  std::string getRankString(int plid) {
+    collect();
+    std::lock_guard<std::mutex> lock(_scoreboardMutex);
+    const Leaderboard::Entry* e = _scoreboard.best(plid);
+    if (e == nullptr) return "";
+    size_t rank = _scoreboard.rank(*e) + 1;
+    std::stringstream str;
+    writeHeader(str, "PLAYER " + std::to_string(plid) + " RANKED " +
+                         std::to_string(rank) + " OF " +
+                         std::to_string(_scoreboard.size()));
+    writeRow(str, rank, *e);
+    str << "+----+-------+--------+------+-----------+-------+----------+\n";
+    return str.str();
+  }
+
+  /// @brief Renders a published top page of the scoreboard.
+  /// @return Scoreboard table, empty if there are no games.
+  static std::string getTopString(const TopScores& top) {
+    if (top.entries.empty()) return "";
+    std::stringstream str;
+    writeHeader(str, "TOP " + padLeft(top.entries.size(), 2) + " SCORES");
+    for (size_t i = 0; i < top.entries.size(); i++)
+      writeRow(str, i + 1, top.entries[i]);
+    str << "+----+-------+--------+------+-----------+-------+----------+\n";
+    return str.str();
+  }
+
+ private:
+  static std::string padLeft(size_t n, int width) {
+    std::string s = std::to_string(n);
+    return std::string(std::max(0, width - (int)s.size()), ' ') + s;
+  }
+
+  static void writeHeader(std::stringstream& str, const std::string& title) {
+    int left = (59 - (int)title.size()) / 2, right = 59 - left - title.size();
     str << "+-----------------------------------------------------------+\n";
-    str << "|                       TOP " << std::setw(2)
-        << std::to_string(_scoreboard.size())
-        << " SCORES                       |\n";
+    str << "|" << std::string(std::max(left, 0), ' ') << title
+        << std::string(std::max(right, 0), ' ') << "|\n";
     str << "+----+-------+--------+------+-----------+-------+----------+\n"
            "|    | SCORE | PLAYER | CODE | NO TRIALS |  MODE | DURATION |\n";
-    for (size_t i = 0; i < _scoreboard.size(); i++) {
-      const auto& s = _scoreboard[i];
-      str << "|" << std::setw(3) << std::to_string(i + 1) << " |  "
-          << std::setw(3) << std::to_string(s.second.score()) << "  | "
-          << std::setw(6) << std::to_string(s.first) << " | "
-          << s.second.getCode().toString() << " |     "
-          << std::to_string(s.second.nT()-1) << "     | "
-          << (s.second.debug() ? "DEBUG" : " PLAY") << " |   " << std::setw(3)
-          << std::to_string(s.second.duration()) << "s   |\n";
-    }
-    str << "+----+-------+--------+------+-----------+-------+----------+\n";
-    return str.str();
+  }
+
+  static void writeRow(std::stringstream& str, size_t rank,
+                       const Leaderboard::Entry& e) {
+    const GameSession& s = e.session;
+    str << "|" << std::setw(3) << std::to_string(rank) << " |  "
+        << std::setw(3) << std::to_string(e.score) << "  | " << std::setw(6)
+        << std::to_string(e.plid) << " | " << s.getCode().toString()
+        << " |     " << std::to_string(s.nT() - 1) << "     | "
+        << (s.debug() ? "DEBUG" : " PLAY") << " |   " << std::setw(3)
+        << std::to_string(s.duration()) << "s   |\n";
   }
 };
 #endif  // GAMESTORAGE_HPP_
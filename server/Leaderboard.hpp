@@ -0,0 +1,184 @@
+#ifndef LEADERBOARD_HPP_
+#define LEADERBOARD_HPP_
+
+#include <cstdint>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "server/GameSession.hpp"
+
+/// @brief Every won game, ordered by score.
+/// An order-statistic treap: each node knows the size of its subtree, so the
+/// k-th game and the rank of a game are found in O(log n). Nodes live in a
+/// vector and link by index, which keeps the tree trivially copyable to and
+/// from a snapshot.
+class Leaderboard {
+ public:
+  /// @brief Won game with its score cached.
+  struct Entry {
+    GameSession session;
+    int32_t plid;
+    /// @brief Insertion order, ties are ranked first come first served.
+    uint32_t seq;
+    uint16_t score;
+  };
+
+  struct Node {
+    Entry entry;
+    uint32_t left, right;
+    /// @brief Number of nodes in this subtree.
+    uint32_t size;
+    uint32_t priority;
+  };
+
+  static const uint32_t NIL = UINT32_MAX;
+
+ private:
+  static_assert(std::is_trivially_copyable_v<Node>,
+                "Nodes are copied as raw bytes");
+
+  std::vector<Node> _nodes;
+  uint32_t _root = NIL;
+  /// @brief Node of the best game of each player.
+  std::unordered_map<int, uint32_t> _best;
+  /// @brief State of the xorshift generator for node priorities.
+  uint32_t _random = 2463534242;
+
+  /// @return Whether a is ranked before b.
+  static bool before(const Entry &a, const Entry &b) {
+    return a.score > b.score || (a.score == b.score && a.seq < b.seq);
+  }
+
+  uint32_t size(uint32_t n) const { return n == NIL ? 0 : _nodes[n].size; }
+
+  void update(uint32_t n) {
+    _nodes[n].size = 1 + size(_nodes[n].left) + size(_nodes[n].right);
+  }
+
+  /// @brief Splits a subtree into the nodes ranked before key and the rest.
+  void split(uint32_t n, const Entry &key, uint32_t &l, uint32_t &r) {
+    if (n == NIL) {
+      l = r = NIL;
+      return;
+    }
+    if (before(_nodes[n].entry, key)) {
+      split(_nodes[n].right, key, _nodes[n].right, r);
+      l = n;
+    } else {
+      split(_nodes[n].left, key, l, _nodes[n].left);
+      r = n;
+    }
+    update(n);
+  }
+
+  /// @brief Joins two subtrees, every node of l ranked before those of r.
+  uint32_t merge(uint32_t l, uint32_t r) {
+    if (l == NIL) return r;
+    if (r == NIL) return l;
+    if (_nodes[l].priority > _nodes[r].priority) {
+      _nodes[l].right = merge(_nodes[l].right, r);
+      update(l);
+      return l;
+    }
+    _nodes[r].left = merge(l, _nodes[r].left);
+    update(r);
+    return r;
+  }
+
+  uint32_t nextPriority() {
+    _random ^= _random << 13;
+    _random ^= _random >> 17;
+    _random ^= _random << 5;
+    return _random;
+  }
+
+  void rebuildBest() {
+    _best.clear();
+    for (uint32_t i = 0; i < _nodes.size(); i++) {
+      auto it = _best.find(_nodes[i].entry.plid);
+      if (it == _best.end() || before(_nodes[i].entry, _nodes[it->second].entry))
+        _best[_nodes[i].entry.plid] = i;
+    }
+  }
+
+ public:
+  /// @brief Adds a won game. O(log n).
+  void insert(int plid, const GameSession &s) {
+    uint32_t n = _nodes.size();
+    Node &node = _nodes.emplace_back();
+    node.entry.session = s;
+    node.entry.plid = plid;
+    node.entry.seq = n;
+    node.entry.score = s.score();
+    node.left = node.right = NIL;
+    node.size = 1;
+    node.priority = nextPriority();
+
+    uint32_t l, r;
+    split(_root, _nodes[n].entry, l, r);
+    _root = merge(merge(l, n), r);
+
+    auto it = _best.find(plid);
+    if (it == _best.end() || before(_nodes[n].entry, _nodes[it->second].entry))
+      _best[plid] = n;
+  }
+
+  /// @return Number of won games.
+  size_t size() const { return _nodes.size(); }
+
+  bool empty() const { return _nodes.empty(); }
+
+  /// @brief Finds the game ranked k-th. O(log n).
+  /// @param k Index between 0 and size() - 1.
+  const Entry &at(size_t k) const {
+    uint32_t n = _root;
+    while (true) {
+      uint32_t l = size(_nodes[n].left);
+      if (k == l) return _nodes[n].entry;
+      if (k < l) {
+        n = _nodes[n].left;
+      } else {
+        k -= l + 1;
+        n = _nodes[n].right;
+      }
+    }
+  }
+
+  /// @brief Finds the best game of a player. O(1).
+  /// @return Entry, or nullptr if the player never won.
+  const Entry *best(int plid) const {
+    auto it = _best.find(plid);
+    return it == _best.end() ? nullptr : &_nodes[it->second].entry;
+  }
+
+  /// @brief Number of games ranked before an entry. O(log n).
+  size_t rank(const Entry &e) const {
+    size_t k = 0;
+    uint32_t n = _root;
+    while (n != NIL) {
+      if (before(_nodes[n].entry, e)) {
+        k += size(_nodes[n].left) + 1;
+        n = _nodes[n].right;
+      } else {
+        n = _nodes[n].left;
+      }
+    }
+    return k;
+  }
+
+  /// @return Raw nodes, for snapshots.
+  const std::vector<Node> &nodes() const { return _nodes; }
+
+  /// @return Root node, for snapshots.
+  uint32_t root() const { return _root; }
+
+  /// @brief Replaces the tree with one saved in a snapshot.
+  void restore(std::vector<Node> nodes, uint32_t root) {
+    _nodes = std::move(nodes);
+    _root = root;
+    rebuildBest();
+  }
+};
+
+#endif  // LEADERBOARD_HPP_
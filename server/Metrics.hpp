@@ -0,0 +1,422 @@
+#ifndef METRICS_HPP_
+#define METRICS_HPP_
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "common/utils.hpp"
+
+/// @brief Latency histogram with bounded relative error.
+/// Values below SUB_BUCKETS have a bucket each, larger ones share a bucket
+/// with the values of the same magnitude and the same SUB_BITS leading bits,
+/// so every bucket is within 1/SUB_BUCKETS (~6%) of the values it holds.
+/// Counts are relaxed atomics, readers see a consistent enough picture
+/// without ever blocking writers. A histogram only one thread records to is
+/// counted with plain loads and stores, no read-modify-write.
+class Histogram {
+ public:
+  static constexpr int SUB_BITS = 4;
+  static constexpr uint64_t SUB_BUCKETS = 1 << SUB_BITS;
+  /// @brief Magnitudes kept, values are capped at 2^MAGNITUDES.
+  static constexpr int MAGNITUDES = 40;
+  static constexpr size_t BUCKETS =
+      (MAGNITUDES - SUB_BITS + 1) * SUB_BUCKETS;
+
+ private:
+  std::atomic<uint64_t> _counts[BUCKETS];
+  std::atomic<uint64_t> _sum;
+
+  /// @return Largest value held by a bucket.
+  static uint64_t upperBound(size_t b) {
+    if (b < SUB_BUCKETS) return b;
+    int shift = b / SUB_BUCKETS - 1;
+    return ((SUB_BUCKETS + b % SUB_BUCKETS + 1) << shift) - 1;
+  }
+
+ public:
+  /// @return Bucket of a value.
+  static size_t bucket(uint64_t v) {
+    if (v < SUB_BUCKETS) return v;
+    int magnitude = 63 - __builtin_clzll(v);
+    if (magnitude >= MAGNITUDES) return BUCKETS - 1;
+    int shift = magnitude - SUB_BITS;
+    return (shift + 1) * SUB_BUCKETS + ((v >> shift) & (SUB_BUCKETS - 1));
+  }
+
+  /// @brief Counts n values of a bucket, from any thread.
+  /// @param sum Sum of the values.
+  void add(size_t b, uint64_t n, uint64_t sum) {
+    _counts[b].fetch_add(n, std::memory_order_relaxed);
+    _sum.fetch_add(sum, std::memory_order_relaxed);
+  }
+
+  /// @brief Counts n values of a bucket, from the only thread recording to
+  /// this histogram.
+  void addAlone(size_t b, uint64_t n, uint64_t sum) {
+    std::atomic<uint64_t> &c = _counts[b];
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    _sum.store(_sum.load(std::memory_order_relaxed) + sum,
+               std::memory_order_relaxed);
+  }
+
+  /// @brief Counts a value, from any thread.
+  void record(uint64_t v) { add(bucket(v), 1, v); }
+
+  /// @brief Counts a value, from the only thread recording to this
+  /// histogram.
+  void recordAlone(uint64_t v) { addAlone(bucket(v), 1, v); }
+
+  /// @brief Adds the counts of another histogram to this one.
+  void merge(const Histogram &other) {
+    for (size_t b = 0; b < BUCKETS; b++)
+      _counts[b].fetch_add(other._counts[b].load(std::memory_order_relaxed),
+                           std::memory_order_relaxed);
+    _sum.fetch_add(other.sum(), std::memory_order_relaxed);
+  }
+
+  /// @return Number of values recorded.
+  uint64_t count() const {
+    uint64_t n = 0;
+    for (const auto &c : _counts) n += c.load(std::memory_order_relaxed);
+    return n;
+  }
+
+  /// @return Sum of the values recorded.
+  uint64_t sum() const { return _sum.load(std::memory_order_relaxed); }
+
+  /// @param q Quantile between 0 and 1.
+  /// @return Upper bound of the value at a quantile, 0 if empty.
+  uint64_t percentile(double q) const {
+    uint64_t total = count();
+    if (total == 0) return 0;
+    uint64_t rank = q * total, seen = 0;
+    for (size_t b = 0; b < BUCKETS; b++) {
+      seen += _counts[b].load(std::memory_order_relaxed);
+      if (seen > rank) return upperBound(b);
+    }
+    return upperBound(BUCKETS - 1);
+  }
+};
+
+/// @brief Request metrics of the server: latency histograms by opcode and by
+/// result, and traffic counters. Lives in memory shared with forked
+/// children, so the TCP requests they answer are counted too.
+/// Every recording thread has histograms of its own, merged when read, so
+/// recording a request takes no atomic read-modify-write. Threads beyond
+/// SHARDS, and forked children, share the first set, counted atomically.
+class Metrics {
+ public:
+  enum Opcode { SNG, TRY, QUT, DBG, STR, SSB, OTHER_OPCODE, OPCODES };
+  enum Result { OK, NOK, DUP, INV, ETM, ENT, ERR, RESULTS };
+  enum Protocol { UDP, TCP, PROTOCOLS };
+
+  static constexpr const char *OPCODE_NAMES[OPCODES] = {
+      "SNG", "TRY", "QUT", "DBG", "STR", "SSB", "OTHER"};
+  static constexpr const char *RESULT_NAMES[RESULTS] = {
+      "OK", "NOK", "DUP", "INV", "ETM", "ENT", "ERR"};
+  static constexpr const char *PROTOCOL_NAMES[PROTOCOLS] = {"udp", "tcp"};
+  /// @brief Sets of histograms, the first shared by any thread.
+  static constexpr int SHARDS = 16;
+
+ private:
+  /// @brief Histograms of one recording thread.
+  struct Shard {
+    Histogram opcodes[OPCODES];
+    Histogram results[RESULTS];
+    /// @brief UDP requests split in time waiting in the socket buffer, from
+    /// their kernel timestamp, and time being served.
+    Histogram queueing;
+    Histogram service;
+  };
+
+  struct Counters {
+    /// @brief Tells apart metrics that reuse the memory of earlier ones.
+    uint64_t id;
+    /// @brief Shards claimed by threads, past the shared one.
+    std::atomic<int> claimed;
+    std::atomic<uint64_t> requests[PROTOCOLS];
+    std::atomic<uint64_t> bytesIn[PROTOCOLS];
+    std::atomic<uint64_t> bytesOut[PROTOCOLS];
+    /// @brief Requests that got no reply.
+    std::atomic<uint64_t> drops[PROTOCOLS];
+    /// @brief Requests repeating their player's last one, and those of them
+    /// executed again rather than answered from the session.
+    std::atomic<uint64_t> repeated;
+    std::atomic<uint64_t> reexecuted;
+    Shard shards[SHARDS];
+  };
+
+  /// @brief Shard a thread records to, claimed on its first record. Starts
+  /// zeroed, which no metrics have as id.
+  struct Claim {
+    uint64_t id;
+    int shard;
+  };
+  static inline thread_local Claim _claim;
+  static inline std::atomic<uint64_t> _lastId = 0;
+  static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                "Shared atomics must be lock free");
+
+  Counters *_c;
+
+  // Delete copy constructor to prevent accidental copies
+  Metrics(const Metrics &) = delete;
+  Metrics &operator=(const Metrics &) = delete;
+
+  static void add(std::atomic<uint64_t> &counter, uint64_t n) {
+    counter.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  /// @return Shard of the calling thread, 0 if it shares the first one.
+  int shard() {
+    if (_claim.id != _c->id) {
+      int s = _c->claimed.fetch_add(1, std::memory_order_relaxed) + 1;
+      _claim = {.id = _c->id, .shard = s < SHARDS ? s : 0};
+    }
+    return _claim.shard;
+  }
+
+  /// @brief Counts n values of a bucket to a histogram of a shard.
+  static void add(Histogram &h, int shard, size_t b, uint64_t n,
+                  uint64_t sum) {
+    if (shard == 0)
+      h.add(b, n, sum);
+    else
+      h.addAlone(b, n, sum);
+  }
+
+  /// @return First three characters of a text as a number, for switches.
+  static constexpr uint32_t code(const char *s) {
+    return (uint8_t)s[0] << 16 | (uint8_t)s[1] << 8 | (uint8_t)s[2];
+  }
+
+  /// @return Whether a text is at least three characters long.
+  static bool threeChars(const char *s) { return s[0] && s[1] && s[2]; }
+
+  /// @return Result of a status word.
+  static Result statusResult(const char *status) {
+    if (!threeChars(status)) return ERR;
+    if (status[0] == 'O' && status[1] == 'K' &&
+        (status[2] == ' ' || status[2] == '\n'))
+      return OK;
+    bool word = status[3] == ' ' || status[3] == '\n';
+    switch (code(status)) {
+      case code("NOK"): return word ? NOK : ERR;
+      case code("DUP"): return word ? DUP : ERR;
+      case code("INV"): return word ? INV : ERR;
+      case code("ETM"): return word ? ETM : ERR;
+      case code("ENT"): return word ? ENT : ERR;
+      case code("ERR"): return ERR;
+      case code("ACT"):
+      case code("FIN"): return status[3] == ' ' ? OK : ERR;
+      case code("EMP"): return strncmp(status, "EMPTY", 5) == 0 ? NOK : ERR;
+      default: return ERR;
+    }
+  }
+
+  /// @return Every shard added together.
+  std::unique_ptr<Shard> merged() const {
+    auto m = std::make_unique<Shard>();
+    int shards = std::min(_c->claimed.load() + 1, SHARDS);
+    for (int s = 0; s < shards; s++) {
+      const Shard &from = _c->shards[s];
+      for (int o = 0; o < OPCODES; o++) m->opcodes[o].merge(from.opcodes[o]);
+      for (int r = 0; r < RESULTS; r++) m->results[r].merge(from.results[r]);
+      m->queueing.merge(from.queueing);
+      m->service.merge(from.service);
+    }
+    return m;
+  }
+
+ public:
+  /// @brief Allocates zeroed counters. Will exit(1) if unsuccessful.
+  Metrics() {
+    void *p = mmap(nullptr, sizeof(Counters), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+      ERROR("Failed to allocate metrics: %s\n", strerror(errno));
+    _c = (Counters *)p;
+    _c->id = ++_lastId;
+  }
+
+  /// @brief Moves the calling thread to the shared shard, to be called by
+  /// forked children: the shard they inherit is still their parent's.
+  void forked() { _claim = {.id = _c->id, .shard = 0}; }
+
+  /// @return Monotonic time in nanoseconds, for latencies.
+  static uint64_t now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  }
+
+  /// @return Opcode of a request.
+  static Opcode opcode(const char *req) {
+    if (!threeChars(req)) return OTHER_OPCODE;
+    switch (code(req)) {
+      case code("SNG"): return SNG;
+      case code("TRY"): return TRY;
+      case code("QUT"): return QUT;
+      case code("DBG"): return DBG;
+      case code("STR"): return STR;
+      case code("SSB"): return SSB;
+      default: return OTHER_OPCODE;
+    }
+  }
+
+  /// @return Result of a reply, read from its status word. Replies listing
+  /// a game count as OK and empty listings as NOK.
+  static Result result(const char *reply) {
+    // Replies mostly are a three letter code and OK, told apart inline.
+    if (threeChars(reply) && reply[3] == ' ' && reply[4] == 'O' &&
+        reply[5] == 'K' && (reply[6] == ' ' || reply[6] == '\n'))
+      return OK;
+    const char *status = strchr(reply, ' ');
+    return status != nullptr ? statusResult(status + 1) : ERR;
+  }
+
+  /// @brief Counts a request answered.
+  /// @param ns Time from its arrival to its reply.
+  void record(Opcode o, Result r, uint64_t ns) {
+    int s = shard();
+    size_t b = Histogram::bucket(ns);
+    add(_c->shards[s].opcodes[o], s, b, 1, ns);
+    add(_c->shards[s].results[r], s, b, 1, ns);
+  }
+
+  /// @brief Counts a batch of UDP requests answered together. Requests are
+  /// tallied by opcode and result first, and every histogram they share is
+  /// counted once.
+  /// @param ns Time from the batch being received to its replies, the same
+  /// for all.
+  /// @param queued Time each request waited in the kernel before being
+  /// received, null if not timed. Zeros, unknown times, are not counted.
+  void record(int n, const Opcode *opcodes, const Result *results,
+              uint64_t ns, const uint64_t *queued = nullptr) {
+    int s = shard();
+    Shard &h = _c->shards[s];
+    uint64_t perOpcode[OPCODES] = {}, perResult[RESULTS] = {};
+    for (int i = 0; i < n; i++) {
+      perOpcode[opcodes[i]]++;
+      perResult[results[i]]++;
+    }
+    size_t b = Histogram::bucket(ns);
+    for (int o = 0; o < OPCODES; o++)
+      if (perOpcode[o] != 0)
+        add(h.opcodes[o], s, b, perOpcode[o], perOpcode[o] * ns);
+    for (int r = 0; r < RESULTS; r++)
+      if (perResult[r] != 0)
+        add(h.results[r], s, b, perResult[r], perResult[r] * ns);
+    if (queued == nullptr) return;
+    for (int i = 0; i < n; i++)
+      if (queued[i] != 0)
+        add(h.queueing, s, Histogram::bucket(queued[i]), 1, queued[i]);
+    add(h.service, s, b, n, n * ns);
+  }
+
+  /// @brief Counts traffic.
+  /// @param requests Requests received.
+  /// @param in Bytes received.
+  /// @param out Bytes sent.
+  /// @param drops Requests not replied to.
+  void count(Protocol p, uint64_t requests, uint64_t in, uint64_t out,
+             uint64_t drops) {
+    add(_c->requests[p], requests);
+    add(_c->bytesIn[p], in);
+    add(_c->bytesOut[p], out);
+    if (drops) add(_c->drops[p], drops);
+  }
+
+  /// @brief Counts a request repeating its player's last one, as
+  /// retransmissions do.
+  /// @param executed Whether it was executed again, changing the session.
+  void repeat(bool executed) {
+    add(_c->repeated, 1);
+    if (executed) add(_c->reexecuted, 1);
+  }
+
+  /// @brief Renders the metrics as a table, latencies in microseconds.
+  std::string toString() const {
+    std::stringstream str;
+    str << "           requests    bytes in   bytes out   drops\n";
+    for (int p = 0; p < PROTOCOLS; p++)
+      str << std::left << std::setw(6) << PROTOCOL_NAMES[p] << std::right
+          << std::setw(13) << _c->requests[p].load() << std::setw(12)
+          << _c->bytesIn[p].load() << std::setw(12) << _c->bytesOut[p].load()
+          << std::setw(8) << _c->drops[p].load() << "\n";
+    str << "repeated " << _c->repeated.load() << ", executed again "
+        << _c->reexecuted.load() << "\n";
+    std::unique_ptr<Shard> m = merged();
+    str << "\nLatency (us)  count       p50       p99      p999\n";
+    auto row = [&str](const char *name, const Histogram &h) {
+      str << std::left << std::setw(8) << name << std::right << std::setw(11)
+          << h.count() << std::fixed << std::setprecision(1);
+      for (double q : {0.5, 0.99, 0.999})
+        str << std::setw(10) << h.percentile(q) / 1000.0;
+      str << "\n";
+    };
+    for (int o = 0; o < OPCODES; o++) row(OPCODE_NAMES[o], m->opcodes[o]);
+    for (int r = 0; r < RESULTS; r++) row(RESULT_NAMES[r], m->results[r]);
+    str << "\nUDP (us)      count       p50       p99      p999\n";
+    row("queue", m->queueing);
+    row("service", m->service);
+    return str.str();
+  }
+
+  /// @brief Renders the metrics in the Prometheus text exposition format.
+  std::string toPrometheus() const {
+    std::stringstream str;
+    const char *counters[] = {"gs_requests_total", "gs_received_bytes_total",
+                              "gs_sent_bytes_total", "gs_dropped_total"};
+    const std::atomic<uint64_t> *values[] = {_c->requests, _c->bytesIn,
+                                             _c->bytesOut, _c->drops};
+    for (int i = 0; i < 4; i++) {
+      str << "# TYPE " << counters[i] << " counter\n";
+      for (int p = 0; p < PROTOCOLS; p++)
+        str << counters[i] << "{protocol=\"" << PROTOCOL_NAMES[p] << "\"} "
+            << values[i][p].load() << "\n";
+    }
+    str << "# TYPE gs_repeated_total counter\n"
+        << "gs_repeated_total{executed=\"false\"} "
+        << _c->repeated.load() - _c->reexecuted.load() << "\n"
+        << "gs_repeated_total{executed=\"true\"} " << _c->reexecuted.load()
+        << "\n";
+    auto summary = [&str](const char *metric, const char *label,
+                          const char *name, const Histogram &h) {
+      for (double q : {0.5, 0.99, 0.999})
+        str << metric << "{" << label << "=\"" << name << "\",quantile=\""
+            << q << "\"} " << h.percentile(q) / 1e9 << "\n";
+      str << metric << "_sum{" << label << "=\"" << name << "\"} "
+          << h.sum() / 1e9 << "\n"
+          << metric << "_count{" << label << "=\"" << name << "\"} "
+          << h.count() << "\n";
+    };
+    std::unique_ptr<Shard> m = merged();
+    str << "# TYPE gs_opcode_latency_seconds summary\n";
+    for (int o = 0; o < OPCODES; o++)
+      summary("gs_opcode_latency_seconds", "opcode", OPCODE_NAMES[o],
+              m->opcodes[o]);
+    str << "# TYPE gs_result_latency_seconds summary\n";
+    for (int r = 0; r < RESULTS; r++)
+      summary("gs_result_latency_seconds", "result", RESULT_NAMES[r],
+              m->results[r]);
+    str << "# TYPE gs_udp_time_seconds summary\n";
+    summary("gs_udp_time_seconds", "stage", "queue", m->queueing);
+    summary("gs_udp_time_seconds", "stage", "service", m->service);
+    return str.str();
+  }
+
+  ~Metrics() { munmap(_c, sizeof(Counters)); }
+};
+
+#endif  // METRICS_HPP_
@@ -0,0 +1,76 @@
+#ifndef PLAYERSTATS_HPP_
+#define PLAYERSTATS_HPP_
+
+#include <stdio.h>
+
+#include <cstdint>
+#include <string>
+
+#include "server/GameSession.hpp"
+
+/// @brief Totals of the finished games of a player, in 32 bytes.
+/// Updated in O(1) as each game ends, so they never need the history.
+struct PlayerStats {
+  uint32_t wins;
+  uint32_t losses;
+  uint32_t timeouts;
+  uint32_t quits;
+  /// @brief Trials made in all games and in won games.
+  uint32_t trials;
+  uint32_t winTrials;
+  /// @brief Epoch time the last game ended.
+  uint32_t lastPlayed;
+  uint16_t bestScore;
+  /// @brief Duration in seconds of the fastest win.
+  uint16_t fastestWin;
+
+  /// @brief Counts a finished game.
+  /// @param s Session of the game, its result must be final.
+  /// @param end Epoch time the game ended.
+  void add(const GameSession &s, time_t end) {
+    uint32_t made = s.nT() - 1;
+    trials += made;
+    lastPlayed = end;
+    switch (s.result()) {
+      case GameSession::WIN:
+        if (wins == 0 || s.duration() < fastestWin) fastestWin = s.duration();
+        if (s.score() > bestScore) bestScore = s.score();
+        wins++;
+        winTrials += made;
+        break;
+      case GameSession::LOSS:
+        losses++;
+        break;
+      case GameSession::TIMEOUT:
+        timeouts++;
+        break;
+      default:
+        quits++;
+        break;
+    }
+  }
+
+  uint32_t games() const { return wins + losses + timeouts + quits; }
+
+  /// @brief Renders the statistics of a player.
+  std::string toString(int plid) const {
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+             "Statistics of player %06d\n\n"
+             "Games played:          %u\n"
+             "Wins:                  %u\n"
+             "Losses:                %u\n"
+             "Timeouts:              %u\n"
+             "Quits:                 %u\n"
+             "Best score:            %u\n"
+             "Fastest win:           %us\n"
+             "Average trials:        %.2f\n"
+             "Average trials to win: %.2f\n",
+             plid, games(), wins, losses, timeouts, quits, bestScore,
+             fastestWin, games() ? (double)trials / games() : 0.0,
+             wins ? (double)winTrials / wins : 0.0);
+    return buf;
+  }
+};
+
+#endif  // PLAYERSTATS_HPP_
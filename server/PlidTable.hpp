@@ -0,0 +1,104 @@
+#ifndef PLIDTABLE_HPP_
+#define PLIDTABLE_HPP_
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <type_traits>
+
+#include "common/utils.hpp"
+
+/// @brief Fixed-size records indexed directly by PLID.
+/// The table is one anonymous mapping, only pages holding records are ever
+/// backed by memory. An all-zero record is an empty slot. Since the table
+/// is a flat image with no pointers, it can be written to and mapped back
+/// from a file as is.
+///
+/// A shared table lives in a memfd segment instead, so forked processes see
+/// every later change rather than a copy-on-write snapshot.
+template <typename T>
+class PlidTable {
+ public:
+  /// @brief Number of slots, one for each possible PLID.
+  static const int SIZE = 1000000;
+  /// @brief Granularity in which the table is mapped.
+  static const size_t PAGE_SIZE = 4096;
+  /// @brief Size of the table image, rounded up to whole pages.
+  static const size_t BYTES =
+      (SIZE * sizeof(T) + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+
+ private:
+  static_assert(std::is_trivially_copyable_v<T>,
+                "Records are copied as raw bytes");
+  static_assert(PAGE_SIZE % sizeof(T) == 0,
+                "Records must not straddle pages");
+
+  T *_table;
+  bool _shared;
+
+  // Delete copy constructor to prevent accidental copies
+  PlidTable(const PlidTable &) = delete;
+  PlidTable &operator=(const PlidTable &) = delete;
+
+ public:
+  /// @param shared Whether forked processes share the table.
+  PlidTable(bool shared = false) : _shared(shared) {
+    int fd = -1;
+    if (shared && ((fd = memfd_create("plid-table", 0)) == -1 ||
+                   ftruncate(fd, BYTES) == -1))
+      ERROR("Failed to create shared PLID table: %s\n", strerror(errno));
+    void *p = mmap(nullptr, BYTES, PROT_READ | PROT_WRITE,
+                   (shared ? MAP_SHARED : MAP_PRIVATE | MAP_ANONYMOUS) |
+                       MAP_NORESERVE,
+                   fd, 0);
+    if (p == MAP_FAILED)
+      ERROR("Failed to allocate PLID table: %s\n", strerror(errno));
+    if (fd != -1) close(fd);
+    _table = (T *)p;
+  }
+
+  T &operator[](int plid) { return _table[plid]; }
+
+  /// @return Raw table image.
+  const char *data() const { return (const char *)_table; }
+
+  /// @return Whether forked processes share the table.
+  bool shared() const { return _shared; }
+
+  /// @brief Replaces the table with a private copy-on-write mapping of a
+  /// file image. Pages are only read from the file when first touched.
+  /// A shared table is read from the file instead.
+  /// @param fd File holding the image.
+  /// @param offset Page-aligned offset of the image in the file.
+  /// @return Whether the file was mapped.
+  bool map(int fd, off_t offset) {
+    if (_shared) {
+      // Empty pages are skipped so they take no memory.
+      static const char zeros[PAGE_SIZE] = {};
+      char page[PAGE_SIZE];
+      for (size_t off = 0; off < BYTES; off += PAGE_SIZE) {
+        if (pread(fd, page, PAGE_SIZE, offset + off) != PAGE_SIZE) {
+          WARN("Failed to read PLID table: %s\n", strerror(errno));
+          return false;
+        }
+        if (memcmp(page, zeros, PAGE_SIZE) != 0)
+          memcpy((char *)_table + off, page, PAGE_SIZE);
+      }
+      return true;
+    }
+    void *p = mmap(_table, BYTES, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_FIXED, fd, offset);
+    if (p == MAP_FAILED) {
+      WARN("Failed to map PLID table: %s\n", strerror(errno));
+      return false;
+    }
+    return true;
+  }
+
+  ~PlidTable() { munmap(_table, BYTES); }
+};
+
+#endif  // PLIDTABLE_HPP_
@@ -0,0 +1,37 @@
+#ifndef PROBES_HPP_
+#define PROBES_HPP_
+
+/// @brief USDT probes of provider "gs", see tools/gs-latency.bt.
+/// Each probe is a single nop until a tracer (bpftrace, perf, systemtap)
+/// attaches to it, and its location and arguments are described in the
+/// .note.stapsdt section, so a running GS can be traced without rebuilding
+/// it. Probes carry the PLID, opcode and result, as C strings, plus an
+/// optional number:
+///
+///   request__receive(plid, opcode, protocol)
+///   request__send(plid, opcode, result, latency_ns)
+///   parse__ok(plid, opcode, protocol), parse__fail(plid, opcode, protocol)
+///   game__start(plid, opcode, "PLAYING", max_time)
+///   game__end(plid, opcode, result, duration)
+///   scoreboard__insert(plid, opcode, result, score)
+///
+/// Without <sys/sdt.h> (systemtap-sdt-dev) or with GS_NO_PROBES defined,
+/// probes compile to nothing.
+#if __has_include(<sys/sdt.h>) && !defined(GS_NO_PROBES)
+#include <sys/sdt.h>
+#define GS_PROBE3(name, a1, a2, a3) STAP_PROBE3(gs, name, a1, a2, a3)
+#define GS_PROBE4(name, a1, a2, a3, a4) STAP_PROBE4(gs, name, a1, a2, a3, a4)
+#else
+// Arguments are only named, never evaluated.
+#define GS_PROBE3(name, a1, a2, a3)                    \
+  do {                                                 \
+    (void)sizeof(a1), (void)sizeof(a2), (void)sizeof(a3); \
+  } while (0)
+#define GS_PROBE4(name, a1, a2, a3, a4)                   \
+  do {                                                    \
+    (void)sizeof(a1), (void)sizeof(a2), (void)sizeof(a3), \
+        (void)sizeof(a4);                                 \
+  } while (0)
+#endif
+
+#endif  // PROBES_HPP_
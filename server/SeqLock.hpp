@@ -0,0 +1,84 @@
+#ifndef SEQLOCK_HPP_
+#define SEQLOCK_HPP_
+
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "common/utils.hpp"
+
+/// @brief Sequence locks shared with forked processes, one per stripe of a
+/// table. A single writer makes the sequence of a stripe odd while changing
+/// it, readers copy what they need and retry if the sequence moved.
+/// Readers never block the writer. The writer is the process that made the
+/// locks: if it dies in the middle of a change, readers stop waiting for it
+/// and read the stripe as it was left.
+class SeqLock {
+ private:
+  static_assert(std::atomic<uint32_t>::is_always_lock_free,
+                "Shared atomics must be lock free");
+
+  /// @brief Spins of a reader on a stripe being written before it yields
+  /// and checks that the writer is still alive.
+  static const uint32_t SPIN_LIMIT = 1 << 14;
+
+  std::atomic<uint32_t> *_seq;
+  size_t _stripes;
+  pid_t _writer;
+
+  // Delete copy constructor to prevent accidental copies
+  SeqLock(const SeqLock &) = delete;
+  SeqLock &operator=(const SeqLock &) = delete;
+
+ public:
+  /// @param stripes Number of independent locks.
+  SeqLock(size_t stripes) : _stripes(stripes), _writer(getpid()) {
+    void *p = mmap(nullptr, stripes * sizeof(*_seq), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+      ERROR("Failed to allocate sequence locks: %s\n", strerror(errno));
+    _seq = (std::atomic<uint32_t> *)p;
+  }
+
+  void writeBegin(size_t stripe) {
+    _seq[stripe].store(_seq[stripe].load(std::memory_order_relaxed) + 1,
+                       std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  void writeEnd(size_t stripe) {
+    _seq[stripe].fetch_add(1, std::memory_order_release);
+  }
+
+  /// @return Sequence to be checked by readRetry(), waits out writers.
+  uint32_t readBegin(size_t stripe) const {
+    uint32_t seq;
+    for (uint32_t spins = 0;
+         (seq = _seq[stripe].load(std::memory_order_acquire)) & 1; spins++) {
+      if (spins < SPIN_LIMIT) continue;
+      // The sequence of a dead writer never moves again, nor does the stripe.
+      if (getpid() != _writer && kill(_writer, 0) == -1 && errno == ESRCH)
+        return seq;
+      sched_yield();
+      spins = 0;
+    }
+    return seq;
+  }
+
+  /// @return Whether what was read since readBegin() may be torn.
+  bool readRetry(size_t stripe, uint32_t seq) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return _seq[stripe].load(std::memory_order_relaxed) != seq;
+  }
+
+  ~SeqLock() { munmap(_seq, _stripes * sizeof(*_seq)); }
+};
+
+#endif  // SEQLOCK_HPP_
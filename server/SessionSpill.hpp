@@ -0,0 +1,197 @@
+#ifndef SESSIONSPILL_HPP_
+#define SESSIONSPILL_HPP_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "common/utils.hpp"
+#include "server/SessionTable.hpp"
+
+/// @brief Memory budget of a session table.
+/// The table is backed one page (128 sessions) at a time, so pages are the
+/// unit of eviction. Once more pages are in use than the budget allows, the
+/// CLOCK hand looks for a page not referenced since its last pass and with
+/// no game in progress, copies it to the spill file and releases it. An
+/// evicted page is read back the next time one of its sessions is touched.
+///
+/// The spill file is a sparse image of the table: an evicted page lives at
+/// its own offset, so only evicted pages take disk space.
+///
+/// Pages of the sessions a request holds references to are pinned for as
+/// long as it does, so touching another session never evicts them.
+class SessionSpill {
+ public:
+  static const size_t PAGES = SessionTable::BYTES / SessionTable::PAGE_SIZE;
+  static const size_t PAGE_SESSIONS =
+      SessionTable::PAGE_SIZE / sizeof(GameSession);
+
+ private:
+  enum PageState : uint8_t {
+    // Never touched, takes no memory.
+    UNUSED,
+    // Backed by memory.
+    RESIDENT,
+    // Backed by memory and touched since the hand last passed.
+    REFERENCED,
+    // Contents are in the spill file.
+    EVICTED,
+  };
+
+  SessionTable &_table;
+  int _fd;
+  /// @brief Only the process that opened the spill file may write to it.
+  pid_t _owner;
+  size_t _maxPages;
+  std::vector<PageState> _pages;
+  /// @brief Pins of each page, pinned pages are never evicted.
+  std::vector<uint16_t> _pins;
+  size_t _resident = 0;
+  size_t _hand = 0;
+  uint64_t _evictions = 0;
+  uint64_t _faults = 0;
+  /// @brief Whether the budget could not be met, warned once.
+  bool _stuck = false;
+
+  // Delete copy constructor to prevent accidental copies
+  SessionSpill(const SessionSpill &) = delete;
+  SessionSpill &operator=(const SessionSpill &) = delete;
+
+  char *page(size_t p) {
+    return (char *)&_table[0] + p * SessionTable::PAGE_SIZE;
+  }
+
+  /// @return Whether no session in a page is being played.
+  bool evictable(size_t p) {
+    GameSession *s = (GameSession *)page(p);
+    for (size_t i = 0; i < PAGE_SESSIONS; i++)
+      if (s[i].result() == GameSession::PLAYING) return false;
+    return true;
+  }
+
+  /// @brief Reads an evicted page back into the table.
+  void faultIn(size_t p) {
+    if (pread(_fd, page(p), SessionTable::PAGE_SIZE,
+              p * SessionTable::PAGE_SIZE) != SessionTable::PAGE_SIZE)
+      ERROR("Failed to read spilled sessions: %s\n", strerror(errno));
+    _faults++;
+  }
+
+  /// @brief Evicts pages until the budget is met.
+  /// @param keep Page that was just touched.
+  void evict(size_t keep) {
+    // Two turns of the hand clear every reference bit on the way.
+    for (size_t scanned = 0; _resident > _maxPages && scanned < 2 * PAGES;
+         scanned++, _hand = (_hand + 1) % PAGES) {
+      PageState &state = _pages[_hand];
+      if (state == REFERENCED) {
+        state = RESIDENT;
+        continue;
+      }
+      if (state != RESIDENT || _hand == keep || _pins[_hand] > 0 ||
+          !evictable(_hand))
+        continue;
+      if (pwrite(_fd, page(_hand), SessionTable::PAGE_SIZE,
+                 _hand * SessionTable::PAGE_SIZE) != SessionTable::PAGE_SIZE) {
+        WARN("Failed to spill sessions: %s\n", strerror(errno));
+        return;
+      }
+      madvise(page(_hand), SessionTable::PAGE_SIZE, MADV_DONTNEED);
+      state = EVICTED;
+      _resident--;
+      _evictions++;
+    }
+    if (_resident > _maxPages && !_stuck)
+      WARN("Session memory budget exceeded, every page has games in "
+           "progress.\n");
+    _stuck = _resident > _maxPages;
+  }
+
+ public:
+  /// @brief Opens the spill file, discarding what it held. Will exit(1) if
+  /// unsuccessful.
+  /// @param table Table to be kept within budget.
+  /// @param path Spill file path.
+  /// @param maxBytes Memory budget of the table.
+  SessionSpill(SessionTable &table, const char *path, size_t maxBytes)
+      : _table(table),
+        _owner(getpid()),
+        _maxPages(std::max<size_t>(maxBytes / SessionTable::PAGE_SIZE, 1)),
+        _pages(PAGES, UNUSED),
+        _pins(PAGES, 0) {
+    _fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (_fd == -1)
+      ERROR("Failed to open spill file %s: %s\n", path, strerror(errno));
+  }
+
+  /// @brief Must be called before a session is accessed. Brings its page
+  /// back if evicted and evicts others if over budget.
+  /// @param plid Player ID associated with the session.
+  void touch(int plid) {
+    size_t p = plid * sizeof(GameSession) / SessionTable::PAGE_SIZE;
+    PageState &state = _pages[p];
+    if (state == REFERENCED) return;
+    if (state == EVICTED) faultIn(p);
+    if (state == UNUSED || state == EVICTED) _resident++;
+    state = REFERENCED;
+    // Forked children only read, the spill file belongs to the parent.
+    if (_resident > _maxPages && getpid() == _owner) evict(p);
+  }
+
+  /// @brief Keeps the page of a session in memory until unpinned.
+  /// @param plid Player ID associated with the session.
+  void pin(int plid) {
+    _pins[plid * sizeof(GameSession) / SessionTable::PAGE_SIZE]++;
+  }
+
+  void unpin(int plid) {
+    _pins[plid * sizeof(GameSession) / SessionTable::PAGE_SIZE]--;
+  }
+
+  /// @brief Forgets every page, once the table was replaced by a snapshot
+  /// image: pages are read from the image when first touched, and nothing
+  /// in the spill file is current any more.
+  void restored() {
+    std::fill(_pages.begin(), _pages.end(), UNUSED);
+    _resident = 0;
+    _hand = 0;
+    _stuck = false;
+    if (ftruncate(_fd, 0) == -1)
+      WARN("Failed to clear spill file: %s\n", strerror(errno));
+  }
+
+  /// @brief Reads a page as it would be if resident. Used by snapshots,
+  /// possibly from a forked child.
+  /// @param p Page index.
+  /// @param buf Where evicted pages are read to.
+  /// @return Page contents, nullptr if unreadable.
+  const char *read(size_t p, char *buf) {
+    if (_pages[p] != EVICTED) return page(p);
+    return pread(_fd, buf, SessionTable::PAGE_SIZE,
+                 p * SessionTable::PAGE_SIZE) == SessionTable::PAGE_SIZE
+               ? buf
+               : nullptr;
+  }
+
+  /// @return Pages backed by memory.
+  size_t residentPages() const { return _resident; }
+
+  /// @return Pages allowed in memory.
+  size_t maxPages() const { return _maxPages; }
+
+  /// @return Pages evicted so far.
+  uint64_t evictions() const { return _evictions; }
+
+  /// @return Pages read back so far.
+  uint64_t faults() const { return _faults; }
+
+  ~SessionSpill() { close(_fd); }
+};
+
+#endif  // SESSIONSPILL_HPP_
@@ -0,0 +1,10 @@
+#ifndef SESSIONTABLE_HPP_
+#define SESSIONTABLE_HPP_
+
+#include "server/GameSession.hpp"
+#include "server/PlidTable.hpp"
+
+/// @brief Game sessions indexed directly by PLID.
+using SessionTable = PlidTable<GameSession>;
+
+#endif  // SESSIONTABLE_HPP_
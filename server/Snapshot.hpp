@@ -0,0 +1,298 @@
+#ifndef SNAPSHOT_HPP_
+#define SNAPSHOT_HPP_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common/utils.hpp"
+#include "server/GameStorage.hpp"
+#include "server/SessionTable.hpp"
+#include "server/WriteAheadLog.hpp"
+
+/// @brief Periodic background snapshots of GameStorage.
+/// A forked child streams the session table and scoreboard to a file while
+/// the parent keeps serving. The child sees the storage as it was at the
+/// fork, copy-on-write, except for a shared session table: that one it reads
+/// live, each session under its sequence lock, so the image may also hold
+/// changes made after the fork. Those changes are in the log after the
+/// snapshot's position, and replaying them again is harmless. The file
+/// holds the table image page-aligned, so a restart maps it instead of
+/// parsing it.
+///
+/// File layout: header page, session table image and player statistics
+/// image (both sparse, empty pages are holes), scoreboard tree nodes, PLIDs
+/// of the games being played. The last let a restart settle those games
+/// without reading the whole table.
+class Snapshot {
+ private:
+  struct Header {
+    char magic[4];
+    uint32_t sessionSize;
+    uint32_t statsSize;
+    uint64_t tableBytes;
+    /// @brief Position of the first log record not covered.
+    uint64_t walPosition;
+    uint64_t sessionCount;
+    /// @brief Epoch time the snapshot was taken.
+    int64_t time;
+    uint64_t scoreboardSize;
+    uint32_t scoreboardRoot;
+    uint32_t nodeSize;
+    uint64_t playingCount;
+    /// @brief Number of the snapshot, written once the rest is on disk, so
+    /// the file left by an earlier or failed snapshot is never taken for it.
+    uint64_t generation;
+  };
+  static constexpr char MAGIC[4] = {'G', 'S', 'S', 'N'};
+
+  /// @brief Microseconds between checks on a running snapshot.
+  static const long POLL_INTERVAL = 100000;
+
+  /// @brief Offset of the table image, must be page-aligned to be mapped.
+  static const off_t TABLE_OFFSET = SessionTable::PAGE_SIZE;
+  static const off_t STATS_OFFSET = TABLE_OFFSET + SessionTable::BYTES;
+  static const off_t NODES_OFFSET = STATS_OFFSET + StatsTable::BYTES;
+
+  const char *_path;
+  /// @brief Seconds between snapshots.
+  int _interval;
+  /// @brief Epoch time of the last snapshot.
+  time_t _last;
+  /// @brief Child writing the current snapshot, -1 if none.
+  pid_t _child = -1;
+  /// @brief Log position covered by the current snapshot.
+  uint64_t _walPosition = 0;
+  /// @brief Storage changes covered by the last snapshot.
+  uint64_t _changes = 0;
+  /// @brief Generation of the current snapshot. Starts from the time, so
+  /// numbers are not reused across restarts.
+  uint64_t _generation;
+
+  // Delete copy constructor to prevent accidental copies
+  Snapshot(const Snapshot &) = delete;
+  Snapshot &operator=(const Snapshot &) = delete;
+
+  /// @brief Writes a table image, only pages holding records are written,
+  /// the rest stay holes.
+  /// @param readPage Called as readPage(page, buf), returns the contents of
+  /// a page, possibly copied to buf, or nullptr if it can not be read.
+  template <typename F>
+  static bool writeImage(int fd, size_t bytes, off_t offset, F &&readPage) {
+    static const char zeros[SessionTable::PAGE_SIZE] = {};
+    static char buf[SessionTable::PAGE_SIZE];
+    for (size_t off = 0; off < bytes; off += SessionTable::PAGE_SIZE) {
+      const char *page = readPage(off / SessionTable::PAGE_SIZE, buf);
+      if (page == nullptr) return false;
+      if (memcmp(page, zeros, SessionTable::PAGE_SIZE) == 0) continue;
+      if (pwrite(fd, page, SessionTable::PAGE_SIZE, offset + off) !=
+          SessionTable::PAGE_SIZE)
+        return false;
+    }
+    return true;
+  }
+
+  /// @brief Writes a snapshot, runs in the forked child.
+  /// @return Whether the snapshot was written.
+  bool write(GameStorage &store, uint64_t walPosition, uint64_t generation) {
+    std::string tmpPath = std::string(_path) + ".tmp";
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) return false;
+
+    const auto &nodes = store.scoreboard().nodes();
+    Header header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.sessionSize = sizeof(GameSession);
+    header.statsSize = sizeof(PlayerStats);
+    header.tableBytes = SessionTable::BYTES;
+    header.walPosition = walPosition;
+    header.sessionCount = store.sessionCount();
+    header.time = _last;
+    header.scoreboardSize = nodes.size();
+    header.scoreboardRoot = store.scoreboard().root();
+    header.nodeSize = sizeof(Leaderboard::Node);
+    header.generation = 0;
+
+    std::vector<int32_t> playing;
+    bool ok =
+        writeImage(fd, SessionTable::BYTES, TABLE_OFFSET,
+                   [&store, &playing](size_t p, char *buf) {
+                     const char *page = store.readSessionPage(p, buf);
+                     if (page == nullptr) return page;
+                     const GameSession *s = (const GameSession *)page;
+                     for (size_t i = 0; i < SessionSpill::PAGE_SESSIONS; i++)
+                       if (s[i].result() == GameSession::PLAYING)
+                         playing.push_back(p * SessionSpill::PAGE_SESSIONS + i);
+                     return page;
+                   }) &&
+         writeImage(fd, StatsTable::BYTES, STATS_OFFSET,
+                    [&store](size_t p, char *) {
+                      return store.stats().data() + p * StatsTable::PAGE_SIZE;
+                    });
+
+    size_t len = nodes.size() * sizeof(Leaderboard::Node);
+    size_t playingLen = playing.size() * sizeof(int32_t);
+    header.playingCount = playing.size();
+    ok = ok && ftruncate(fd, NODES_OFFSET + len + playingLen) != -1 &&
+         pwrite(fd, nodes.data(), len, NODES_OFFSET) == (ssize_t)len &&
+         pwrite(fd, playing.data(), playingLen, NODES_OFFSET + len) ==
+             (ssize_t)playingLen &&
+         pwrite(fd, &header, sizeof(header), 0) == sizeof(header) &&
+         fsync(fd) != -1;
+    header.generation = generation;
+    ok = ok &&
+         pwrite(fd, &header.generation, sizeof(header.generation),
+                offsetof(Header, generation)) == sizeof(header.generation) &&
+         fsync(fd) != -1;
+    close(fd);
+    if (!ok || rename(tmpPath.c_str(), _path) == -1) {
+      unlink(tmpPath.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  /// @brief Reads the header of the snapshot file.
+  bool readHeader(int fd, Header &header) {
+    return pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+           memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 &&
+           header.sessionSize == sizeof(GameSession) &&
+           header.statsSize == sizeof(PlayerStats) &&
+           header.tableBytes == SessionTable::BYTES &&
+           header.nodeSize == sizeof(Leaderboard::Node);
+  }
+
+ public:
+  /// @param path Snapshot file path.
+  /// @param interval Seconds between snapshots.
+  Snapshot(const char *path, int interval)
+      : _path(path),
+        _interval(interval),
+        _last(utils_clock.now()),
+        _generation(utils_clock.now() * 1000000ull) {}
+
+  /// @brief Restores a storage from the snapshot file, if there is one.
+  /// The session table is mapped, not read.
+  /// @param store Storage to be restored.
+  /// @param walPosition Where the log position covered is written.
+  /// @return Whether a snapshot was restored.
+  bool load(GameStorage &store, uint64_t &walPosition) {
+    int fd = open(_path, O_RDONLY);
+    if (fd == -1) {
+      if (errno != ENOENT)
+        WARN("Failed to open snapshot %s: %s\n", _path, strerror(errno));
+      return false;
+    }
+    Header header;
+    if (!readHeader(fd, header)) {
+      WARN("File %s is not a compatible snapshot, ignoring it.\n", _path);
+      close(fd);
+      return false;
+    }
+
+    std::vector<Leaderboard::Node> nodes(header.scoreboardSize);
+    size_t len = nodes.size() * sizeof(Leaderboard::Node);
+    std::vector<int32_t> playing(header.playingCount);
+    size_t playingLen = playing.size() * sizeof(int32_t);
+    if (pread(fd, nodes.data(), len, NODES_OFFSET) != (ssize_t)len ||
+        pread(fd, playing.data(), playingLen, NODES_OFFSET + len) !=
+            (ssize_t)playingLen ||
+        !store.sessions().map(fd, TABLE_OFFSET) ||
+        !store.stats().map(fd, STATS_OFFSET)) {
+      WARN("Failed to read snapshot %s.\n", _path);
+      close(fd);
+      return false;
+    }
+    close(fd);
+
+    store.scoreboard().restore(std::move(nodes), header.scoreboardRoot);
+    store.restored(header.sessionCount, header.time,
+                   std::vector<int>(playing.begin(), playing.end()));
+    walPosition = _walPosition = header.walPosition;
+    return true;
+  }
+
+  /// @brief Forks a child that writes a snapshot.
+  /// @param store Storage to be saved.
+  /// @param wal Log of the storage, if any. It is committed first, so the
+  /// snapshot covers exactly the records before its current position.
+  void save(GameStorage &store, WriteAheadLog *wal) {
+    if (_child != -1) return;
+    if (wal != nullptr) wal->commit();
+    timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    // No session changes between reading the log position and the fork.
+    GameStorage::Pause pause(store);
+    _walPosition = wal != nullptr ? wal->position() : 0;
+    _changes = store.changes();
+    _last = utils_clock.now();
+    _generation++;
+
+    pid_t pid = fork();
+    if (pid == -1) {
+      WARN("Failed to fork for snapshot: %s\n", strerror(errno));
+      return;
+    }
+    if (pid == 0) {
+      // Child must not run the parent's destructors nor flush its buffers.
+      bool ok = write(store, _walPosition, _generation);
+      if (!ok) WARN("Failed to write snapshot %s: %s\n", _path, strerror(errno));
+      _exit(ok ? 0 : 1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    _child = pid;
+    DEBUG("Snapshot started, parent paused %ld us.\n",
+          (end.tv_sec - start.tv_sec) * 1000000 +
+              (end.tv_nsec - start.tv_nsec) / 1000);
+  }
+
+  /// @brief Starts a snapshot if one is due and finishes the one running,
+  /// compacting the log in the background once it is safely written.
+  void tick(GameStorage &store, WriteAheadLog *wal) {
+    if (_child != -1) {
+      // Children may be reaped automatically, -1 also means it is done, and
+      // only the file tells whether it succeeded.
+      int status;
+      pid_t pid = waitpid(_child, &status, WNOHANG);
+      if (pid == 0) return;
+      _child = -1;
+
+      Header header;
+      int fd = open(_path, O_RDONLY);
+      bool ok = (pid == -1 || (WIFEXITED(status) && WEXITSTATUS(status) == 0)) &&
+                fd != -1 && readHeader(fd, header) &&
+                header.generation == _generation &&
+                header.walPosition == _walPosition;
+      if (fd != -1) close(fd);
+      if (!ok) {
+        WARN("Snapshot %s was not written, will retry.\n", _path);
+        _changes = 0;
+        return;
+      }
+      DEBUG("Snapshot %s written.\n", _path);
+      if (wal != nullptr) wal->compactInBackground(_walPosition);
+    }
+    if (timeout(store) == 0) save(store, wal);
+  }
+
+  /// @return Microseconds until the next snapshot is due or the running one
+  /// should be checked on, -1 if there is nothing new to save.
+  long timeout(GameStorage &store) const {
+    if (_child != -1) return POLL_INTERVAL;
+    if (store.changes() == _changes) return -1;
+    time_t due = _last + _interval;
+    return utils_clock.now() >= due ? 0 : (due - utils_clock.now()) * 1000000;
+  }
+
+  /// @return Whether a snapshot is being written.
+  bool running() const { return _child != -1; }
+};
+
+#endif  // SNAPSHOT_HPP_
@@ -8,17 +8,64 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
 
 #include <common/TCPSocket.hpp>
+#include <server/Capture.hpp>
+#include <server/Cycles.hpp>
+#include <server/Probes.hpp>
 #include <server/TCPServerParser.hpp>
+#include <server/Tracer.hpp>
 
 class TCPServer {
  private:
+  /// @brief Reply of this process the client did not take at once, written
+  /// as its socket drains.
+  struct Output {
+    int fd;
+    /// @brief Rest of the reply.
+    std::string data;
+    size_t sent;
+    /// @brief Monotonic time the client is given up on.
+    uint64_t deadline;
+    Metrics *metrics;
+    Metrics::Opcode opcode;
+    Metrics::Result result;
+    uint64_t accepted;
+    size_t in, out;
+  };
+
   TCPSocket _socket;
+  Capture::Writer *_capture = nullptr;
+  std::vector<uint8_t> _captured;
+  std::vector<Output> _outputs;
+
+  /// @brief Records an answered request.
+  /// @param in Bytes of the request.
+  /// @param out Bytes of the reply.
+  /// @param sent Whether the whole reply was written.
+  static void answered(Metrics &metrics, Metrics::Opcode opcode,
+                       Metrics::Result res, uint64_t accepted, size_t in,
+                       size_t out, bool sent) {
+    uint64_t latency = Metrics::now() - accepted;
+    metrics.record(opcode, res, latency);
+    GS_PROBE4(request__send, 0, Metrics::OPCODE_NAMES[opcode],
+              Metrics::RESULT_NAMES[res], latency);
+    metrics.count(Metrics::TCP, 1, in, sent ? out : 0, !sent);
+  }
 
  public:
   /// @brief Size of TCP listen queue.
   static const int QUEUE_SIZE = 3;
+  /// @brief Size of the request buffer, which replies are written over.
+  static const int MAX_REPLY = 16384;
+  /// @brief Nanoseconds a client gets to take a reply written by this
+  /// process.
+  static const uint64_t WRITE_TIMEOUT = 5000000000ull;
 
   /// @brief Creates an TCP socket bound to provided ip. Will exit(1) if
   /// unsuccessful.
@@ -58,36 +105,177 @@ class TCPServer {
     freeaddrinfo(res);
   }
 
+  /// @brief Ends a forked child once it has answered its request, without
+  /// running any destructor: the writer threads of the capture, archive and
+  /// log are the parent's, and destroying the locks they were waiting on at
+  /// the fork blocks forever.
+  [[noreturn]] static void exitChild() {
+    fflush(stdout);
+    fflush(stderr);
+    _exit(0);
+  }
+
+  /// @brief Captures every request answered by this process and its reply.
+  /// Requests answered by forked children are not captured.
+  void captureTo(Capture::Writer &capture) { _capture = &capture; }
+
+  /// @brief Accepts and answers a request. Requests that already arrived
+  /// whole are answered by this process, so they share its render caches,
+  /// the rest are read and answered by a forked child. This process never
+  /// waits on a client: what it can not write at once is left to flush().
+  /// @return 1 if this is the child process, which must then leave with
+  /// exitChild(), 0 otherwise.
   int processRequest(const TCPServerParser &parser) {
     struct sockaddr_in addr;
     socklen_t addrlen = sizeof(addr);
 
     TCPConnection con = _socket.accept((sockaddr &)addr, addrlen);
+    uint64_t accepted = Metrics::now();
+    uint64_t acceptedWall = _capture ? Capture::now() : 0;
+    Tracer::Scope scope(Tracer::begin());
+    Tracer::Stage stage("tcp request");
 
-    int pid;
-    if ((pid = fork()) == -1) {
+    char buf[MAX_REPLY], ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &(addr.sin_addr), ip, INET_ADDRSTRLEN);
+    int port = ntohs(addr.sin_port);
+
+    uint64_t cycles = Cycles::enabled() ? Cycles::now() : 0;
+    ssize_t n = recv(con.fd(), buf, sizeof(buf) - 1, MSG_DONTWAIT);
+    if (cycles != 0) cycles = Cycles::now() - cycles;
+    if (n < 0) n = 0;
+    buf[n] = '\0';
+    bool whole = n > 0 && buf[n - 1] == '\n';
+
+    int pid = 0;
+    if (!whole && (pid = parser.fork()) == -1) {
       ERROR("Failed to create Fork.\n");
     } else if (pid > 0) {
-      // Parent process
+      // Parent process, the request is the child's to trace.
+      stage.cancel();
       return 0;
+    } else if (!whole) {
+      // The replies left to the parent are not the child's to hold open.
+      for (Output &o : _outputs) close(o.fd);
+      _outputs.clear();
     }
 
-    char buf[2048], ip[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &(addr.sin_addr), ip, INET_ADDRSTRLEN);
-    int port = ntohs(addr.sin_port);
-
     VERBOSE("Received TCP request from %s:%d\n", ip, port);
 
-    con.read(buf, sizeof(buf), '\n');
+    if (!whole) {
+      Tracer::Stage stage("receive");
+      n += std::max(con.read(buf + n, sizeof(buf) - n - 1, '\n'), 0);
+    }
+    Metrics::Opcode opcode = Metrics::opcode(buf);
+    GS_PROBE3(request__receive, 0, Metrics::OPCODE_NAMES[opcode], "tcp");
+    // Only counted when answered by this process, a forked child does not
+    // count cycles.
+    Cycles::request(opcode);
+    Cycles::add(opcode, Cycles::RECV, cycles);
+    Cycles::Scope cyclesScope(opcode);
+    // The reply is written over the request.
+    std::string request;
+    if (_capture && whole) request.assign(buf, n);
 
-    const char *result = parser.executeRequest(buf, sizeof(buf));
+    const char *result;
+    {
+      Tracer::Stage stage("execute");
+      Cycles::Timer timer(Cycles::DISPATCH);
+      result = parser.executeRequest(buf, sizeof(buf));
+    }
 
     DEBUG("Sending back: %s\n", result);
 
-    con.write(result, strlen(result));
+    int len = strlen(result);
+    Metrics::Result res = Metrics::result(result);
+    if (_capture && whole) {
+      Capture::append(_captured, Capture::TCP, acceptedWall, addr,
+                      request.data(), request.size(), result, len);
+      _capture->push(_captured);
+    }
+    if (whole) {
+      ssize_t k;
+      {
+        Tracer::Stage stage("send");
+        Cycles::Timer timer(Cycles::SEND);
+        k = send(con.fd(), result, len, MSG_DONTWAIT);
+      }
+      if (k == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) k = 0;
+      if (k >= 0 && k < len) {
+        _outputs.push_back({.fd = con.release(),
+                            .data = std::string(result + k, len - k),
+                            .sent = 0,
+                            .deadline = Metrics::now() + WRITE_TIMEOUT,
+                            .metrics = &parser.metrics(),
+                            .opcode = opcode,
+                            .result = res,
+                            .accepted = accepted,
+                            .in = (size_t)n,
+                            .out = (size_t)len});
+        return 0;
+      }
+      answered(parser.metrics(), opcode, res, accepted, n, len, k == len);
+      return 0;
+    }
+
+    bool sent;
+    {
+      Tracer::Stage stage("send");
+      sent = con.write(result, len) == len;
+    }
+    answered(parser.metrics(), opcode, res, accepted, n, len, sent);
     return 1;
   }
 
+  /// @brief Adds the clients with a reply left to write to a set.
+  /// @return Highest descriptor added, -1 if none.
+  int watch(fd_set &writable) const {
+    int max = -1;
+    for (const Output &o : _outputs) {
+      FD_SET(o.fd, &writable);
+      max = std::max(max, o.fd);
+    }
+    return max;
+  }
+
+  /// @brief Writes on to the clients that can take more, closing those
+  /// done, gone or too slow.
+  /// @param writable Clients whose sockets can be written to.
+  void flush(const fd_set &writable) {
+    uint64_t now = Metrics::now();
+    for (size_t i = 0; i < _outputs.size();) {
+      Output &o = _outputs[i];
+      bool failed = false;
+      if (FD_ISSET(o.fd, &writable)) {
+        ssize_t k = send(o.fd, o.data.data() + o.sent, o.data.size() - o.sent,
+                         MSG_DONTWAIT);
+        if (k > 0) o.sent += k;
+        failed = k == -1 && errno != EAGAIN && errno != EWOULDBLOCK &&
+                 errno != EINTR;
+      }
+      bool done = o.sent == o.data.size();
+      if (!done && !failed && now < o.deadline) {
+        i++;
+        continue;
+      }
+      if (!done)
+        WARN("Failed to write to TCP Socket: %s\n",
+             failed ? strerror(errno) : "client too slow");
+      answered(*o.metrics, o.opcode, o.result, o.accepted, o.in, o.out, done);
+      close(o.fd);
+      _outputs[i] = std::move(_outputs.back());
+      _outputs.pop_back();
+    }
+  }
+
+  /// @return Microseconds until a client is given up on, -1 if no reply is
+  /// left to write.
+  long timeout() const {
+    if (_outputs.empty()) return -1;
+    uint64_t first = _outputs[0].deadline, now = Metrics::now();
+    for (const Output &o : _outputs) first = std::min(first, o.deadline);
+    return now >= first ? 0 : (first - now) / 1000;
+  }
+
   /// @return Server's TCP socket.
   TCPSocket &socket() { return _socket; }
 };
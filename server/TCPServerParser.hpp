@@ -2,15 +2,55 @@
 #define TCPSERVERPARSER_HPP_
 
 #include <cstring>
+#include <string>
 
+#include "Cycles.hpp"
 #include "GameStorage.hpp"
+#include "Metrics.hpp"
+#include "Probes.hpp"
 
 class TCPServerParser {
  private:
   GameStorage &_gameStore;
+  Metrics &_metrics;
+  /// @brief Reply too large for the request buffer, until the next request.
+  mutable std::string _reply;
+
+  /// @brief Writes a status line giving the size of a body, then the body,
+  /// over the request if they fit in it.
+  /// @return The reply.
+  const char *withBody(char *req, size_t size, const char *status,
+                       const std::string &body) const {
+    int n = snprintf(req, size, "%s %zu\n", status, body.size());
+    if (n + body.size() < size) {
+      memcpy(req + n, body.c_str(), body.size() + 1);
+      return req;
+    }
+    _reply.assign(req, n);
+    _reply += body;
+    return _reply.c_str();
+  }
 
  public:
-  TCPServerParser(GameStorage &sessions) : _gameStore(sessions) {}
+  TCPServerParser(GameStorage &sessions, Metrics &metrics)
+      : _gameStore(sessions), _metrics(metrics) {}
+
+  Metrics &metrics() const { return _metrics; }
+
+  /// @brief Forks a process to answer a request, with the storage paused
+  /// so the child does not inherit it half changed.
+  /// @return As fork().
+  pid_t fork() const {
+    // Output still buffered would be written again by the child.
+    fflush(nullptr);
+    GameStorage::Pause pause(_gameStore);
+    pid_t pid = ::fork();
+    if (pid == 0) {
+      _metrics.forked();
+      Cycles::forked();
+    }
+    return pid;
+  }
 
   const char *executeRequest(char *req, size_t size) const {
     int plid;
@@ -18,18 +58,20 @@ class TCPServerParser {
     if (strncmp(req, "STR", 3) == 0) {
       if (sscanf(req, "STR %06d%c", &plid, &newLine) != 2 || plid < 1 ||
           plid > 999999 || newLine != '\n') {
+        GS_PROBE3(parse__fail, 0, "STR", "tcp");
         return "STR NOK\n";
       }
+      GS_PROBE3(parse__ok, plid, "STR", "tcp");
       VERBOSE_APPEND("\tType: Show Trials\n");
       VERBOSE_APPEND("\tPLID: %06d\n", plid);
-      GameSession &game = _gameStore.getSession(plid);
+      GameSession game = _gameStore.readSession(plid);
       if (!game.exists()) {
         VERBOSE_APPEND("\tResult: Could not find game.\n");
         return "STR NOK\n";
       }
       const char *status = game.inProgress() ? "ACT" : "FIN";
 
-      std::string Fdata = game.showTrials(plid);
+      const std::string &Fdata = _gameStore.getTrialsString(plid, game);
       VERBOSE_APPEND("\tResult: Showing Trials: \n%s\n", Fdata.c_str());
 
       sprintf(req, "RST %s TRIALS_%06d.txt %lu %s\n", status, plid,
@@ -38,23 +80,91 @@ class TCPServerParser {
     }
 
     if (strncmp(req, "SSB", 3) == 0) {
-      std::string Fdata = _gameStore.getScoreboardString();
-      VERBOSE_APPEND("\tType: Show Scoreboard\n");
-      if (Fdata.empty()) {
+      // Cached pages are referenced, not copied.
+      const std::string *Fdata;
+      std::string rank;
+      int page;
+      plid = 0;
+      if (strcmp(req, "SSB\n") == 0) {
+        VERBOSE_APPEND("\tType: Show Scoreboard\n");
+        Fdata = &_gameStore.getCachedScoreboardString();
+      } else if (sscanf(req, "SSB PAGE %d%c", &page, &newLine) == 2 &&
+                 page >= 1 && newLine == '\n') {
+        VERBOSE_APPEND("\tType: Show Scoreboard Page\n");
+        VERBOSE_APPEND("\tPage: %d\n", page);
+        Fdata = &_gameStore.getCachedScoreboardString(
+            (page - 1) * GameStorage::SCOREBOARD_PAGE);
+      } else if (sscanf(req, "SSB RANK %06d%c", &plid, &newLine) == 2 &&
+                 plid >= 1 && plid <= 999999 && newLine == '\n') {
+        VERBOSE_APPEND("\tType: Show Scoreboard Rank\n");
+        VERBOSE_APPEND("\tPLID: %06d\n", plid);
+        rank = _gameStore.getRankString(plid);
+        Fdata = &rank;
+      } else {
+        GS_PROBE3(parse__fail, 0, "SSB", "tcp");
+        VERBOSE_APPEND("\tResult: Couldn't process request: %s", req);
+        return "ERR\n";
+      }
+      GS_PROBE3(parse__ok, plid, "SSB", "tcp");
+      if (Fdata->empty()) {
         VERBOSE_APPEND("\tResult: Scoreboard is empty.\n");
         return "RSS EMPTY\n";
       }
-      const time_t now = time(nullptr);
-      char timeStr[15];
-      strftime(timeStr, sizeof(timeStr), "%Y%m%d%H%M%S", localtime(&now));
+      const char *timeStr = utils_clock.fileString();
 
       VERBOSE_APPEND(
           "\tResult: Showing Scoreboard SCORES%14s.txt (%lu bytes): \n%s\n",
-          timeStr, Fdata.size(), Fdata.c_str());
-      sprintf(req, "RSS OK SCORES%14s.txt %lu %s\n", timeStr, Fdata.size(),
+          timeStr, Fdata->size(), Fdata->c_str());
+      sprintf(req, "RSS OK SCORES%14s.txt %lu %s\n", timeStr, Fdata->size(),
+              Fdata->c_str());
+      return req;
+    }
+    if (strncmp(req, "SPS", 3) == 0) {
+      if (sscanf(req, "SPS %06d%c", &plid, &newLine) != 2 || plid < 1 ||
+          plid > 999999 || newLine != '\n') {
+        GS_PROBE3(parse__fail, 0, "SPS", "tcp");
+        return "RPS NOK\n";
+      }
+      GS_PROBE3(parse__ok, plid, "SPS", "tcp");
+      VERBOSE_APPEND("\tType: Show Player Statistics\n");
+      VERBOSE_APPEND("\tPLID: %06d\n", plid);
+      std::string Fdata = _gameStore.getStatsString(plid);
+      if (Fdata.empty()) {
+        VERBOSE_APPEND("\tResult: Player has no finished games.\n");
+        return "RPS EMPTY\n";
+      }
+      VERBOSE_APPEND("\tResult: Showing Statistics: \n%s\n", Fdata.c_str());
+
+      sprintf(req, "RPS OK STATS_%06d.txt %lu %s\n", plid, Fdata.size(),
               Fdata.c_str());
       return req;
     }
+    if (strcmp(req, "SMS\n") == 0) {
+      GS_PROBE3(parse__ok, 0, "SMS", "tcp");
+      VERBOSE_APPEND("\tType: Show Memory Status\n");
+      std::string Fdata = _gameStore.getMemoryString();
+      VERBOSE_APPEND("\tResult: Showing Memory Status: \n%s\n", Fdata.c_str());
+      sprintf(req, "RMS OK MEMORY_%14s.txt %lu %s\n", utils_clock.fileString(),
+              Fdata.size(), Fdata.c_str());
+      return req;
+    }
+    // STATS and CYCLES are only served over TCP: over UDP, a few spoofed
+    // bytes would get a reply a hundred times larger sent to their victim.
+    if (strcmp(req, "STATS\n") == 0 || strcmp(req, "STATS PROM\n") == 0) {
+      GS_PROBE3(parse__ok, 0, "STATS", "tcp");
+      VERBOSE_APPEND("\tType: Show Metrics\n");
+      std::string Fdata = strcmp(req, "STATS\n") == 0
+                              ? _metrics.toString()
+                              : _metrics.toPrometheus();
+      return withBody(req, size, "RSTATS OK", Fdata);
+    }
+    if (strcmp(req, "CYCLES\n") == 0) {
+      GS_PROBE3(parse__ok, 0, "CYCLES", "tcp");
+      VERBOSE_APPEND("\tType: Show Cycles\n");
+      std::string Fdata = Cycles::toString();
+      return withBody(req, size, "RCYCLES OK", Fdata);
+    }
+    GS_PROBE3(parse__fail, 0, "OTHER", "tcp");
     VERBOSE_APPEND("\tResult: Couldn't process request: %s", req);
     return "ERR\n";
   }
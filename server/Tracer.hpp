@@ -0,0 +1,173 @@
+#ifndef TRACER_HPP_
+#define TRACER_HPP_
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+
+#include "common/utils.hpp"
+#include "server/Metrics.hpp"
+
+/// @brief Sampling tracer of requests.
+/// One request in every N gets an id, and every stage it goes through while
+/// that id is current on its thread is recorded as a span. Spans go to a
+/// ring shared with forked children, overwriting the oldest, and are dumped
+/// as Chrome trace JSON (chrome://tracing, ui.perfetto.dev) on demand.
+///
+/// With sampling off, a span costs a thread-local load and a branch.
+class Tracer {
+ public:
+  /// @brief Spans kept, the oldest are overwritten.
+  static const size_t CAPACITY = 1 << 16;
+
+  /// @brief Time spent in a stage of a request.
+  struct Span {
+    uint64_t request;
+    /// @brief Static string, valid in every process of the server.
+    const char *name;
+    uint64_t begin;
+    uint64_t end;
+    int32_t pid;
+    int32_t tid;
+  };
+
+  /// @brief Makes a request current on this thread while it lives.
+  class Scope {
+   private:
+    uint64_t _previous;
+
+   public:
+    Scope(uint64_t request) : _previous(_current) { _current = request; }
+    ~Scope() { _current = _previous; }
+  };
+
+  /// @brief Records the lifetime of a stage of the current request, if it
+  /// is being traced.
+  class Stage {
+   private:
+    const char *_name;
+    uint64_t _begin = 0;
+
+   public:
+    Stage(const char *name) : _name(name) {
+      if (_current != 0) _begin = Metrics::now();
+    }
+    ~Stage() {
+      if (_current != 0 && _begin != 0)
+        _active->record(_current, _name, _begin, Metrics::now());
+    }
+
+    /// @brief Drops the stage, for a process that hands its request over
+    /// to a forked child, which records the stage instead.
+    void cancel() { _begin = 0; }
+  };
+
+ private:
+  struct Ring {
+    std::atomic<uint64_t> next;
+    std::atomic<uint64_t> requests;
+    Span spans[CAPACITY];
+  };
+
+  /// @brief Tracer that spans are recorded to, if sampling.
+  inline static Tracer *_active = nullptr;
+  /// @brief Request being traced on this thread, 0 if none.
+  inline static thread_local uint64_t _current = 0;
+  /// @brief Requests seen by this thread, for sampling.
+  inline static thread_local uint64_t _seen = 0;
+
+  Ring *_ring = nullptr;
+  /// @brief One request traced every _rate, 0 if none.
+  uint64_t _rate = 0;
+
+  // Delete copy constructor to prevent accidental copies
+  Tracer(const Tracer &) = delete;
+  Tracer &operator=(const Tracer &) = delete;
+
+ public:
+  Tracer() {}
+
+  /// @brief Starts tracing one request in every rate. Will exit(1) if
+  /// unsuccessful.
+  void sample(uint64_t rate) {
+    if (rate == 0 || _ring != nullptr) return;
+    void *p = mmap(nullptr, sizeof(Ring), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+      ERROR("Failed to allocate trace buffer: %s\n", strerror(errno));
+    _ring = (Ring *)p;
+    _rate = rate;
+    _active = this;
+  }
+
+  /// @return Id of a request about to be handled if it is to be traced, 0
+  /// otherwise.
+  static uint64_t begin() {
+    if (_active == nullptr || ++_seen % _active->_rate != 0) return 0;
+    return _active->_ring->requests.fetch_add(1, std::memory_order_relaxed) +
+           1;
+  }
+
+  /// @return Whether any request is traced.
+  static bool enabled() { return _active != nullptr; }
+
+  /// @brief Records a span measured by the caller.
+  /// @param request Id from begin(), nothing is recorded if 0.
+  void record(uint64_t request, const char *name, uint64_t begin,
+              uint64_t end) {
+    if (request == 0) return;
+    uint64_t i = _ring->next.fetch_add(1, std::memory_order_relaxed);
+    Span &s = _ring->spans[i % CAPACITY];
+    s.request = request;
+    s.name = name;
+    s.begin = begin;
+    s.end = end;
+    s.pid = getpid();
+    s.tid = syscall(SYS_gettid);
+  }
+
+  /// @brief Records a span of the active tracer, if any.
+  static void span(uint64_t request, const char *name, uint64_t begin,
+                   uint64_t end) {
+    if (_active != nullptr) _active->record(request, name, begin, end);
+  }
+
+  /// @brief Writes the spans kept as Chrome trace JSON.
+  /// @param path File path.
+  /// @return Number of spans written, -1 if the file could not be written.
+  long dump(const char *path) const {
+    if (_ring == nullptr) return 0;
+    FILE *f = fopen(path, "w");
+    if (f == nullptr) return -1;
+    uint64_t end = _ring->next.load(std::memory_order_relaxed);
+    uint64_t first = end > CAPACITY ? end - CAPACITY : 0;
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (uint64_t i = first; i < end; i++) {
+      const Span &s = _ring->spans[i % CAPACITY];
+      fprintf(f,
+              "%s\n{\"name\":\"%s\",\"cat\":\"request\",\"ph\":\"X\","
+              "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,"
+              "\"args\":{\"request\":%lu}}",
+              i == first ? "" : ",", s.name, s.begin / 1000.0,
+              (s.end - s.begin) / 1000.0, s.pid, s.tid,
+              (unsigned long)s.request);
+    }
+    fprintf(f, "\n]}\n");
+    bool ok = fclose(f) == 0;
+    return ok ? (long)(end - first) : -1;
+  }
+
+  ~Tracer() {
+    if (_ring == nullptr) return;
+    if (_active == this) _active = nullptr;
+    munmap(_ring, sizeof(Ring));
+  }
+};
+
+#endif  // TRACER_HPP_
@@ -1,6 +1,8 @@
 #ifndef TRIAL_HPP_
 #define TRIAL_HPP_
 
+#include <time.h>
+
 #include <cstdint>
 #include <string>
 
@@ -27,6 +29,9 @@ class Trial {
   char bc3() const { return _c3; }
   char bc4() const { return _c4; }
 
+  /// @brief State of the code generator of this thread, 0 until seeded.
+  inline static thread_local uint64_t _random = 0;
+
  public:
   /// @brief Default Constructor creates an invalid trial.
   Trial() {}
@@ -40,13 +45,44 @@ class Trial {
     _nBW = 0;
   }
 
-  /// @brief Generate a random trial using rand().
+  /// @brief Seeds the code generator of the calling thread, so the codes
+  /// it draws from then on are reproducible.
+  static void seed(uint64_t seed) {
+    _random = seed * 0x9E3779B97F4A7C15ull | 1;
+  }
+
+  /// @brief Generate a random trial. Each thread draws from a xorshift
+  /// generator of its own, seeded from the clock unless seed() was called.
   static Trial random() {
+    if (_random == 0) {
+      timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      seed((ts.tv_sec * 1000000000ull + ts.tv_nsec) ^ (uintptr_t)&_random);
+    }
+    _random ^= _random >> 12;
+    _random ^= _random << 25;
+    _random ^= _random >> 27;
+    uint64_t r = _random * 0x2545F4914F6CDD1Dull >> 32;
+    return fromIndex(r * CODES >> 32);
+  }
+
+  /// @brief Number of possible codes.
+  static const uint16_t CODES = 6 * 6 * 6 * 6;
+
+  /// @brief Index of the code between 0 and CODES - 1, CODES if invalid.
+  uint16_t index() const {
+    if (!isValid()) return CODES;
+    return (((_c1 - 1) * 6 + _c2 - 1) * 6 + _c3 - 1) * 6 + _c4 - 1;
+  }
+
+  /// @brief Constructor from code index, an invalid trial if out of range.
+  static Trial fromIndex(uint16_t index) {
     Trial t;
-    t._c1 = (rand() % 6) + 1;
-    t._c2 = (rand() % 6) + 1;
-    t._c3 = (rand() % 6) + 1;
-    t._c4 = (rand() % 6) + 1;
+    if (index >= CODES) return t;
+    t._c4 = index % 6 + 1;
+    t._c3 = index / 6 % 6 + 1;
+    t._c2 = index / 36 % 6 + 1;
+    t._c1 = index / 216 + 1;
     return t;
   }
 
@@ -72,8 +108,8 @@ class Trial {
     uint16_t nW = _nBW & 0b0011;
 
     if (nB == 3 && nW > 1) {
-      nBlack = nW == 3 ? 4 : 0;
-      nWhite = nW == 3 ? 0 : 4;
+      nBlack = nW == 2 ? 4 : 0;
+      nWhite = nW == 2 ? 0 : 4;
     } else {
       nBlack = nB;
       nWhite = nW;
@@ -93,10 +129,10 @@ class Trial {
     }
   }
 
-  /// @brief Calculates nB and nW for the Trial.
+  /// @brief Calculates nB and nW against a code without storing them.
   /// @param code Secret code.
   /// @return True if nB == 4
-  bool evaluateNumbers(const Trial &code, uint16_t &nB, uint16_t &nW) {
+  bool evaluate(const Trial &code, uint16_t &nB, uint16_t &nW) const {
     nB = 0, nW = 0;
 
     char codeCol[4] = {code.bc1(), code.bc2(), code.bc3(), code.bc4()};
@@ -123,9 +159,17 @@ class Trial {
         }
       }
     }
+    return nB == 4;
+  }
+
+  /// @brief Calculates nB and nW for the Trial.
+  /// @param code Secret code.
+  /// @return True if nB == 4
+  bool evaluateNumbers(const Trial &code, uint16_t &nB, uint16_t &nW) {
+    bool victory = evaluate(code, nB, nW);
     DEBUG("nB=%d nW=%d\n", nB, nW);
     setnBW(nB, nW);
-    return nB == 4;
+    return victory;
   }
 
   /// @brief Get the trial in a string format.
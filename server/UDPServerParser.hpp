@@ -1,175 +1,286 @@
 #ifndef UDPSERVERPARSER_HPP_
 #define UDPSERVERPARSER_HPP_
 
+#include <arpa/inet.h>
 #include <string.h>
 
 #include <common/utils.hpp>
+#include <server/Cycles.hpp>
 #include <server/GameStorage.hpp>
+#include <server/Metrics.hpp>
+#include <server/Probes.hpp>
 #include <server/Trial.hpp>
 
 class UDPServerParser {
+ public:
+  /// @brief Request parsed but not yet executed.
+  struct Request {
+    enum Type { START, TRY, QUIT, DEBUG_START, UNKNOWN };
+    Type type = UNKNOWN;
+    /// @brief Whether the request is well formed.
+    bool valid = false;
+    int plid = 0;
+    int maxTime = 0;
+    int nT = 0;
+    char c1, c2, c3, c4;
+    /// @brief Original text, for messages.
+    const char *text;
+  };
+
+  /// @brief Verbose log of an answered request, a plain copy of what is
+  /// needed to describe it later, on the logger thread.
+  struct RequestLog {
+    in_addr addr;
+    uint16_t port;
+    Request::Type type;
+    bool valid;
+    int plid, maxTime, nT;
+    char c1, c2, c3, c4;
+    char text[32];
+    char reply[48];
+
+    RequestLog(const sockaddr_in &from, const Request &r, const char *reply)
+        : addr(from.sin_addr),
+          port(ntohs(from.sin_port)),
+          type(r.type),
+          valid(r.valid),
+          plid(r.plid),
+          maxTime(r.maxTime),
+          nT(r.nT),
+          c1(r.c1),
+          c2(r.c2),
+          c3(r.c3),
+          c4(r.c4) {
+      snprintf(text, sizeof(text), "%s", r.text);
+      snprintf(this->reply, sizeof(this->reply), "%s", reply);
+    }
+
+    void format(std::string &out) const {
+      char ip[INET_ADDRSTRLEN], buf[256];
+      inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+      int n = snprintf(buf, sizeof(buf), "Received UDP request from %s:%d\n",
+                       ip, port);
+      if (!valid) {
+        n += snprintf(buf + n, sizeof(buf) - n,
+                      "\tResult: Couldn't process request: %.*s\n",
+                      (int)strcspn(text, "\n"), text);
+        out.append(buf, n);
+        return;
+      }
+      switch (type) {
+        case Request::START:
+          n += snprintf(buf + n, sizeof(buf) - n,
+                        "\tType: Start New Game\n\tPLID: %06d\n"
+                        "\tMaxTime: %3d\n",
+                        plid, maxTime);
+          break;
+        case Request::TRY:
+          n += snprintf(buf + n, sizeof(buf) - n,
+                        "\tType: Try\n\tPLID: %06d\n\tTrial: %c %c %c %c\n"
+                        "\tnT: %d\n",
+                        plid, c1, c2, c3, c4, nT);
+          break;
+        case Request::QUIT:
+          n += snprintf(buf + n, sizeof(buf) - n, "\tType: Quit\n\tPLID: %06d\n",
+                        plid);
+          break;
+        case Request::DEBUG_START:
+          n += snprintf(buf + n, sizeof(buf) - n,
+                        "\tType: Start New Debug Game\n\tPLID: %06d\n"
+                        "\tMaxTime: %3d\n\tCode: %c %c %c %c\n",
+                        plid, maxTime, c1, c2, c3, c4);
+          break;
+        case Request::UNKNOWN:
+          break;
+      }
+      n += snprintf(buf + n, sizeof(buf) - n, "\tResult: %.*s\n",
+                    (int)strcspn(reply, "\n"), reply);
+      out.append(buf, std::min<size_t>(n, sizeof(buf) - 1));
+    }
+  };
+
  private:
   char _buf[BUFFER_SIZE];
   GameStorage &_gameStore;
+  Metrics &_metrics;
 
  public:
-  UDPServerParser(GameStorage &sessions) : _gameStore(sessions) {
-    srand(time(NULL));
-  }
+  UDPServerParser(GameStorage &sessions, Metrics &metrics)
+      : _gameStore(sessions), _metrics(metrics) {}
 
-  const char *executeRequest(const char *req) {
-    // Start New Game
-    if (strncmp(req, "SNG", 3) == 0) {
-      int plid, maxTime;
-      char newLine;
-      if ((sscanf(req, "SNG %06d %03d%c", &plid, &maxTime, &newLine) != 3) ||
-          (plid < 1 || plid > 999999 || maxTime < 1 || maxTime > 600) ||
-          newLine != '\n') {
-        VERBOSE_APPEND("\tResult: Couldn't process request: %s", req);
-        return "RSG ERR\n";
-      }
-      VERBOSE_APPEND("\tType: Start New Game\n");
-      VERBOSE_APPEND("\tPLID: %06d\n", plid);
-      VERBOSE_APPEND("\tMaxTime: %3d\n", maxTime);
-
-      GameSession &game = _gameStore.getSession(plid);
-      if (game.inProgress() && game.nT() > 1) {
-        // There's already a game in Progress.
-        VERBOSE_APPEND("\tResult: Game already in progress.\n");
-        return "RSG NOK\n";
-      }
+  Metrics &metrics() { return _metrics; }
+
+  const char *executeRequest(const char *req) { return execute(parse(req)); }
 
-      // Start a new game.
-      game = GameSession::newGame(maxTime);
-      _gameStore.newSession(plid, game);
-      char c1 = game.getCode().c1(), c2 = game.getCode().c2(),
-           c3 = game.getCode().c3(), c4 = game.getCode().c4();
-      VERBOSE_APPEND("\tResult: Started New Game with code %c %c %c %c.\n", c1,
-                     c2, c3, c4);
-      return "RSG OK\n";
+  /// @brief Parses a request without touching any session.
+  /// @param req Null-terminated request, must outlive the result.
+  Request parse(const char *req) const {
+    Request r;
+    r.text = req;
+    char newLine;
+    if (strncmp(req, "SNG", 3) == 0) {
+      r.type = Request::START;
+      r.valid = sscanf(req, "SNG %06d %03d%c", &r.plid, &r.maxTime,
+                       &newLine) == 3 &&
+                r.plid >= 1 && r.plid <= 999999 && r.maxTime >= 1 &&
+                r.maxTime <= 600 && newLine == '\n';
+    } else if (strncmp(req, "TRY", 3) == 0) {
+      r.type = Request::TRY;
+      r.valid = sscanf(req, "TRY %06d %c %c %c %c %d%c", &r.plid, &r.c1,
+                       &r.c2, &r.c3, &r.c4, &r.nT, &newLine) == 7 &&
+                r.plid >= 1 && r.plid <= 999999;
+    } else if (strncmp(req, "QUT", 3) == 0) {
+      r.type = Request::QUIT;
+      r.valid = sscanf(req, "QUT %06d%c", &r.plid, &newLine) == 2 &&
+                r.plid >= 1 && r.plid <= 999999 && newLine == '\n';
+    } else if (strncmp(req, "DBG", 3) == 0) {
+      r.type = Request::DEBUG_START;
+      r.valid = sscanf(req, "DBG %06d %03d %c %c %c %c%c", &r.plid,
+                       &r.maxTime, &r.c1, &r.c2, &r.c3, &r.c4,
+                       &newLine) == 7 &&
+                r.plid >= 1 && r.plid <= 999999 && r.maxTime >= 1 &&
+                r.maxTime <= 600 && newLine == '\n' &&
+                Trial(r.c1, r.c2, r.c3, r.c4).isValid();
     }
+    const char *opcode = Metrics::OPCODE_NAMES[Metrics::opcode(req)];
+    if (r.valid) {
+      GS_PROBE3(parse__ok, r.plid, opcode, "udp");
+    } else {
+      GS_PROBE3(parse__fail, r.plid, opcode, "udp");
+    }
+    return r;
+  }
 
-    // Try a guess
-    if (strncmp(req, "TRY", 3) == 0) {
-      int plid, nT, res;
-      char c1, c2, c3, c4, newLine;
-
-      // Check
-      if ((sscanf(req, "TRY %06d %c %c %c %c %d%c", &plid, &c1, &c2, &c3, &c4,
-                  &nT, &newLine) != 7) ||
-          (plid < 1 || plid > 999999)) {
-        VERBOSE_APPEND("\tResult: Couldn't process request: %s", req);
-        return "RTR ERR\n";
-      }
-      VERBOSE_APPEND("\tType: Try\n");
-      VERBOSE_APPEND("\tPLID: %06d\n", plid);
-      VERBOSE_APPEND("\tTrial: %c %c %c %c\n", c1, c2, c3, c4);
-      VERBOSE_APPEND("\tnT: %d\n", nT);
-      GameSession &game = _gameStore.getSession(plid);
-      if (!game.exists()) {
-        // There is no game for this PLID.
-        VERBOSE_APPEND("\tResult: There's currently no game in progress.\n");
-        return "RTR NOK\n";
-      }
+  /// @brief Executes a parsed request.
+  /// @return Reply, valid until the next request is executed.
+  const char *execute(const Request &r) {
+    int plid = r.plid;
+    GameStorage::Writing writing(_gameStore, plid);
+    switch (r.type) {
+      case Request::START: {
+        // Start New Game
+        if (!r.valid) {
+          return "RSG ERR\n";
+        }
 
-      Trial t(c1, c2, c3, c4);
-      uint16_t nB = 0, nW = 0;
-      const Trial &code = game.getCode();
-      res = game.executeTrial(t, nT, nB, nW);
+        GameSession &game = _gameStore.getSession(plid);
+        if (game.inProgress() && game.nT() > 1) {
+          // There's already a game in Progress.
+          return "RSG NOK\n";
+        }
+
+        // A game without trials is started again, with a new code, so a
+        // retransmitted SNG is executed twice.
+        if (game.inProgress()) _metrics.repeat(true);
+
+        // Start a new game.
+        const Trial code =
+            _gameStore.newSession(plid, GameSession::newGame(r.maxTime))
+                .getCode();
+        _gameStore.log(WriteAheadLog::START, plid);
+        DEBUG("Started game of %06d with code %c %c %c %c.\n", plid,
+              code.c1(), code.c2(), code.c3(), code.c4());
+        return "RSG OK\n";
+      }
 
-      switch (res) {
-        case GameSession::TrialResult::ERROR:
-          VERBOSE_APPEND("\tResult: Couldn't process request: %s", req);
+      case Request::TRY: {
+        // Try a guess
+        if (!r.valid) {
           return "RTR ERR\n";
-        case GameSession::TrialResult::QUIT:
-          VERBOSE_APPEND("\tResult: There's currently no game in progress.\n");
+        }
+        int nT = r.nT, res;
+        GameSession &game = _gameStore.getSession(plid);
+        if (!game.exists()) {
+          // There is no game for this PLID.
           return "RTR NOK\n";
-        case GameSession::TrialResult::DUPLICATE:
-          VERBOSE_APPEND(
-              "\tResult: Same attempt was already made this session.\n");
-          return "RTR DUP\n";
-        case GameSession::TrialResult::INVALID:
-          VERBOSE_APPEND("\tResult: Invalid trial number.\n");
-          return "RTR INV\n";
-        case GameSession::TrialResult::TIMEOUT:
-          VERBOSE_APPEND("\tResult: Time Limit Exceeded.\n");
-          sprintf(_buf, "RTR ETM %c %c %c %c\n", code.c1(), code.c2(),
-                  code.c3(), code.c4());
-          return _buf;
-        case GameSession::TrialResult::LOSS:
-          VERBOSE_APPEND("\tResult: Limit of Tries Exceeded.\n");
-          sprintf(_buf, "RTR ENT %c %c %c %c\n", code.c1(), code.c2(),
-                  code.c3(), code.c4());
-          return _buf;
-        case GameSession::TrialResult::WIN:
-          VERBOSE_APPEND("\tResult: Victory!\n");
-          _gameStore.addToScoreboard(plid, game);
-          sprintf(_buf, "RTR OK %d %d %d\n", nT, nB, nW);
-          return _buf;
-        case GameSession::TrialResult::PLAYING:
-          VERBOSE_APPEND("\tResult: nB=%d nW=%d.\n", nB, nW);
-          sprintf(_buf, "RTR OK %d %d %d\n", nT, nB, nW);
-          return _buf;
-      }
-    }
+        }
 
-    // Quit game
-    if (strncmp(req, "QUT", 3) == 0) {
-      int plid;
-      char newLine;
+        Trial t(r.c1, r.c2, r.c3, r.c4);
+        uint16_t nB = 0, nW = 0;
+        const Trial &code = game.getCode();
+        uint16_t prevNT = game.nT();
+        {
+          Tracer::Stage stage("executeTrial");
+          Cycles::Timer timer(Cycles::EVALUATE);
+          res = game.executeTrial(t, nT, nB, nW);
+        }
+        // Retries leave the session untouched.
+        bool changed = game.nT() != prevNT;
+        if (!changed && nT > 0 && nT == prevNT - 1 &&
+            t == game.getTrial(nT))
+          _metrics.repeat(false);
+        if (changed) _gameStore.log(WriteAheadLog::TRY, plid);
+        if (changed && (res == GameSession::WIN || res == GameSession::LOSS))
+          _gameStore.finished(plid);
 
-      if ((sscanf(req, "QUT %06d%c", &plid, &newLine) != 2) ||
-          (plid < 1 || plid > 999999) || newLine != '\n') {
-        VERBOSE_APPEND("\tResult: Couldn't process request: %s", req);
-        return "RQT ERR\n";
+        Cycles::Timer timer(Cycles::FORMAT);
+        switch (res) {
+          case GameSession::TrialResult::ERROR:
+            return "RTR ERR\n";
+          case GameSession::TrialResult::QUIT:
+            return "RTR NOK\n";
+          case GameSession::TrialResult::DUPLICATE:
+            return "RTR DUP\n";
+          case GameSession::TrialResult::INVALID:
+            return "RTR INV\n";
+          case GameSession::TrialResult::TIMEOUT:
+            sprintf(_buf, "RTR ETM %c %c %c %c\n", code.c1(), code.c2(),
+                    code.c3(), code.c4());
+            return _buf;
+          case GameSession::TrialResult::LOSS:
+            sprintf(_buf, "RTR ENT %c %c %c %c\n", code.c1(), code.c2(),
+                    code.c3(), code.c4());
+            return _buf;
+          case GameSession::TrialResult::WIN:
+            if (changed) _gameStore.addToScoreboard(plid, game);
+            sprintf(_buf, "RTR OK %d %d %d\n", nT, nB, nW);
+            return _buf;
+          case GameSession::TrialResult::PLAYING:
+            sprintf(_buf, "RTR OK %d %d %d\n", nT, nB, nW);
+            return _buf;
+        }
+        break;
       }
-      VERBOSE_APPEND("\tType: Quit\n");
-      VERBOSE_APPEND("\tPLID: %06d\n", plid);
-      GameSession &game = _gameStore.getSession(plid);
-      // Attempt to end game
-      if (!game.endGame()) {
-        VERBOSE_APPEND("\tResult: There's currently no game in progress.\n");
-        return "RQT NOK\n";
-      }
-      VERBOSE_APPEND("\tResult: Quit game.\n");
-      const Trial &code = game.getCode();
-      sprintf(_buf, "RQT OK %c %c %c %c\n", code.c1(), code.c2(), code.c3(),
-              code.c4());
-      return _buf;
-    }
 
-    // Start new Game with given secret
-    if (strncmp(req, "DBG", 3) == 0) {
-      int plid, maxTime;
-      char c1, c2, c3, c4, newLine;
-      if ((sscanf(req, "DBG %06d %03d %c %c %c %c%c", &plid, &maxTime, &c1, &c2,
-                  &c3, &c4, &newLine) != 7) ||
-          (plid < 1 || plid > 999999 || maxTime < 1 || maxTime > 600) ||
-          newLine != '\n') {
-        VERBOSE_APPEND("\tResult: Couldn't process request: %s", req);
-        return "RDB ERR\n";
+      case Request::QUIT: {
+        // Quit game
+        if (!r.valid) {
+          return "RQT ERR\n";
+        }
+        GameSession &game = _gameStore.getSession(plid);
+        // Attempt to end game
+        if (!game.endGame()) {
+          return "RQT NOK\n";
+        }
+        _gameStore.log(WriteAheadLog::QUIT, plid);
+        _gameStore.finished(plid);
+        Cycles::Timer timer(Cycles::FORMAT);
+        const Trial &code = game.getCode();
+        sprintf(_buf, "RQT OK %c %c %c %c\n", code.c1(), code.c2(), code.c3(),
+                code.c4());
+        return _buf;
       }
-      Trial code = Trial(c1, c2, c3, c4);
-      if (!code.isValid()) {
-        VERBOSE_APPEND("\tResult: Couldn't process request: %s", req);
-        return "RDB ERR\n";
-      }
-      VERBOSE_APPEND("\tType: Start New Debug Game\n");
-      VERBOSE_APPEND("\tPLID: %06d\n", plid);
-      VERBOSE_APPEND("\tMaxTime: %3d\n", maxTime);
-      VERBOSE_APPEND("\tCode: %c %c %c %c\n", c1, c2, c3, c4);
-      if (_gameStore.getSession(plid).inProgress()) {
-        // There's already a game in Progress.
-        VERBOSE_APPEND("\tResult: Game already in Progress.\n");
-        return "RDB NOK\n";
+
+      case Request::DEBUG_START: {
+        // Start new Game with given secret
+        if (!r.valid) {
+          return "RDB ERR\n";
+        }
+        Trial code = Trial(r.c1, r.c2, r.c3, r.c4);
+        if (_gameStore.getSession(plid).inProgress()) {
+          // There's already a game in Progress.
+          return "RDB NOK\n";
+        }
+        // Start a new game.
+        _gameStore.newSession(plid,
+                              GameSession::newDebugGame(r.maxTime, code));
+        _gameStore.log(WriteAheadLog::DEBUG_START, plid);
+        return "RDB OK\n";
       }
-      // Start a new game.
-      VERBOSE_APPEND("\tResult: Started New Game with code %c %c %c %c.\n", c1,
-                     c2, c3, c4);
-      _gameStore.newSession(plid, GameSession::newDebugGame(maxTime, code));
-      return "RDB OK\n";
+
+      case Request::UNKNOWN:
+        break;
     }
-    VERBOSE_APPEND("\tResult: Couldn't process request: %s", req);
     return "ERR\n";
   }
 };
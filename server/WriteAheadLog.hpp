@@ -0,0 +1,345 @@
+#ifndef WRITEAHEADLOG_HPP_
+#define WRITEAHEADLOG_HPP_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "common/utils.hpp"
+#include "server/GameSession.hpp"
+
+/// @brief Append-only log of every GameStorage state change.
+/// Records are fixed-size and carry the whole session image after the change,
+/// so replaying them is idempotent. Appends are buffered and group-committed:
+/// every record appended within one commit interval shares a single write()
+/// and fdatasync().
+/// Records are numbered by their position since the log was created, which
+/// lets a snapshot name the first record it does not cover and the log drop
+/// every record before it.
+/// Records may be appended from many threads, a commit only holds them back
+/// while it takes the pending batch, not while it writes it.
+class WriteAheadLog {
+ public:
+  /// @brief Request that caused the state change.
+  enum Operation : uint8_t {
+    // SNG
+    START,
+    // DBG
+    DEBUG_START,
+    // TRY
+    TRY,
+    // QUT
+    QUIT,
+    // Game found out of time
+    TIMEOUT
+  };
+
+  /// @brief One state change, 4 + 4 + 8 + sizeof(GameSession) bytes.
+  struct Record {
+    uint32_t plid;
+    Operation op;
+    uint8_t _pad[3];
+    /// @brief Epoch time of the change, sessions only keep relative times.
+    int64_t time;
+    GameSession session;
+  };
+
+ private:
+  static_assert(std::is_trivially_copyable_v<GameSession>,
+                "GameSession is written to disk as raw bytes");
+
+  /// @brief File header, identifies the format and the record layout.
+  struct Header {
+    char magic[4];
+    uint32_t recordSize;
+    /// @brief Position of the first record in the file.
+    uint64_t start;
+  };
+  static constexpr char MAGIC[4] = {'G', 'S', 'W', 'L'};
+
+  /// @brief Pending records that force a commit regardless of the interval.
+  static const size_t MAX_PENDING = 4096;
+
+  const char *_path;
+  int _fd;
+  /// @brief Position of the first record in the file.
+  uint64_t _start = 0;
+  /// @brief Number of records committed to the file.
+  uint64_t _committed = 0;
+  /// @brief Only the process that opened the log may write to it.
+  pid_t _owner;
+  /// @brief Commit interval in nanoseconds.
+  uint64_t _interval;
+  /// @brief Monotonic time at which pending records must be committed.
+  uint64_t _deadline = 0;
+  std::vector<Record> _pending;
+  /// @brief Batch being written by a commit.
+  std::vector<Record> _writing;
+  /// @brief Guards the pending records and the positions.
+  mutable std::mutex _mutex;
+  /// @brief Serializes commits, and the end of compactions.
+  std::mutex _commitMutex;
+  /// @brief Serializes compactions.
+  std::mutex _compactMutex;
+  /// @brief Thread of the last background compaction, if any.
+  std::unique_ptr<std::thread> _compactor;
+  std::atomic<bool> _compacting = false;
+
+  static bool writeHeader(int fd, uint64_t start) {
+    Header header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.recordSize = sizeof(Record);
+    header.start = start;
+    return ::write(fd, &header, sizeof(header)) == sizeof(header) &&
+           fdatasync(fd) != -1;
+  }
+
+  /// @brief Copies committed records to another file.
+  /// @param first Index in this file of the first record copied.
+  /// @param last Index in this file of the record after the last copied.
+  bool copyRecords(int fd, uint64_t first, uint64_t last) {
+    std::vector<Record> chunk(MAX_PENDING);
+    off_t offset = sizeof(Header) + first * sizeof(Record);
+    off_t end = sizeof(Header) + last * sizeof(Record);
+    while (offset < end) {
+      size_t len = std::min<size_t>(chunk.size() * sizeof(Record), end - offset);
+      if (pread(_fd, chunk.data(), len, offset) != (ssize_t)len ||
+          ::write(fd, chunk.data(), len) != (ssize_t)len)
+        return false;
+      offset += len;
+    }
+    return true;
+  }
+
+  // Delete copy constructor to prevent accidental copies
+  WriteAheadLog(const WriteAheadLog &) = delete;
+  WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+ public:
+  /// @brief Opens (or creates) a log. Will exit(1) if unsuccessful.
+  /// @param path Log file path.
+  /// @param interval Commit interval in milliseconds, 0 commits every record.
+  WriteAheadLog(const char *path, int interval)
+      : _path(path), _owner(getpid()), _interval(interval * 1000000ull) {
+    _fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (_fd == -1)
+      ERROR("Failed to open log %s: %s\n", path, strerror(errno));
+
+    Header header;
+    ssize_t n = pread(_fd, &header, sizeof(header), 0);
+    if (n == 0) {
+      if (!writeHeader(_fd, 0))
+        ERROR("Failed to initialize log %s: %s\n", path, strerror(errno));
+    } else if (n != sizeof(header) ||
+               memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+               header.recordSize != sizeof(Record)) {
+      ERROR("File %s is not a compatible log.\n", path);
+    } else {
+      _start = header.start;
+    }
+
+    struct stat st;
+    if (fstat(_fd, &st) == -1)
+      ERROR("Failed to read log %s: %s\n", path, strerror(errno));
+    _committed = (st.st_size - sizeof(Header)) / sizeof(Record);
+    off_t end = sizeof(Header) + _committed * sizeof(Record);
+    if (end != st.st_size) {
+      WARN("Discarding %ld bytes of torn log record.\n",
+           (long)(st.st_size - end));
+      if (ftruncate(_fd, end) == -1)
+        ERROR("Failed to truncate log %s: %s\n", path, strerror(errno));
+    }
+    _pending.reserve(MAX_PENDING);
+    _writing.reserve(MAX_PENDING);
+  }
+
+  /// @return Position of the next record to be appended.
+  uint64_t position() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _start + _committed + _writing.size() + _pending.size();
+  }
+
+  /// @brief Calls apply(op, plid, session, time) for every record in the
+  /// log.
+  /// @param from Position of the first record to be replayed.
+  /// @return Number of records replayed.
+  template <typename F>
+  size_t replay(uint64_t from, F &&apply) {
+    if (from < _start)
+      ERROR("Log %s starts at record %lu, but record %lu is needed.\n", _path,
+            (unsigned long)_start, (unsigned long)from);
+    if (from > _start + _committed) return 0;
+
+    std::vector<Record> chunk(MAX_PENDING);
+    off_t offset = sizeof(Header) + (from - _start) * sizeof(Record);
+    off_t end = sizeof(Header) + _committed * sizeof(Record);
+    while (offset < end) {
+      size_t n = std::min<size_t>(chunk.size(), (end - offset) / sizeof(Record));
+      if (pread(_fd, chunk.data(), n * sizeof(Record), offset) !=
+          (ssize_t)(n * sizeof(Record)))
+        ERROR("Failed to read log: %s\n", strerror(errno));
+      for (size_t i = 0; i < n; i++)
+        apply(chunk[i].op, (int)chunk[i].plid, chunk[i].session,
+              (time_t)chunk[i].time);
+      offset += n * sizeof(Record);
+    }
+    return _start + _committed - from;
+  }
+
+  /// @brief Drops every record before a position, once a snapshot covers
+  /// them. The remaining records are copied to a new file that atomically
+  /// replaces the log. Commits only wait for the records committed during
+  /// the copy, not for the copy itself.
+  /// @param upTo Position of the first record to be kept.
+  void compact(uint64_t upTo) {
+    if (getpid() != _owner) return;
+    std::lock_guard<std::mutex> compactLock(_compactMutex);
+    commit();
+    uint64_t copied;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (upTo <= _start || upTo > _start + _committed) return;
+      copied = _committed;
+    }
+
+    std::string tmpPath = std::string(_path) + ".tmp";
+    int fd = open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd == -1) {
+      WARN("Failed to compact log: %s\n", strerror(errno));
+      return;
+    }
+    // Only compactions move the start, and the file only grows meanwhile.
+    bool ok = writeHeader(fd, upTo) && copyRecords(fd, upTo - _start, copied);
+
+    std::lock_guard<std::mutex> commitLock(_commitMutex);
+    ok = ok && copyRecords(fd, copied, _committed);
+    if (!ok || fdatasync(fd) == -1 || rename(tmpPath.c_str(), _path) == -1) {
+      WARN("Failed to compact log: %s\n", strerror(errno));
+      close(fd);
+      unlink(tmpPath.c_str());
+      return;
+    }
+    DEBUG("Compacted log, dropped %lu records.\n",
+          (unsigned long)(upTo - _start));
+    std::lock_guard<std::mutex> lock(_mutex);
+    close(_fd);
+    _fd = fd;
+    _committed -= upTo - _start;
+    _start = upTo;
+  }
+
+  /// @brief Runs compact() on a thread of its own, so the caller does not
+  /// wait for the copy. Does nothing while the last one is still running,
+  /// the next compaction drops its records as well.
+  void compactInBackground(uint64_t upTo) {
+    if (_compacting) return;
+    if (_compactor != nullptr) _compactor->join();
+    _compacting = true;
+    _compactor = std::make_unique<std::thread>([this, upTo] {
+      compact(upTo);
+      _compacting = false;
+    });
+  }
+
+  /// @brief Buffers a record until the next commit.
+  /// @param time Epoch time of the change, 0 for now.
+  void append(Operation op, int plid, const GameSession &session,
+              time_t time = 0) {
+    bool full;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (_pending.empty()) _deadline = utils_clock.monotonic() + _interval;
+      Record &r = _pending.emplace_back();
+      r.plid = plid;
+      r.op = op;
+      r.time = time != 0 ? time : utils_clock.now();
+      r.session = session;
+      full = _interval == 0 || _pending.size() >= MAX_PENDING;
+    }
+    if (full) commit();
+  }
+
+  /// @brief Writes and syncs every pending record. Records not written whole
+  /// are cut off the file and stay pending, to be written again by the next
+  /// commit. Will exit(1) if they can not be cut off.
+  void commit() {
+    if (getpid() != _owner) return;
+    std::lock_guard<std::mutex> commitLock(_commitMutex);
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (_pending.empty()) return;
+      std::swap(_writing, _pending);
+    }
+    const char *buf = (const char *)_writing.data();
+    size_t len = _writing.size() * sizeof(Record), n_written = 0;
+    while (n_written < len) {
+      ssize_t n = ::write(_fd, buf + n_written, len - n_written);
+      if (n == -1) {
+        if (errno == EINTR) continue;
+        WARN("Failed to write %zu log records: %s\n", _writing.size(),
+             strerror(errno));
+        break;
+      }
+      n_written += n;
+    }
+    size_t written = n_written / sizeof(Record);
+    // A torn record would misalign every record appended after it.
+    if (n_written % sizeof(Record) != 0 &&
+        ftruncate(_fd, sizeof(Header) + (_committed + written) *
+                                            sizeof(Record)) == -1)
+      ERROR("Failed to truncate log %s: %s\n", _path, strerror(errno));
+    if (fdatasync(_fd) == -1) WARN("Failed to sync log: %s\n", strerror(errno));
+    DEBUG("Committed %zu log records.\n", written);
+    std::lock_guard<std::mutex> lock(_mutex);
+    _committed += written;
+    if (written < _writing.size()) {
+      if (_pending.empty()) _deadline = utils_clock.monotonic() + _interval;
+      _pending.insert(_pending.begin(), _writing.begin() + written,
+                      _writing.end());
+    }
+    _writing.clear();
+  }
+
+  /// @brief Commits if the commit interval of the oldest pending record ended.
+  void tick() {
+    bool due;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      due = !_pending.empty() && utils_clock.monotonic() >= _deadline;
+    }
+    if (due) commit();
+  }
+
+  /// @return Microseconds until the next commit is due, -1 if none is pending.
+  long timeout() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_pending.empty()) return -1;
+    uint64_t now = utils_clock.monotonic();
+    return now >= _deadline ? 0 : (_deadline - now) / 1000;
+  }
+
+  ~WriteAheadLog() {
+    // Forked children inherit the pending records, only the owner commits.
+    // They do not have the compaction thread either.
+    if (getpid() != _owner) {
+      (void)_compactor.release();
+      return;
+    }
+    if (_compactor != nullptr) _compactor->join();
+    commit();
+    close(_fd);
+  }
+};
+
+#endif  // WRITEAHEADLOG_HPP_
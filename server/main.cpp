@@ -1,64 +1,254 @@
+#include <signal.h>
 #include <stdio.h>
 #include <sys/select.h>
 
+#include <memory>
+#include <thread>
+#include <vector>
+
 #include "common/utils.hpp"
+#include "server/Archive.hpp"
+#include "server/Capture.hpp"
+#include "server/Cycles.hpp"
 #include "server/GameStorage.hpp"
+#include "server/Metrics.hpp"
 #include "server/TCPServer.hpp"
 #include "server/TCPServerParser.hpp"
+#include "server/Tracer.hpp"
 #include "server/UDPServer.hpp"
+#include "server/Snapshot.hpp"
 #include "server/UDPServerParser.hpp"
+#include "server/WriteAheadLog.hpp"
 
 const char *DEFAULT_IP = "0.0.0.0";
 const char *DEFAULT_PORT = "58071";
+/// @brief Default group commit interval of the write-ahead log in ms.
+const int DEFAULT_COMMIT_INTERVAL = 10;
+/// @brief Default interval between snapshots in seconds.
+const int DEFAULT_SNAPSHOT_INTERVAL = 60;
+/// @brief Default spill file of sessions evicted to stay within budget.
+const char *DEFAULT_SPILL_PATH = "GS.spill";
+/// @brief Default file traces are dumped to on SIGUSR1.
+const char *DEFAULT_TRACE_PATH = "GS.trace.json";
+
+/// @brief Set by SIGUSR1, the event loop dumps the trace.
+volatile sig_atomic_t traceRequested = 0;
 
 int main(int argc, char **argv) {
   const char *ip = DEFAULT_IP;
   const char *port = DEFAULT_PORT;
+  const char *walPath = nullptr;
+  int commitInterval = DEFAULT_COMMIT_INTERVAL;
+  const char *snapshotPath = nullptr;
+  int snapshotInterval = DEFAULT_SNAPSHOT_INTERVAL;
+  const char *archivePath = nullptr;
+  int memoryBudget = 0;
+  const char *spillPath = DEFAULT_SPILL_PATH;
+  bool sharedSessions = false;
+  int udpThreads = 0;
+  int traceRate = 0;
+  const char *tracePath = DEFAULT_TRACE_PATH;
+  bool countCycles = false;
+  const char *capturePath = nullptr;
 
   // Handle CLI Flags
   for (int i = 1; i < argc; i++) {
     if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
       port = argv[++i];
+    else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+      walPath = argv[++i];
+    else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+      commitInterval = std::max(atoi(argv[++i]), 0);
+    else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+      snapshotPath = argv[++i];
+    else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc)
+      snapshotInterval = std::max(atoi(argv[++i]), 1);
+    else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc)
+      archivePath = argv[++i];
+    else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+      memoryBudget = std::max(atoi(argv[++i]), 0);
+    else if (strcmp(argv[i], "-M") == 0 && i + 1 < argc)
+      spillPath = argv[++i];
+    else if (strcmp(argv[i], "-x") == 0)
+      sharedSessions = true;
+    else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+      udpThreads = std::max(atoi(argv[++i]), 0);
+    else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+      traceRate = std::max(atoi(argv[++i]), 0);
+    else if (strcmp(argv[i], "-R") == 0 && i + 1 < argc)
+      tracePath = argv[++i];
+    else if (strcmp(argv[i], "-C") == 0)
+      countCycles = true;
+    else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc)
+      capturePath = argv[++i];
     else if (strcmp(argv[i], "-v") == 0) {
       utils_verbose_flag = true;
     } else if (strcmp(argv[i], "-d") == 0) {
       utils_debug_flag = true;
     } else {
-      fprintf(stderr, "Usage: %s [-p port] [-v] [-d]\n", argv[0]);
+      fprintf(stderr, "Usage: %s [-p port] [-v] [-d] [-w wal] [-c commit_ms] "
+              "[-s snapshot] [-S snapshot_s] [-a archive] [-m memory_mb] "
+              "[-M spill] [-x] [-t threads] [-r trace_rate] [-R trace] [-C] "
+              "[-k capture]\n",
+              argv[0]);
       return 1;
     }
   }
 
+  if (sharedSessions && memoryBudget > 0) {
+    fprintf(stderr, "A shared session table can not be spilled, -x and -m "
+            "are exclusive.\n");
+    return 1;
+  }
+  if (udpThreads > 0 && memoryBudget > 0) {
+    fprintf(stderr, "A spilled session table is not thread safe, -t and -m "
+            "are exclusive.\n");
+    return 1;
+  }
+
+  // SIGUSR1 is blocked in every thread, the logger's and the ones started
+  // later included, and only let through while the event loop waits, so it
+  // is this loop that wakes up to dump the trace.
+  sigset_t usr1, waitMask;
+  sigemptyset(&usr1);
+  sigaddset(&usr1, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &usr1, &waitMask);
+
+  // Messages are formatted and written by a thread of their own from here.
+  utils_logger.start();
   INFO("GSPort is %s\n", port);
 
-  GameStorage gameStore = GameStorage();
-  UDPServer udpServer = UDPServer(port, ip);
+  timespec start, ready;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  GameStorage gameStore = GameStorage(sharedSessions, udpThreads > 0);
+  std::unique_ptr<SessionSpill> spill;
+  if (memoryBudget > 0) {
+    spill = std::make_unique<SessionSpill>(gameStore.sessions(), spillPath,
+                                           (size_t)memoryBudget << 20);
+    gameStore.spillTo(*spill);
+  }
+  std::unique_ptr<Archive::Writer> archive;
+  if (archivePath != nullptr) {
+    archive = std::make_unique<Archive::Writer>(archivePath);
+    gameStore.archiveTo(*archive);
+  }
+  std::unique_ptr<Snapshot> snapshot;
+  uint64_t walPosition = 0;
+  if (snapshotPath != nullptr) {
+    snapshot = std::make_unique<Snapshot>(snapshotPath, snapshotInterval);
+    if (snapshot->load(gameStore, walPosition))
+      INFO("Restored snapshot %s\n", snapshotPath);
+  }
+  std::unique_ptr<WriteAheadLog> wal;
+  if (walPath != nullptr) {
+    wal = std::make_unique<WriteAheadLog>(walPath, commitInterval);
+    size_t n = gameStore.recover(*wal, walPosition);
+    INFO("Replayed %zu records from %s\n", n, walPath);
+  }
+  gameStore.settle();
+
+  clock_gettime(CLOCK_MONOTONIC, &ready);
+  INFO("Storage ready in %ld us\n", (ready.tv_sec - start.tv_sec) * 1000000 +
+                                        (ready.tv_nsec - start.tv_nsec) / 1000);
+  // With worker threads, each has its own socket on the port and this loop
+  // only serves TCP and the timers.
+  Metrics metrics;
+  Tracer tracer;
+  if (traceRate > 0) {
+    tracer.sample(traceRate);
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = [](int) { traceRequested = 1; };
+    if (sigaction(SIGUSR1, &act, nullptr) == -1)
+      ERROR("Failed to create handler for SIGUSR1: %s\n", strerror(errno));
+    INFO("Tracing 1 in %d requests, SIGUSR1 dumps them to %s\n", traceRate,
+         tracePath);
+  }
+  if (countCycles) {
+    Cycles::enable();
+    INFO("Counting cycles per stage, CYCLES shows them\n");
+  }
+  std::unique_ptr<Capture::Writer> capture;
+  if (capturePath != nullptr) {
+    capture = std::make_unique<Capture::Writer>(capturePath);
+    INFO("Capturing requests to %s\n", capturePath);
+  }
+  std::vector<std::unique_ptr<UDPServer>> udpServers;
+  std::vector<std::unique_ptr<UDPServerParser>> udpParsers;
+  for (int i = 0; i < std::max(udpThreads, 1); i++) {
+    udpServers.push_back(
+        std::make_unique<UDPServer>(port, ip, udpThreads > 0));
+    if (capture) udpServers.back()->captureTo(*capture);
+    udpParsers.push_back(std::make_unique<UDPServerParser>(gameStore, metrics));
+  }
+  for (int i = 0; i < udpThreads; i++)
+    std::thread(&UDPServer::serve, udpServers[i].get(),
+                std::ref(*udpParsers[i]))
+        .detach();
+  if (udpThreads > 0) INFO("Serving UDP from %d threads\n", udpThreads);
   TCPServer tcpServer = TCPServer(port, ip);
-  UDPServerParser udpParser = UDPServerParser(gameStore);
-  TCPServerParser tcpParser = TCPServerParser(gameStore);
+  TCPServerParser tcpParser = TCPServerParser(gameStore, metrics);
+  if (capture) tcpServer.captureTo(*capture);
 
-  fd_set rfds, testfds;
+  fd_set rfds, testfds, writefds;
   FD_ZERO(&rfds);                          // Clear input mask
-  FD_SET(udpServer.socket().fd(), &rfds);  // Set UDP Channel on
   FD_SET(tcpServer.socket().fd(), &rfds);  // Set TCP Channel on
-  int nfds = std::max(udpServer.socket().fd(), tcpServer.socket().fd());
+  int nfds = tcpServer.socket().fd();
+  if (udpThreads == 0) {
+    FD_SET(udpServers[0]->socket().fd(), &rfds);  // Set UDP Channel on
+    nfds = std::max(nfds, udpServers[0]->socket().fd());
+  }
 
   while (1) {
     testfds = rfds;
-    int ready = select(nfds + 1, &testfds, nullptr, nullptr, nullptr);
+    // TCP replies not taken at once are written as the clients drain them.
+    FD_ZERO(&writefds);
+    int maxfd = std::max(nfds, tcpServer.watch(writefds));
+    // Wake up in time for the next group commit, snapshot or timeout.
+    timespec timeout, *timeoutp = nullptr;
+    long us = gameStore.timeout();
+    long walUs = wal ? wal->timeout() : -1;
+    long snapshotUs = snapshot ? snapshot->timeout(gameStore) : -1;
+    long tcpUs = tcpServer.timeout();
+    if (us < 0 || (walUs >= 0 && walUs < us)) us = walUs;
+    if (us < 0 || (snapshotUs >= 0 && snapshotUs < us)) us = snapshotUs;
+    if (us < 0 || (tcpUs >= 0 && tcpUs < us)) us = tcpUs;
+    if (us >= 0) {
+      timeout = {.tv_sec = us / 1000000, .tv_nsec = us % 1000000 * 1000};
+      timeoutp = &timeout;
+    }
+    int ready =
+        pselect(maxfd + 1, &testfds, &writefds, nullptr, timeoutp, &waitMask);
     if (ready == -1) {
-      WARN("Select failed: %s\n", strerror(errno));
+      if (errno != EINTR) WARN("Select failed: %s\n", strerror(errno));
+      FD_ZERO(&testfds);
+      FD_ZERO(&writefds);
+    }
+    if (traceRequested) {
+      traceRequested = 0;
+      long n = tracer.dump(tracePath);
+      if (n < 0)
+        WARN("Failed to write trace %s: %s\n", tracePath, strerror(errno));
+      else
+        INFO("Dumped %ld spans to %s\n", n, tracePath);
     }
-    if (FD_ISSET(udpServer.socket().fd(), &testfds)) {
+    // Time is only read once per iteration.
+    utils_clock.refresh();
+    if (udpThreads == 0 && FD_ISSET(udpServers[0]->socket().fd(), &testfds)) {
       DEBUG("Processing UDP\n");
-      udpServer.processRequest(udpParser);
+      udpServers[0]->processRequest(*udpParsers[0]);
     }
     if (FD_ISSET(tcpServer.socket().fd(), &testfds)) {
       DEBUG("Processing TCP\n");
 
       // Exit if process is child.
-      if (tcpServer.processRequest(tcpParser)) return 0;
+      if (tcpServer.processRequest(tcpParser)) TCPServer::exitChild();
     }
+    tcpServer.flush(writefds);
+    gameStore.tick();
+    if (wal) wal->tick();
+    if (snapshot) snapshot->tick(gameStore, wal.get());
   }
 
   return 0;
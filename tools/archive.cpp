@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "common/utils.hpp"
+#include "server/Archive.hpp"
+#include "server/GameSession.hpp"
+#include "server/Trial.hpp"
+
+/// @brief Aggregates of a set of games, merged across threads.
+struct Aggregates {
+  static const int MAX_DURATION = 600;
+
+  uint64_t games = 0;
+  uint64_t debug = 0;
+  uint64_t results[GameSession::PLAYING + 1] = {};
+  /// @brief Won games by number of trials.
+  uint64_t trialsToWin[Archive::MAX_TRIALS + 1] = {};
+  /// @brief Games by duration in seconds, all and won.
+  uint64_t durations[MAX_DURATION + 1] = {};
+  uint64_t winDurations[MAX_DURATION + 1] = {};
+  /// @brief Per code: games, wins and trials of those wins.
+  uint64_t codeGames[Trial::CODES] = {};
+  uint64_t codeWins[Trial::CODES] = {};
+  uint64_t codeTrials[Trial::CODES] = {};
+
+  void add(const Archive::Block &b) {
+    const uint16_t *code = b.column<uint16_t>(Archive::CODE);
+    const uint16_t *duration = b.column<uint16_t>(Archive::DURATION);
+    const uint8_t *trials = b.column<uint8_t>(Archive::TRIALS_MADE);
+    const uint8_t *result = b.column<uint8_t>(Archive::RESULT);
+    const uint8_t *debugMode = b.column<uint8_t>(Archive::DEBUG_MODE);
+    games += b.games;
+    for (uint32_t i = 0; i < b.games; i++) {
+      uint16_t d = std::min<uint16_t>(duration[i], MAX_DURATION);
+      uint16_t c = std::min<uint16_t>(code[i], Trial::CODES - 1);
+      uint8_t t = std::min<uint8_t>(trials[i], Archive::MAX_TRIALS);
+      bool win = result[i] == GameSession::WIN;
+      debug += debugMode[i];
+      results[std::min<uint8_t>(result[i], GameSession::PLAYING)]++;
+      durations[d]++;
+      codeGames[c]++;
+      if (win) {
+        trialsToWin[t]++;
+        winDurations[d]++;
+        codeWins[c]++;
+        codeTrials[c] += t;
+      }
+    }
+  }
+
+  void merge(const Aggregates &o) {
+    games += o.games;
+    debug += o.debug;
+    for (int i = 0; i <= GameSession::PLAYING; i++) results[i] += o.results[i];
+    for (int i = 0; i <= Archive::MAX_TRIALS; i++)
+      trialsToWin[i] += o.trialsToWin[i];
+    for (int i = 0; i <= MAX_DURATION; i++) {
+      durations[i] += o.durations[i];
+      winDurations[i] += o.winDurations[i];
+    }
+    for (int i = 0; i < Trial::CODES; i++) {
+      codeGames[i] += o.codeGames[i];
+      codeWins[i] += o.codeWins[i];
+      codeTrials[i] += o.codeTrials[i];
+    }
+  }
+};
+
+/// @return Duration under which a fraction p of the histogram falls.
+static int percentile(const uint64_t *hist, double p) {
+  uint64_t total = 0, seen = 0;
+  for (int i = 0; i <= Aggregates::MAX_DURATION; i++) total += hist[i];
+  if (total == 0) return 0;
+  for (int i = 0; i <= Aggregates::MAX_DURATION; i++) {
+    seen += hist[i];
+    if (seen >= p * total) return i;
+  }
+  return Aggregates::MAX_DURATION;
+}
+
+static void printPercentiles(const char *name, const uint64_t *hist) {
+  printf("  %-10s p50 %3ds  p90 %3ds  p99 %3ds  max %3ds\n", name,
+         percentile(hist, 0.5), percentile(hist, 0.9), percentile(hist, 0.99),
+         percentile(hist, 1));
+}
+
+static void printCodes(const char *title, const Aggregates &a,
+                       std::vector<int> &codes) {
+  printf("\n%s\n  CODE  GAMES   WIN%%  AVG TRIALS\n", title);
+  for (size_t i = 0; i < codes.size() && i < 10; i++) {
+    int c = codes[i];
+    printf("  %s  %5lu  %5.1f  %10.2f\n", Trial::fromIndex(c).toString().c_str(),
+           (unsigned long)a.codeGames[c], 100.0 * a.codeWins[c] / a.codeGames[c],
+           a.codeWins[c] ? (double)a.codeTrials[c] / a.codeWins[c] : 0.0);
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *path = nullptr;
+  int threads = std::max(1u, std::thread::hardware_concurrency());
+
+  // Handle CLI Flags
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+      threads = std::max(atoi(argv[++i]), 1);
+    else if (path == nullptr && argv[i][0] != '-')
+      path = argv[i];
+    else
+      path = nullptr, argc = 0;
+  }
+  if (path == nullptr) {
+    fprintf(stderr, "Usage: %s [-j threads] archive\n", argv[0]);
+    return 1;
+  }
+
+  Archive::Reader reader(path);
+  const uint32_t mask = 1u << Archive::CODE | 1u << Archive::DURATION |
+                        1u << Archive::TRIALS_MADE | 1u << Archive::RESULT |
+                        1u << Archive::DEBUG_MODE;
+
+  // Blocks are handed out one at a time, each thread keeps its own totals.
+  std::atomic<size_t> next = 0;
+  std::vector<Aggregates> partial(threads);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      Archive::Block block;
+      for (size_t i; (i = next++) < reader.blocks();) {
+        if (!reader.read(i, mask, block)) {
+          WARN("Skipping unreadable block %zu.\n", i);
+          continue;
+        }
+        partial[t].add(block);
+      }
+    });
+  }
+  Aggregates a;
+  for (int t = 0; t < threads; t++) {
+    workers[t].join();
+    a.merge(partial[t]);
+  }
+
+  printf("%lu games in %zu blocks (%lu debug)\n", (unsigned long)a.games,
+         reader.blocks(), (unsigned long)a.debug);
+  printf("  won %lu, lost %lu, timed out %lu, quit %lu\n",
+         (unsigned long)a.results[GameSession::WIN],
+         (unsigned long)a.results[GameSession::LOSS],
+         (unsigned long)a.results[GameSession::TIMEOUT],
+         (unsigned long)a.results[GameSession::QUIT]);
+
+  printf("\nTrials to win\n");
+  uint64_t wins = std::max<uint64_t>(a.results[GameSession::WIN], 1);
+  for (int t = 1; t <= Archive::MAX_TRIALS; t++)
+    printf("  %d %10lu %5.1f%% %s\n", t, (unsigned long)a.trialsToWin[t],
+           100.0 * a.trialsToWin[t] / wins,
+           std::string(50 * a.trialsToWin[t] / wins, '#').c_str());
+
+  printf("\nDuration\n");
+  printPercentiles("all games", a.durations);
+  printPercentiles("won games", a.winDurations);
+
+  std::vector<int> codes;
+  for (int c = 0; c < Trial::CODES; c++)
+    if (a.codeGames[c] > 0) codes.push_back(c);
+  // Hardest codes are won least often and, when won, need more trials.
+  auto harder = [&](int x, int y) {
+    double wx = (double)a.codeWins[x] / a.codeGames[x];
+    double wy = (double)a.codeWins[y] / a.codeGames[y];
+    if (wx != wy) return wx < wy;
+    return a.codeTrials[x] * a.codeWins[y] > a.codeTrials[y] * a.codeWins[x];
+  };
+  std::sort(codes.begin(), codes.end(), harder);
+  printCodes("Hardest codes", a, codes);
+  std::reverse(codes.begin(), codes.end());
+  printCodes("Easiest codes", a, codes);
+  return 0;
+}
@@ -0,0 +1,462 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "client/AsyncUDPClient.hpp"
+#include "client/TCPClient.hpp"
+#include "common/utils.hpp"
+#include "server/Metrics.hpp"
+#include "server/Trial.hpp"
+
+const char *DEFAULT_IP = "localhost";
+const char *DEFAULT_PORT = "58071";
+
+/// @brief Everything measured, shared by all threads.
+struct Report {
+  Histogram latency[Metrics::OPCODES];
+  std::atomic<uint64_t> sent[Metrics::OPCODES];
+  std::atomic<uint64_t> replies[Metrics::OPCODES];
+  /// @brief Replies with an ERR status or that broke the game.
+  std::atomic<uint64_t> errors[Metrics::OPCODES];
+  std::atomic<uint64_t> timeouts[Metrics::OPCODES];
+  std::atomic<uint64_t> won, lost, quit, wonTrials;
+  /// @brief Open loop sends due while every player was waiting.
+  std::atomic<uint64_t> missed;
+  /// @brief TCP queries not made because the TCP threads fell behind.
+  std::atomic<uint64_t> dropped;
+} report;
+
+/// @brief Options shared by all threads.
+struct Options {
+  const char *ip = DEFAULT_IP;
+  const char *port = DEFAULT_PORT;
+  int players = 1000;
+  int threads = 1;
+  int seconds = 10;
+  /// @brief UDP requests per second in open loop, 0 for closed loop.
+  int rate = 0;
+  /// @brief Percentage of games followed by STR and SSB over TCP.
+  int mix = 0;
+  int tcpThreads = 1;
+  /// @brief Percentage of games quit before they end.
+  int quitters = 10;
+  /// @brief Wait for UDP replies until a round trip is measured.
+  int timeoutMs = 1000;
+  int maxTimeoutMs = 8000;
+  /// @brief Percentage of UDP transmissions dropped, to simulate loss.
+  int loss = 0;
+  int firstPlid = 1;
+  unsigned seed = 1;
+} options;
+
+/// @brief Mastermind solver that always guesses a code consistent with
+/// every answer so far, which wins in under 5 trials on average.
+class Solver {
+ private:
+  std::vector<uint16_t> _candidates;
+
+ public:
+  /// @brief Starts a game, guesses are taken in random order.
+  void reset(std::mt19937 &rng) {
+    _candidates.resize(Trial::CODES);
+    std::iota(_candidates.begin(), _candidates.end(), 0);
+    std::shuffle(_candidates.begin(), _candidates.end(), rng);
+  }
+
+  Trial guess() const {
+    return Trial::fromIndex(_candidates.empty() ? 0 : _candidates.front());
+  }
+
+  /// @brief Keeps the codes that would have answered a guess the same.
+  void answer(const Trial &guess, uint16_t nB, uint16_t nW) {
+    std::erase_if(_candidates, [&](uint16_t c) {
+      uint16_t b, w;
+      guess.evaluate(Trial::fromIndex(c), b, w);
+      return b != nB || w != nW;
+    });
+  }
+};
+
+/// @brief Query for the TCP threads.
+struct Query {
+  Metrics::Opcode opcode;
+  int plid;
+};
+
+/// @brief Bounded queue of queries from the UDP threads to the TCP ones.
+class QueryQueue {
+ public:
+  static const size_t CAPACITY = 10000;
+
+ private:
+  std::mutex _mutex;
+  std::condition_variable _ready;
+  std::deque<Query> _queries;
+  bool _closed = false;
+
+ public:
+  void push(Query q) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (_queries.size() >= CAPACITY) {
+        report.dropped++;
+        return;
+      }
+      _queries.push_back(q);
+    }
+    _ready.notify_one();
+  }
+
+  /// @return Whether a query was popped, false once closed.
+  bool pop(Query &q) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _ready.wait(lock, [this] { return _closed || !_queries.empty(); });
+    if (_closed) return false;
+    q = _queries.front();
+    _queries.pop_front();
+    return true;
+  }
+
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _closed = true;
+    }
+    _ready.notify_all();
+  }
+} queries;
+
+/// @brief Simulated player, with one request in flight at most.
+struct Player {
+  int plid;
+  Solver solver;
+  Trial guess;
+  int nT = 1;
+  /// @brief Trial the game is quit at, 0 to play it out.
+  int quitAt = 0;
+  /// @brief Next request or the one in flight.
+  char request[BUFFER_SIZE] = "";
+  Metrics::Opcode opcode = Metrics::SNG;
+  /// @brief When the request was due, latency counts from here.
+  uint64_t start = 0;
+};
+
+/// @brief Drives a share of the players through their games over UDP.
+class Worker {
+ private:
+  AsyncUDPClient _client;
+  std::vector<std::unique_ptr<Player>> _players;
+  std::mt19937 _rng;
+  /// @brief Players with their next request ready, in open loop.
+  std::deque<uint32_t> _idle;
+  /// @brief Nanoseconds between sends in open loop, 0 in closed loop.
+  uint64_t _interval;
+
+  // Delete copy constructor to prevent accidental copies
+  Worker(const Worker &) = delete;
+  Worker &operator=(const Worker &) = delete;
+
+  void send(uint32_t i) {
+    Player &p = *_players[i];
+    report.sent[p.opcode]++;
+    _client.send(p.plid, p.request,
+                 [this, i](const AsyncUDPClient::Completion &c) {
+                   receive(i, c);
+                 });
+  }
+
+  /// @brief Makes the next request of a player, sent now in closed loop
+  /// and when the rate allows in open loop.
+  void next(uint32_t i, Metrics::Opcode opcode, uint64_t now) {
+    Player &p = *_players[i];
+    switch (opcode) {
+      case Metrics::SNG:
+        snprintf(p.request, sizeof(p.request), "SNG %06d %03d\n", p.plid, 600);
+        break;
+      case Metrics::TRY:
+        p.guess = p.solver.guess();
+        snprintf(p.request, sizeof(p.request), "TRY %06d %c %c %c %c %d\n",
+                 p.plid, p.guess.c1(), p.guess.c2(), p.guess.c3(),
+                 p.guess.c4(), p.nT);
+        break;
+      default:
+        snprintf(p.request, sizeof(p.request), "QUT %06d\n", p.plid);
+        break;
+    }
+    p.opcode = opcode;
+    if (_interval != 0) {
+      _idle.push_back(i);
+    } else {
+      p.start = now;
+      send(i);
+    }
+  }
+
+  /// @brief Starts a new game, after the last one ended.
+  void newGame(uint32_t i, uint64_t now) {
+    Player &p = *_players[i];
+    p.nT = 1;
+    std::uniform_int_distribution<int> percent(0, 99);
+    p.quitAt = percent(_rng) < options.quitters
+                   ? std::uniform_int_distribution<int>(1, 7)(_rng)
+                   : 0;
+    next(i, Metrics::SNG, now);
+  }
+
+  /// @brief Ends a game, asking for its trials and the scoreboard over TCP
+  /// every so often.
+  void ended(uint32_t i, std::atomic<uint64_t> &result, uint64_t now) {
+    result++;
+    if (std::uniform_int_distribution<int>(0, 99)(_rng) < options.mix) {
+      queries.push({Metrics::STR, _players[i]->plid});
+      queries.push({Metrics::SSB, 0});
+    }
+    newGame(i, now);
+  }
+
+  /// @brief Plays on from the reply to a player's request, giving up on the
+  /// game if none came.
+  void receive(uint32_t i, const AsyncUDPClient::Completion &c) {
+    Player &p = *_players[i];
+    uint64_t now = Metrics::now();
+    const char *reply = c.reply;
+    report.timeouts[p.opcode] += c.sends - 1 + (reply == nullptr);
+    if (reply == nullptr) {
+      report.errors[p.opcode]++;
+      newGame(i, now);
+      return;
+    }
+    report.replies[p.opcode]++;
+    report.latency[p.opcode].record(now - p.start);
+
+    int nT, nB, nW;
+    if (p.opcode == Metrics::SNG) {
+      if (strcmp(reply, "RSG OK\n") == 0) {
+        p.solver.reset(_rng);
+        next(i, p.quitAt == 1 ? Metrics::QUT : Metrics::TRY, now);
+      } else if (strcmp(reply, "RSG NOK\n") == 0) {
+        // A game of an earlier run is still going.
+        p.quitAt = 0;
+        next(i, Metrics::QUT, now);
+      } else {
+        report.errors[p.opcode]++;
+        newGame(i, now);
+      }
+    } else if (p.opcode == Metrics::TRY) {
+      if (sscanf(reply, "RTR OK %d %d %d", &nT, &nB, &nW) == 3) {
+        if (nB == 4) {
+          report.wonTrials += nT;
+          ended(i, report.won, now);
+          return;
+        }
+        p.solver.answer(p.guess, nB, nW);
+        p.nT++;
+        next(i, p.nT == p.quitAt ? Metrics::QUT : Metrics::TRY, now);
+      } else if (strncmp(reply, "RTR ENT", 7) == 0 ||
+                 strncmp(reply, "RTR ETM", 7) == 0) {
+        ended(i, report.lost, now);
+      } else {
+        report.errors[p.opcode]++;
+        next(i, Metrics::QUT, now);
+      }
+    } else {
+      if (strncmp(reply, "RQT OK", 6) == 0 && p.quitAt != 0)
+        ended(i, report.quit, now);
+      else
+        newGame(i, now);
+    }
+  }
+
+ public:
+  /// @param first Index of the first player of the worker.
+  Worker(int first, int players, unsigned seed)
+      : _client(options.ip, options.port, options.timeoutMs,
+                options.maxTimeoutMs),
+        _rng(seed) {
+    _client.setLoss(options.loss, seed);
+    _interval = options.rate > 0
+                    ? 1000000000ull * options.threads / options.rate
+                    : 0;
+    for (int i = 0; i < players; i++) {
+      _players.push_back(std::make_unique<Player>());
+      _players[i]->plid = options.firstPlid + first + i;
+    }
+  }
+
+  /// @brief Plays until a deadline.
+  /// @param end Monotonic time in nanoseconds.
+  void run(uint64_t end) {
+    uint64_t now = Metrics::now(), due = now;
+    for (uint32_t i = 0; i < _players.size(); i++) newGame(i, now);
+    while ((now = Metrics::now()) < end) {
+      // Open loop sends are due at a fixed rate, whether players are ready
+      // or not, and their latency counts from when they were due.
+      for (; _interval != 0 && due <= now; due += _interval) {
+        if (_idle.empty()) {
+          report.missed++;
+          continue;
+        }
+        uint32_t i = _idle.front();
+        _idle.pop_front();
+        _players[i]->start = due;
+        send(i);
+      }
+      uint64_t wake = end;
+      if (_interval != 0) wake = std::min(wake, due);
+      // Waits under a millisecond are spun, epoll can not wait less. The
+      // client wakes up earlier for its retransmissions.
+      _client.poll(wake > now ? (wake - now) / 1000000 : 0);
+    }
+  }
+};
+
+/// @brief Makes the queries of finished games over TCP, one at a time.
+void queryLoop(const char *ip, const char *port) {
+  TCPClient client(ip, port);
+  Query q;
+  char request[BUFFER_SIZE];
+  while (queries.pop(q)) {
+    if (q.opcode == Metrics::STR)
+      snprintf(request, sizeof(request), "STR %06d\n", q.plid);
+    else
+      snprintf(request, sizeof(request), "SSB\n");
+    uint64_t start = Metrics::now();
+    report.sent[q.opcode]++;
+    const char *reply = client.runCommand(request);
+    report.replies[q.opcode]++;
+    report.latency[q.opcode].record(Metrics::now() - start);
+    if (Metrics::result(reply) == Metrics::ERR) report.errors[q.opcode]++;
+  }
+}
+
+void printReport(double seconds, uint64_t games) {
+  uint64_t requests = 0, replies = 0, errors = 0, timeouts = 0;
+  for (int o = 0; o < Metrics::OPCODES; o++) {
+    requests += report.sent[o];
+    replies += report.replies[o];
+    errors += report.errors[o];
+    timeouts += report.timeouts[o];
+  }
+  printf("%d players on %d threads for %.1f s, %s\n", options.players,
+         options.threads, seconds,
+         options.rate > 0 ? "open loop" : "closed loop");
+  if (options.rate > 0)
+    printf("  target %d req/s, %lu sends missed with every player busy\n",
+           options.rate, (unsigned long)report.missed.load());
+  printf("  %lu requests, %lu replies (%.0f req/s)\n", (unsigned long)requests,
+         (unsigned long)replies, replies / seconds);
+  printf("  %lu errors (%.3f%%), %lu timeouts (%.3f%%)\n",
+         (unsigned long)errors, 100.0 * errors / std::max<uint64_t>(replies, 1),
+         (unsigned long)timeouts,
+         100.0 * timeouts / std::max<uint64_t>(requests, 1));
+  printf("  %lu games: %lu won in %.2f trials, %lu lost, %lu quit\n",
+         (unsigned long)games, (unsigned long)report.won.load(),
+         (double)report.wonTrials / std::max<uint64_t>(report.won, 1),
+         (unsigned long)report.lost.load(), (unsigned long)report.quit.load());
+  if (report.dropped)
+    printf("  %lu TCP queries dropped, TCP threads fell behind\n",
+           (unsigned long)report.dropped.load());
+
+  printf("\nOpcode   requests    errors  timeouts   p50 (us)   p99 (us)  "
+         "p999 (us)\n");
+  for (int o = 0; o < Metrics::OPCODES; o++) {
+    if (report.sent[o] == 0) continue;
+    const Histogram &h = report.latency[o];
+    printf("%-6s %10lu %9lu %9lu %10.1f %10.1f %10.1f\n",
+           Metrics::OPCODE_NAMES[o], (unsigned long)report.sent[o].load(),
+           (unsigned long)report.errors[o].load(),
+           (unsigned long)report.timeouts[o].load(), h.percentile(0.5) / 1e3,
+           h.percentile(0.99) / 1e3, h.percentile(0.999) / 1e3);
+  }
+}
+
+int main(int argc, char **argv) {
+  // Handle CLI Flags
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+      options.ip = argv[++i];
+    else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+      options.port = argv[++i];
+    else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc)
+      options.players = std::max(atoi(argv[++i]), 1);
+    else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+      options.threads = std::max(atoi(argv[++i]), 1);
+    else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+      options.seconds = std::max(atoi(argv[++i]), 1);
+    else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+      options.rate = std::max(atoi(argv[++i]), 0);
+    else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+      options.mix = std::clamp(atoi(argv[++i]), 0, 100);
+    else if (strcmp(argv[i], "-T") == 0 && i + 1 < argc)
+      options.tcpThreads = std::max(atoi(argv[++i]), 1);
+    else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc)
+      options.quitters = std::clamp(atoi(argv[++i]), 0, 100);
+    else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+      options.timeoutMs = std::max(atoi(argv[++i]), 1);
+    else if (strcmp(argv[i], "-W") == 0 && i + 1 < argc)
+      options.maxTimeoutMs = std::max(atoi(argv[++i]), 1);
+    else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+      options.loss = std::clamp(atoi(argv[++i]), 0, 100);
+    else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+      options.firstPlid = std::max(atoi(argv[++i]), 1);
+    else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+      options.seed = atoi(argv[++i]);
+    else {
+      fprintf(stderr,
+              "Usage: %s [-n GSip] [-p GSport] [-P players] [-t threads] "
+              "[-d seconds] [-r rate] [-m mix_percent] [-T tcp_threads] "
+              "[-q quit_percent] [-w timeout_ms] [-W max_timeout_ms] "
+              "[-l loss_percent] [-b first_plid] [-s seed]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  options.threads = std::min(options.threads, options.players);
+  if (options.firstPlid + options.players - 1 > 999999)
+    ERROR("Players %d to %d exceed the largest PLID.\n", options.firstPlid,
+          options.firstPlid + options.players - 1);
+
+  // Every player has a socket of its own.
+  rlimit files;
+  if (getrlimit(RLIMIT_NOFILE, &files) == 0 &&
+      files.rlim_cur < (rlim_t)options.players + 64) {
+    files.rlim_cur = std::min<rlim_t>(files.rlim_max, options.players + 64);
+    setrlimit(RLIMIT_NOFILE, &files);
+  }
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  for (int t = 0, first = 0; t < options.threads; t++) {
+    int players = options.players / options.threads +
+                  (t < options.players % options.threads);
+    workers.push_back(
+        std::make_unique<Worker>(first, players, options.seed + t));
+    first += players;
+  }
+
+  uint64_t start = Metrics::now();
+  uint64_t end = start + options.seconds * 1000000000ull;
+  std::vector<std::thread> threads;
+  for (auto &w : workers) threads.emplace_back(&Worker::run, w.get(), end);
+  std::vector<std::thread> tcpThreads;
+  for (int t = 0; options.mix > 0 && t < options.tcpThreads; t++)
+    tcpThreads.emplace_back(queryLoop, options.ip, options.port);
+  for (auto &t : threads) t.join();
+  queries.close();
+  for (auto &t : tcpThreads) t.join();
+  double seconds = (Metrics::now() - start) / 1e9;
+
+  printReport(seconds, report.won + report.lost + report.quit);
+  return 0;
+}
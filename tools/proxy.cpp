@@ -0,0 +1,436 @@
+#include <netdb.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "client/TCPClient.hpp"
+#include "client/UDPClient.hpp"
+#include "common/UDPSocket.hpp"
+#include "common/utils.hpp"
+#include "server/Metrics.hpp"
+
+const char *DEFAULT_IP = "localhost";
+const char *DEFAULT_PORT = "58071";
+const char *DEFAULT_LISTEN_PORT = "58072";
+/// @brief Extra hold of reordered datagrams, so later ones overtake them.
+const int REORDER_MS = 10;
+/// @brief Largest datagram forwarded.
+const int MAX_DATAGRAM = 16384;
+/// @brief Epoll key of the socket players send to.
+const uint64_t LISTENER = UINT64_MAX;
+/// @brief Milliseconds between looks for idle players.
+const int SWEEP_MS = 1000;
+
+/// @brief Options of the proxy.
+struct Options {
+  const char *ip = DEFAULT_IP;
+  const char *port = DEFAULT_PORT;
+  const char *listenPort = DEFAULT_LISTEN_PORT;
+  /// @brief Percentages of datagrams dropped, duplicated and reordered.
+  int drop = 0;
+  int duplicate = 0;
+  int reorder = 0;
+  /// @brief Delay of every datagram, plus up to jitterMs more.
+  int delayMs = 0;
+  int jitterMs = 0;
+  /// @brief Seconds to run for, 0 until interrupted.
+  int seconds = 0;
+  /// @brief Seconds a player may stay quiet before its socket is closed.
+  int idleSeconds = 30;
+  unsigned seed = 1;
+} options;
+
+/// @brief What happened to the datagrams going one way.
+struct Direction {
+  uint64_t received, dropped, duplicated, reordered;
+};
+
+/// @brief Everything measured.
+struct Report {
+  Direction toServer, toPlayer;
+  /// @brief Distinct requests, and copies of the latest one sent again.
+  uint64_t requests, retransmissions;
+  /// @brief Requests whose reply reached the player.
+  uint64_t answered;
+  /// @brief Copies of a request reaching GS after the first.
+  uint64_t repeats;
+  /// @brief Repeats GS answered differently than the first copy.
+  uint64_t differed;
+  /// @brief Players seen, and those dropped after going idle.
+  uint64_t players, expired;
+  /// @brief Monotonic time of the first request and the last answer.
+  uint64_t first, last;
+} report;
+
+volatile sig_atomic_t stopping = 0;
+
+/// @brief Player behind the proxy, seen by GS at an address of its own
+/// until it goes idle.
+struct Player {
+  sockaddr_in addr;
+  UDPSocket upstream;
+  /// @brief Monotonic time of its last request.
+  uint64_t active = 0;
+  /// @brief Latest request, and the first reply GS gave it.
+  std::string request;
+  std::string reply;
+  /// @brief Copies of the latest request that reached GS.
+  int delivered = 0;
+  bool answered = false;
+};
+
+/// @brief Datagram held back until it is due.
+struct Datagram {
+  uint64_t due;
+  /// @brief Keeps datagrams due together in order.
+  uint64_t order;
+  uint64_t player;
+  bool toServer;
+  std::string data;
+  bool operator>(const Datagram &d) const {
+    return due != d.due ? due > d.due : order > d.order;
+  }
+};
+
+/// @brief Forwards datagrams between players and GS, impairing them.
+class Proxy {
+ private:
+  UDPSocket _listener;
+  addrinfo *_server = nullptr;
+  int _epoll;
+  std::unordered_map<uint64_t, std::unique_ptr<Player>> _players;
+  std::priority_queue<Datagram, std::vector<Datagram>, std::greater<Datagram>>
+      _held;
+  uint64_t _order = 0;
+  std::mt19937 _rng;
+  char _buf[MAX_DATAGRAM];
+
+  // Delete copy constructor to prevent accidental copies
+  Proxy(const Proxy &) = delete;
+  Proxy &operator=(const Proxy &) = delete;
+
+  bool chance(int percent) {
+    return percent > 0 && (int)(_rng() % 100) < percent;
+  }
+
+  /// @brief Drops, duplicates, delays and reorders a datagram.
+  void impair(uint64_t key, bool toServer, const char *data, size_t len,
+              uint64_t now) {
+    Direction &d = toServer ? report.toServer : report.toPlayer;
+    d.received++;
+    if (chance(options.drop)) {
+      d.dropped++;
+      return;
+    }
+    int copies = 1;
+    if (chance(options.duplicate)) {
+      d.duplicated++;
+      copies++;
+    }
+    for (int i = 0; i < copies; i++) {
+      uint64_t delay = options.delayMs * 1000000ull;
+      if (options.jitterMs > 0)
+        delay += _rng() % (options.jitterMs * 1000000ull + 1);
+      if (chance(options.reorder)) {
+        d.reordered++;
+        delay += REORDER_MS * 1000000ull;
+      }
+      _held.push(
+          {now + delay, _order++, key, toServer, std::string(data, len)});
+    }
+  }
+
+  /// @brief Sends a datagram on, keeping track of the copies of requests
+  /// reaching GS and of the replies reaching players.
+  void deliver(const Datagram &d, uint64_t now) {
+    auto it = _players.find(d.player);
+    if (it == _players.end()) return;  // Expired while held.
+    Player &p = *it->second;
+    if (d.toServer) {
+      if (d.data == p.request && ++p.delivered > 1) report.repeats++;
+      if (::sendto(p.upstream.fd(), d.data.data(), d.data.size(), 0,
+                   _server->ai_addr, _server->ai_addrlen) == -1)
+        DEBUG("UDP Failed to send %zu bytes: %s\n", d.data.size(),
+              strerror(errno));
+      return;
+    }
+    const char *req = p.request.c_str();
+    if (!p.answered &&
+        UDPClient::answers(UDPClient::replyCode(req),
+                           UDPClient::trialNumber(req), d.data.c_str())) {
+      p.answered = true;
+      report.answered++;
+      report.last = now;
+    }
+    if (::sendto(_listener.fd(), d.data.data(), d.data.size(), 0,
+                 (sockaddr *)&p.addr, sizeof(p.addr)) == -1)
+      DEBUG("UDP Failed to send %zu bytes: %s\n", d.data.size(),
+            strerror(errno));
+  }
+
+  /// @brief Takes the requests of players, telling new ones from copies of
+  /// the last.
+  void fromPlayers(uint64_t now) {
+    sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    ssize_t n;
+    while ((n = ::recvfrom(_listener.fd(), _buf, sizeof(_buf) - 1,
+                           MSG_DONTWAIT, (sockaddr *)&addr, &addrlen)) >= 0) {
+      _buf[n] = '\0';
+      uint64_t key = (uint64_t)addr.sin_addr.s_addr << 16 | addr.sin_port;
+      auto &slot = _players[key];
+      if (slot == nullptr) {
+        slot = std::make_unique<Player>();
+        slot->addr = addr;
+        epoll_event ev = {.events = EPOLLIN, .data = {.u64 = key}};
+        if (epoll_ctl(_epoll, EPOLL_CTL_ADD, slot->upstream.fd(), &ev) == -1)
+          ERROR("Failed to watch socket: %s\n", strerror(errno));
+        report.players++;
+      }
+      Player &p = *slot;
+      p.active = now;
+      if (report.first == 0) report.first = now;
+      if (p.request.size() == (size_t)n &&
+          memcmp(p.request.data(), _buf, n) == 0) {
+        report.retransmissions++;
+      } else {
+        report.requests++;
+        p.request.assign(_buf, n);
+        p.reply.clear();
+        p.delivered = 0;
+        p.answered = false;
+      }
+      impair(key, true, _buf, n, now);
+      addrlen = sizeof(addr);
+    }
+  }
+
+  /// @brief Takes the replies of GS to a player, telling those to repeated
+  /// requests that were executed again.
+  void fromServer(uint64_t key, uint64_t now) {
+    auto it = _players.find(key);
+    if (it == _players.end()) return;
+    Player &p = *it->second;
+    ssize_t n;
+    while ((n = ::recv(p.upstream.fd(), _buf, sizeof(_buf) - 1,
+                       MSG_DONTWAIT)) >= 0) {
+      _buf[n] = '\0';
+      const char *req = p.request.c_str();
+      if (!p.request.empty() &&
+          UDPClient::answers(UDPClient::replyCode(req),
+                             UDPClient::trialNumber(req), _buf)) {
+        if (p.reply.empty())
+          p.reply.assign(_buf, n);
+        else if (p.reply != _buf)
+          report.differed++;
+      }
+      impair(key, false, _buf, n, now);
+    }
+  }
+
+  /// @brief Closes the sockets of players idle for longer than allowed.
+  /// Replies still on their way to them are dropped.
+  void expire(uint64_t now) {
+    uint64_t idle = options.idleSeconds * 1000000000ull;
+    for (auto it = _players.begin(); it != _players.end();) {
+      if (now - it->second->active < idle) {
+        ++it;
+        continue;
+      }
+      epoll_ctl(_epoll, EPOLL_CTL_DEL, it->second->upstream.fd(), nullptr);
+      it = _players.erase(it);
+      report.expired++;
+    }
+  }
+
+ public:
+  /// @brief Binds the port players send to. Will exit(1) if unsuccessful.
+  Proxy() : _rng(options.seed) {
+    addrinfo hints, *local = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    int errcode = getaddrinfo(options.ip, options.port, &hints, &_server);
+    if (errcode != 0)
+      ERROR("Failed to translate address %s:%s: %s\n", options.ip,
+            options.port, gai_strerror(errcode));
+    hints.ai_flags = AI_PASSIVE;
+    errcode = getaddrinfo(nullptr, options.listenPort, &hints, &local);
+    if (errcode != 0)
+      ERROR("Failed to translate address 0.0.0.0:%s: %s\n",
+            options.listenPort, gai_strerror(errcode));
+    if (_listener.bind(local->ai_addr, local->ai_addrlen) == -1)
+      ERROR("Failed to bind port %s: %s\n", options.listenPort,
+            strerror(errno));
+    freeaddrinfo(local);
+
+    _epoll = epoll_create1(0);
+    if (_epoll == -1) ERROR("Failed to create epoll: %s\n", strerror(errno));
+    epoll_event ev = {.events = EPOLLIN, .data = {.u64 = LISTENER}};
+    if (epoll_ctl(_epoll, EPOLL_CTL_ADD, _listener.fd(), &ev) == -1)
+      ERROR("Failed to watch socket: %s\n", strerror(errno));
+  }
+
+  /// @brief Forwards datagrams until a deadline or until interrupted.
+  /// @param end Monotonic time in nanoseconds, 0 for none.
+  void run(uint64_t end) {
+    epoll_event events[64];
+    uint64_t sweep = Metrics::now() + SWEEP_MS * 1000000ull;
+    while (!stopping) {
+      uint64_t now = Metrics::now();
+      if (end != 0 && now >= end) break;
+      if (now >= sweep) {
+        expire(now);
+        sweep = now + SWEEP_MS * 1000000ull;
+      }
+      for (; !_held.empty() && _held.top().due <= now; _held.pop())
+        deliver(_held.top(), now);
+      uint64_t wake = _players.empty() ? end : sweep;
+      if (end != 0 && end < wake) wake = end;
+      if (!_held.empty() && (wake == 0 || _held.top().due < wake))
+        wake = _held.top().due;
+      // Sleeps round up, datagrams are never sent early.
+      int ms = wake == 0 ? -1
+               : wake > now ? (wake - now + 999999) / 1000000
+                            : 0;
+      int n = epoll_wait(_epoll, events, 64, ms);
+      now = Metrics::now();
+      for (int k = 0; k < n; k++) {
+        if (events[k].data.u64 == LISTENER)
+          fromPlayers(now);
+        else
+          fromServer(events[k].data.u64, now);
+      }
+    }
+  }
+
+  ~Proxy() {
+    close(_epoll);
+    freeaddrinfo(_server);
+  }
+};
+
+/// @brief Counts of repeated requests kept by GS, shown by STATS.
+struct Repeats {
+  uint64_t repeated, reexecuted;
+};
+
+/// @brief Reads the counts of repeated requests from GS, over TCP.
+/// @return Whether GS gave them.
+bool readRepeats(Repeats &r) {
+  TCPClient client(options.ip, options.port);
+  const char *line = strstr(client.runCommand("STATS\n"), "\nrepeated ");
+  unsigned long repeated, reexecuted;
+  if (line == nullptr ||
+      sscanf(line, "\nrepeated %lu, executed again %lu", &repeated,
+             &reexecuted) != 2)
+    return false;
+  r = {repeated, reexecuted};
+  return true;
+}
+
+void printDirection(const char *name, const Direction &d) {
+  printf("  %-10s %10lu datagrams, %lu dropped, %lu duplicated, %lu "
+         "reordered\n",
+         name, (unsigned long)d.received, (unsigned long)d.dropped,
+         (unsigned long)d.duplicated, (unsigned long)d.reordered);
+}
+
+void printReport(const Repeats *before, const Repeats *after) {
+  double seconds = report.last > report.first
+                       ? (report.last - report.first) / 1e9
+                       : 0;
+  printf("%lu players for %.1f s: drop %d%%, duplicate %d%%, reorder %d%%, "
+         "delay %d+%d ms\n",
+         (unsigned long)report.players, seconds, options.drop, options.duplicate, options.reorder,
+         options.delayMs, options.jitterMs);
+  printf("  %lu requests, %lu retransmissions (%.3f%%)\n",
+         (unsigned long)report.requests,
+         (unsigned long)report.retransmissions,
+         100.0 * report.retransmissions /
+             std::max<uint64_t>(report.requests, 1));
+  printf("  %lu answered (%.3f%%), goodput %.0f req/s\n",
+         (unsigned long)report.answered,
+         100.0 * report.answered / std::max<uint64_t>(report.requests, 1),
+         seconds > 0 ? report.answered / seconds : 0);
+  printDirection("to GS", report.toServer);
+  printDirection("to players", report.toPlayer);
+  printf("  %lu players expired after %d s idle\n",
+         (unsigned long)report.expired, options.idleSeconds);
+  printf("  GS got %lu repeated requests, %lu answered differently\n",
+         (unsigned long)report.repeats, (unsigned long)report.differed);
+  if (before != nullptr && after != nullptr)
+    printf("  GS counted %lu repeated requests, %lu executed again\n",
+           (unsigned long)(after->repeated - before->repeated),
+           (unsigned long)(after->reexecuted - before->reexecuted));
+  else
+    printf("  GS counts of repeated requests unavailable over TCP\n");
+}
+
+int main(int argc, char **argv) {
+  // Handle CLI Flags
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+      options.ip = argv[++i];
+    else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+      options.port = argv[++i];
+    else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+      options.listenPort = argv[++i];
+    else if (strcmp(argv[i], "-D") == 0 && i + 1 < argc)
+      options.drop = std::clamp(atoi(argv[++i]), 0, 100);
+    else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc)
+      options.duplicate = std::clamp(atoi(argv[++i]), 0, 100);
+    else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+      options.reorder = std::clamp(atoi(argv[++i]), 0, 100);
+    else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+      options.delayMs = std::max(atoi(argv[++i]), 0);
+    else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+      options.jitterMs = std::max(atoi(argv[++i]), 0);
+    else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+      options.seconds = std::max(atoi(argv[++i]), 0);
+    else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+      options.idleSeconds = std::max(atoi(argv[++i]), 1);
+    else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+      options.seed = atoi(argv[++i]);
+    else {
+      fprintf(stderr,
+              "Usage: %s [-n GSip] [-p GSport] [-l listen_port] "
+              "[-D drop_percent] [-u duplicate_percent] [-r reorder_percent] "
+              "[-d delay_ms] [-j jitter_ms] [-t seconds] [-i idle_seconds] "
+              "[-s seed]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  struct sigaction act;
+  memset(&act, 0, sizeof(act));
+  act.sa_handler = [](int) { stopping = 1; };
+  if (sigaction(SIGINT, &act, nullptr) == -1 ||
+      sigaction(SIGTERM, &act, nullptr) == -1)
+    ERROR("Failed to create handler for SIGINT: %s\n", strerror(errno));
+
+  // GS counts the repeats it sees from every client, not only the proxy's.
+  Repeats before, after;
+  bool counted = readRepeats(before);
+
+  Proxy proxy;
+  INFO("Forwarding port %s to %s:%s\n", options.listenPort, options.ip,
+       options.port);
+  proxy.run(options.seconds > 0
+                ? Metrics::now() + options.seconds * 1000000000ull
+                : 0);
+  counted = counted && readRepeats(after);
+  printReport(counted ? &before : nullptr, counted ? &after : nullptr);
+  return 0;
+}
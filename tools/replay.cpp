@@ -0,0 +1,409 @@
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/TCPSocket.hpp"
+#include "common/UDPSocket.hpp"
+#include "common/utils.hpp"
+#include "server/Capture.hpp"
+#include "server/Metrics.hpp"
+
+const char *DEFAULT_IP = "localhost";
+const char *DEFAULT_PORT = "58071";
+/// @brief Mismatching replies printed by default.
+const int DEFAULT_SHOWN = 10;
+/// @brief Largest reply of either server.
+const int MAX_REPLY = 16384;
+
+/// @brief Everything measured, shared by all threads.
+struct Report {
+  Histogram latency[Metrics::OPCODES];
+  std::atomic<uint64_t> sent[Metrics::OPCODES];
+  std::atomic<uint64_t> replies[Metrics::OPCODES];
+  /// @brief Replies that differ from the captured ones.
+  std::atomic<uint64_t> mismatches[Metrics::OPCODES];
+  std::atomic<uint64_t> timeouts[Metrics::OPCODES];
+  /// @brief Largest delay of a send past its time, in nanoseconds.
+  std::atomic<uint64_t> lag;
+  std::mutex mutex;
+  /// @brief First mismatching requests, with both replies.
+  std::vector<std::string> shown;
+} report;
+
+/// @brief Options shared by all threads.
+struct Options {
+  const char *ip = DEFAULT_IP;
+  const char *port = DEFAULT_PORT;
+  int threads = 1;
+  /// @brief Speed up over the capture, 0 to send as fast as replies come.
+  double speed = 1;
+  int timeoutMs = 1000;
+  int shown = DEFAULT_SHOWN;
+} options;
+
+/// @brief Captured request to be replayed.
+struct Entry {
+  /// @brief Nanoseconds since the first request of the capture.
+  uint64_t time;
+  Metrics::Opcode opcode;
+  std::string request;
+  std::string reply;
+};
+
+/// @return When an entry is due, as monotonic time in nanoseconds.
+uint64_t due(const Entry &e, uint64_t start) {
+  return options.speed > 0 ? start + (uint64_t)(e.time / options.speed)
+                           : start;
+}
+
+/// @brief Compares a reply with the captured one, keeping the first few
+/// that differ to be shown.
+void check(const Entry &e, const char *reply, size_t len) {
+  report.replies[e.opcode]++;
+  if (e.reply.size() == len && memcmp(e.reply.data(), reply, len) == 0)
+    return;
+  report.mismatches[e.opcode]++;
+  std::lock_guard<std::mutex> lock(report.mutex);
+  if ((int)report.shown.size() < options.shown)
+    report.shown.push_back("request:  " + e.request + "captured: " + e.reply +
+                           "replayed: " + std::string(reply, len));
+}
+
+/// @return Whether a reply may answer an entry: it has the opcode of the
+/// captured reply and, if it names a trial, the trial of the request.
+bool answers(const Entry &e, const char *reply, size_t len) {
+  if (len < 3 || e.reply.size() < 3 || memcmp(reply, e.reply.data(), 3) != 0)
+    return false;
+  int nT, replyNT;
+  std::string text(reply, len);
+  if (sscanf(e.request.c_str(), "TRY %*d %*c %*c %*c %*c %d", &nT) != 1 ||
+      sscanf(text.c_str(), "RTR OK %d", &replyNT) != 1)
+    return true;
+  return replyNT == nT;
+}
+
+/// @brief Client of the capture, its requests replayed from a socket of
+/// their own so the server sees as many clients as were captured.
+struct Peer {
+  UDPSocket socket;
+  /// @brief Entries not sent yet, in order.
+  std::deque<const Entry *> pending;
+  /// @brief Entries sent and not answered, with their send time, oldest
+  /// first. Replies may be reordered or lost, so each is matched to the
+  /// oldest entry it may answer.
+  std::deque<std::pair<const Entry *, uint64_t>> inflight;
+};
+
+/// @brief Replays the UDP requests of a share of the peers.
+class Worker {
+ private:
+  struct Timer {
+    uint64_t deadline;
+    uint32_t peer;
+    /// @brief Entry the timer is for, expired if still in flight.
+    const Entry *entry;
+    bool operator>(const Timer &t) const { return deadline > t.deadline; }
+  };
+
+  const sockaddr *_addr;
+  socklen_t _addrlen;
+  std::vector<std::unique_ptr<Peer>> _peers;
+  int _epoll;
+  /// @brief Peers by the time their next request is due.
+  std::priority_queue<std::pair<uint64_t, uint32_t>,
+                      std::vector<std::pair<uint64_t, uint32_t>>,
+                      std::greater<std::pair<uint64_t, uint32_t>>>
+      _due;
+  std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> _timers;
+  uint64_t _start = 0;
+  /// @brief Entries neither answered nor timed out.
+  size_t _open = 0;
+  char _buf[MAX_REPLY];
+
+  // Delete copy constructor to prevent accidental copies
+  Worker(const Worker &) = delete;
+  Worker &operator=(const Worker &) = delete;
+
+  /// @brief Schedules the next request of a peer. Timed, it is scheduled
+  /// as the last one is sent, as fast as possible once that is answered.
+  void schedule(uint32_t i) {
+    Peer &p = *_peers[i];
+    if (!p.pending.empty()) _due.push({due(*p.pending.front(), _start), i});
+  }
+
+  /// @brief Ends a request in flight of a peer.
+  void done(uint32_t i,
+            std::deque<std::pair<const Entry *, uint64_t>>::iterator it) {
+    _peers[i]->inflight.erase(it);
+    _open--;
+    if (options.speed == 0) schedule(i);
+  }
+
+  void send(uint32_t i, uint64_t now) {
+    Peer &p = *_peers[i];
+    const Entry *e = p.pending.front();
+    p.pending.pop_front();
+    report.sent[e->opcode]++;
+    if (::sendto(p.socket.fd(), e->request.data(), e->request.size(), 0,
+                 _addr, _addrlen) == -1)
+      DEBUG("UDP Failed to send: %s\n", strerror(errno));
+    p.inflight.push_back({e, now});
+    _timers.push({now + options.timeoutMs * 1000000ull, i, e});
+    if (options.speed > 0) schedule(i);
+  }
+
+  void receive(uint32_t i, uint64_t now) {
+    Peer &p = *_peers[i];
+    ssize_t n = recv(p.socket.fd(), _buf, sizeof(_buf), MSG_DONTWAIT);
+    if (n < 0 || p.inflight.empty()) return;
+    // A reply no entry may take is checked against the oldest, so it shows
+    // up as a mismatch.
+    auto it = std::find_if(p.inflight.begin(), p.inflight.end(),
+                           [&](const auto &f) {
+                             return answers(*f.first, _buf, n);
+                           });
+    if (it == p.inflight.end()) it = p.inflight.begin();
+    auto [e, sent] = *it;
+    report.latency[e->opcode].record(now - sent);
+    check(*e, _buf, n);
+    done(i, it);
+  }
+
+  /// @brief Gives up on requests left unanswered. Captured clients'
+  /// retries are in the capture, so none are made here.
+  void expire(uint64_t now) {
+    while (!_timers.empty() && _timers.top().deadline <= now) {
+      Timer t = _timers.top();
+      _timers.pop();
+      Peer &p = *_peers[t.peer];
+      auto it = std::find_if(
+          p.inflight.begin(), p.inflight.end(),
+          [&t](const auto &f) { return f.first == t.entry; });
+      if (it == p.inflight.end()) continue;
+      report.timeouts[t.entry->opcode]++;
+      done(t.peer, it);
+    }
+  }
+
+ public:
+  Worker(const addrinfo &server) : _addr(server.ai_addr),
+                                   _addrlen(server.ai_addrlen) {
+    _epoll = epoll_create1(0);
+    if (_epoll == -1) ERROR("Failed to create epoll: %s\n", strerror(errno));
+  }
+
+  /// @brief Takes a peer and the entries it sent, in order.
+  void add(const std::vector<const Entry *> &entries) {
+    uint32_t i = _peers.size();
+    _peers.push_back(std::make_unique<Peer>());
+    _peers[i]->pending.assign(entries.begin(), entries.end());
+    _open += entries.size();
+    epoll_event ev = {.events = EPOLLIN, .data = {.u32 = i}};
+    if (epoll_ctl(_epoll, EPOLL_CTL_ADD, _peers[i]->socket.fd(), &ev) == -1)
+      ERROR("Failed to watch socket: %s\n", strerror(errno));
+  }
+
+  /// @brief Replays every entry, until all are answered or timed out.
+  /// @param start Monotonic time in nanoseconds of the first entry.
+  void run(uint64_t start) {
+    _start = start;
+    for (uint32_t i = 0; i < _peers.size(); i++) schedule(i);
+    epoll_event events[64];
+    while (_open > 0) {
+      uint64_t now = Metrics::now();
+      while (!_due.empty() && _due.top().first <= now) {
+        uint64_t late = now - _due.top().first;
+        if (late > report.lag) report.lag = late;
+        uint32_t i = _due.top().second;
+        _due.pop();
+        send(i, now);
+      }
+      uint64_t wake = UINT64_MAX;
+      if (!_due.empty()) wake = _due.top().first;
+      if (!_timers.empty()) wake = std::min(wake, _timers.top().deadline);
+      // Waits under a millisecond are spun, epoll can not wait less.
+      int ms = wake > now ? std::min<uint64_t>((wake - now) / 1000000, 1000)
+                          : 0;
+      int n = epoll_wait(_epoll, events, 64, ms);
+      now = Metrics::now();
+      for (int k = 0; k < n; k++) receive(events[k].data.u32, now);
+      expire(now);
+    }
+  }
+
+  ~Worker() { close(_epoll); }
+};
+
+/// @brief Replays the TCP requests in order, one connection at a time as
+/// the server accepts them.
+void replayTCP(const addrinfo &server, const std::vector<const Entry *> &tcp,
+               uint64_t start) {
+  std::vector<char> buf(MAX_REPLY);
+  for (const Entry *e : tcp) {
+    uint64_t at = due(*e, start), now = Metrics::now();
+    if (at > now)
+      std::this_thread::sleep_for(std::chrono::nanoseconds(at - now));
+    else if (now - at > report.lag)
+      report.lag = now - at;
+    report.sent[e->opcode]++;
+    uint64_t sent = Metrics::now();
+    TCPConnection con =
+        TCPSocket().connect(*server.ai_addr, server.ai_addrlen);
+    int n = -1;
+    if (con.write(e->request.data(), e->request.size()) ==
+        (int)e->request.size())
+      n = con.read(buf.data(), buf.size() - 1);
+    if (n < 0) {
+      report.timeouts[e->opcode]++;
+      continue;
+    }
+    report.latency[e->opcode].record(Metrics::now() - sent);
+    check(*e, buf.data(), n);
+  }
+}
+
+void printReport(size_t entries, size_t peers, double captured,
+                 double seconds) {
+  uint64_t replies = 0, mismatches = 0, timeouts = 0;
+  for (int o = 0; o < Metrics::OPCODES; o++) {
+    replies += report.replies[o];
+    mismatches += report.mismatches[o];
+    timeouts += report.timeouts[o];
+  }
+  for (const std::string &s : report.shown) printf("%s\n", s.c_str());
+  printf("%zu requests from %zu clients, captured over %.1f s, replayed in "
+         "%.1f s (%.0f req/s)\n",
+         entries, peers, captured, seconds, entries / seconds);
+  if (options.speed > 0)
+    printf("  at %gx, sends up to %.1f ms late\n", options.speed,
+           report.lag / 1e6);
+  printf("  %lu replies, %lu mismatches (%.3f%%), %lu timeouts\n",
+         (unsigned long)replies, (unsigned long)mismatches,
+         100.0 * mismatches / std::max<uint64_t>(replies, 1),
+         (unsigned long)timeouts);
+
+  printf("\nOpcode   requests  mismatch  timeouts   p50 (us)   p99 (us)  "
+         "p999 (us)\n");
+  for (int o = 0; o < Metrics::OPCODES; o++) {
+    if (report.sent[o] == 0) continue;
+    const Histogram &h = report.latency[o];
+    printf("%-6s %10lu %9lu %9lu %10.1f %10.1f %10.1f\n",
+           Metrics::OPCODE_NAMES[o], (unsigned long)report.sent[o].load(),
+           (unsigned long)report.mismatches[o].load(),
+           (unsigned long)report.timeouts[o].load(), h.percentile(0.5) / 1e3,
+           h.percentile(0.99) / 1e3, h.percentile(0.999) / 1e3);
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *path = nullptr;
+  // Handle CLI Flags
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+      options.ip = argv[++i];
+    else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+      options.port = argv[++i];
+    else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+      options.threads = std::max(atoi(argv[++i]), 1);
+    else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc)
+      options.speed = std::max(atof(argv[++i]), 0.0);
+    else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+      options.timeoutMs = std::max(atoi(argv[++i]), 1);
+    else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc)
+      options.shown = std::max(atoi(argv[++i]), 0);
+    else if (argv[i][0] != '-' && path == nullptr)
+      path = argv[i];
+    else {
+      path = nullptr;
+      break;
+    }
+  }
+  if (path == nullptr) {
+    fprintf(stderr,
+            "Usage: %s capture [-n GSip] [-p GSport] [-t threads] "
+            "[-x speed, 0 for max] [-w timeout_ms] [-e shown_mismatches]\n",
+            argv[0]);
+    return 1;
+  }
+
+  // Requests of a client stay together and in order, UDP clients are told
+  // apart by address and port. Every TCP connection has a port of its own.
+  std::vector<Entry> entries;
+  std::vector<uint64_t> peerOf;
+  {
+    Capture::Reader reader(path);
+    Capture::Record r;
+    Entry e;
+    uint64_t first = 0;
+    while (reader.next(r, e.request, e.reply)) {
+      if (entries.empty()) first = r.time;
+      e.time = r.time > first ? r.time - first : 0;
+      e.opcode = Metrics::opcode(e.request.c_str());
+      entries.push_back(e);
+      peerOf.push_back(r.transport == Capture::TCP
+                           ? UINT64_MAX
+                           : (uint64_t)r.addr << 16 | r.port);
+    }
+  }
+  if (entries.empty()) ERROR("No requests in %s.\n", path);
+
+  std::map<uint64_t, std::vector<const Entry *>> peers;
+  std::vector<const Entry *> tcp;
+  for (size_t i = 0; i < entries.size(); i++)
+    (peerOf[i] == UINT64_MAX ? tcp : peers[peerOf[i]]).push_back(&entries[i]);
+
+  // Every client has a socket of its own.
+  rlimit files;
+  if (getrlimit(RLIMIT_NOFILE, &files) == 0 &&
+      files.rlim_cur < (rlim_t)peers.size() + 64) {
+    files.rlim_cur = std::min<rlim_t>(files.rlim_max, peers.size() + 64);
+    setrlimit(RLIMIT_NOFILE, &files);
+  }
+
+  addrinfo hints, *udp = nullptr, *stream = nullptr;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  int errcode = getaddrinfo(options.ip, options.port, &hints, &udp);
+  hints.ai_socktype = SOCK_STREAM;
+  if (errcode == 0)
+    errcode = getaddrinfo(options.ip, options.port, &hints, &stream);
+  if (errcode != 0)
+    ERROR("Failed to translate address %s:%s: %s\n", options.ip, options.port,
+          gai_strerror(errcode));
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  for (int t = 0; t < options.threads; t++)
+    workers.push_back(std::make_unique<Worker>(*udp));
+  size_t k = 0;
+  for (const auto &[peer, list] : peers)
+    workers[k++ % workers.size()]->add(list);
+
+  uint64_t start = Metrics::now();
+  std::vector<std::thread> threads;
+  for (auto &w : workers) threads.emplace_back(&Worker::run, w.get(), start);
+  if (!tcp.empty()) threads.emplace_back(replayTCP, *stream, tcp, start);
+  for (auto &t : threads) t.join();
+  double seconds = (Metrics::now() - start) / 1e9;
+
+  printReport(entries.size(), peers.size() + tcp.size(),
+              entries.back().time / 1e9, seconds);
+  freeaddrinfo(udp);
+  freeaddrinfo(stream);
+  return 0;
+}
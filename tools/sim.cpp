@@ -0,0 +1,459 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/utils.hpp"
+#include "server/GameStorage.hpp"
+#include "server/Metrics.hpp"
+#include "server/TCPServerParser.hpp"
+#include "server/Trial.hpp"
+#include "server/UDPServerParser.hpp"
+
+/// @brief Epoch time every simulation starts at, 2025-01-01.
+const time_t START = 1735689600;
+/// @brief Time limit of games not meant to run out of time.
+const int MAX_TIME = 600;
+/// @brief Largest reply of the TCP parser.
+const int MAX_REPLY = 16384;
+
+/// @brief Options shared by all threads.
+struct Options {
+  int threads = 1;
+  /// @brief Players of each simulation.
+  int players = 10000;
+  /// @brief Games played by each simulation.
+  uint64_t games = 100000;
+  /// @brief Percentage of requests lost, and of replies.
+  int loss = 1;
+  /// @brief Percentage of trials sent as a duplicate or out of order.
+  int faults = 5;
+  /// @brief Percentage of games followed by STR and SSB over TCP.
+  int mix = 1;
+  unsigned seed = 1;
+  /// @brief Failed checks printed.
+  int shown = 10;
+} options;
+
+/// @brief One simulation: a storage, its parsers and players, all driven
+/// from a single thread on a fake clock advanced a second per round, with
+/// requests handed to the parsers directly. Requests and replies are lost
+/// at random, and every reply is checked against a model of the game kept
+/// by the simulation, which sees every request that reaches the server.
+/// Everything random is drawn from generators seeded from the seed of the
+/// simulation, so it always plays out the same.
+class Simulation {
+ public:
+  struct Counts {
+    uint64_t requests = 0, games = 0, won = 0, lost = 0, quit = 0,
+             timedOut = 0, requestsLost = 0, repliesLost = 0, queries = 0,
+             failures = 0;
+  };
+
+ private:
+  /// @brief How a player means to end a game.
+  enum Plan { WIN, LOSE, QUIT, TIME_OUT };
+
+  /// @brief The game of a player as the server should have it.
+  struct Model {
+    bool exists = false;
+    Trial code;
+    /// @brief Next trial.
+    int nT = 1;
+    Trial trials[9];
+    GameSession::TrialResult result = GameSession::ERROR;
+    time_t started = 0;
+    int maxTime = 0;
+  };
+
+  struct Player {
+    int plid;
+    Model model;
+    bool playing = false;
+    Plan plan = WIN;
+    /// @brief Trial the game is won or quit at, or trials made before
+    /// running out of time.
+    int target = 0;
+    /// @brief Next trial, as the player knows it.
+    int nT = 1;
+    /// @brief Request sent and not answered, resent every round until it is.
+    char pending[BUFFER_SIZE] = "";
+  };
+
+  Counts _counts;
+  std::vector<std::string> _failures;
+  /// @brief FNV-1a hash of every reply, the same on every run of a seed.
+  uint64_t _digest = 14695981039346656037ull;
+  std::mt19937_64 _rng;
+  std::unique_ptr<GameStorage> _store;
+  Metrics _metrics;
+  std::unique_ptr<UDPServerParser> _udp;
+  std::unique_ptr<TCPServerParser> _tcp;
+  std::vector<Player> _players;
+  /// @brief Games won so far, the scoreboard is empty until one is.
+  uint64_t _wins = 0;
+  char _expected[BUFFER_SIZE];
+  char _tcpBuf[MAX_REPLY];
+
+  // Delete copy constructor to prevent accidental copies
+  Simulation(const Simulation &) = delete;
+  Simulation &operator=(const Simulation &) = delete;
+
+  bool chance(int percent) { return (int)(_rng() % 100) < percent; }
+
+  void fail(const Player &p, const char *request, const char *reply) {
+    _counts.failures++;
+    if ((int)_failures.size() < options.shown)
+      _failures.push_back("player " + std::to_string(p.plid) + " at " +
+                          std::to_string(utils_clock.now() - START) +
+                          " s\n  request:  " + request +
+                          "  expected: " + _expected + "  replied:  " + reply);
+  }
+
+  void hash(const char *reply) {
+    for (; *reply; reply++)
+      _digest = (_digest ^ (uint8_t)*reply) * 1099511628211ull;
+  }
+
+  /// @brief Ends a game of the model that ran out of time, as the server
+  /// does on every access.
+  static bool inProgress(Model &m) {
+    if (m.result == GameSession::PLAYING &&
+        utils_clock.now() - m.started >= m.maxTime)
+      m.result = GameSession::TIMEOUT;
+    return m.result == GameSession::PLAYING;
+  }
+
+  void codeReply(const char *prefix, const Trial &code) {
+    snprintf(_expected, sizeof(_expected), "%s %c %c %c %c\n", prefix,
+             code.c1(), code.c2(), code.c3(), code.c4());
+  }
+
+  /// @brief Writes the reply the server should give to a trial to
+  /// _expected, and makes it in the model.
+  void expectTrial(Model &m, const Trial &t, int nT) {
+    uint16_t nB = 0, nW = 0;
+    if (!m.exists) {
+      strcpy(_expected, "RTR NOK\n");
+      return;
+    }
+    inProgress(m);
+    bool retry = nT == m.nT - 1 && t == m.trials[nT];
+    if (!retry && m.result == GameSession::PLAYING) {
+      if (nT != m.nT) {
+        strcpy(_expected, "RTR INV\n");
+        return;
+      }
+      for (int i = 1; i < m.nT; i++)
+        if (t == m.trials[i]) {
+          strcpy(_expected, "RTR DUP\n");
+          return;
+        }
+      m.trials[m.nT++] = t;
+      t.evaluate(m.code, nB, nW);
+      if (nB == 4)
+        m.result = GameSession::WIN;
+      else if (m.nT > 8)
+        m.result = GameSession::LOSS;
+    } else if (!retry &&
+               (m.result != GameSession::TIMEOUT || nT != m.nT)) {
+      strcpy(_expected, "RTR NOK\n");
+      return;
+    } else if (retry) {
+      t.evaluate(m.code, nB, nW);
+    }
+    switch (m.result) {
+      case GameSession::LOSS:
+        codeReply("RTR ENT", m.code);
+        break;
+      case GameSession::TIMEOUT:
+        codeReply("RTR ETM", m.code);
+        break;
+      case GameSession::QUIT:
+        strcpy(_expected, "RTR NOK\n");
+        break;
+      default:
+        snprintf(_expected, sizeof(_expected), "RTR OK %d %d %d\n", nT, nB,
+                 nW);
+        break;
+    }
+  }
+
+  /// @brief Writes the reply the server should give to _expected, and
+  /// makes the request in the model.
+  void expect(Model &m, const char *request) {
+    char c1, c2, c3, c4;
+    int plid, maxTime, nT;
+    if (sscanf(request, "SNG %d %d", &plid, &maxTime) == 2) {
+      if (inProgress(m) && m.nT > 1) {
+        strcpy(_expected, "RSG NOK\n");
+        return;
+      }
+      // The code is only known once the server draws it.
+      m = Model{.exists = true, .result = GameSession::PLAYING,
+                .started = utils_clock.now(), .maxTime = maxTime};
+      strcpy(_expected, "RSG OK\n");
+    } else if (sscanf(request, "DBG %d %d %c %c %c %c", &plid, &maxTime, &c1,
+                      &c2, &c3, &c4) == 6) {
+      if (inProgress(m)) {
+        strcpy(_expected, "RDB NOK\n");
+        return;
+      }
+      m = Model{.exists = true, .code = Trial(c1, c2, c3, c4),
+                .result = GameSession::PLAYING,
+                .started = utils_clock.now(), .maxTime = maxTime};
+      strcpy(_expected, "RDB OK\n");
+    } else if (sscanf(request, "TRY %d %c %c %c %c %d", &plid, &c1, &c2, &c3,
+                      &c4, &nT) == 6) {
+      expectTrial(m, Trial(c1, c2, c3, c4), nT);
+    } else {
+      if (!inProgress(m)) {
+        strcpy(_expected, "RQT NOK\n");
+        return;
+      }
+      m.result = GameSession::QUIT;
+      codeReply("RQT OK", m.code);
+    }
+  }
+
+  /// @brief Hands a request to the server, losing it or its reply at
+  /// random, and checks the reply.
+  /// @return Reply, null if lost.
+  const char *send(Player &p, const char *request) {
+    _counts.requests++;
+    if (chance(options.loss)) {
+      _counts.requestsLost++;
+      return nullptr;
+    }
+    expect(p.model, request);
+    const char *reply = _udp->executeRequest(request);
+    hash(reply);
+    if (strcmp(reply, _expected) != 0) fail(p, request, reply);
+    if (strncmp(request, "SNG", 3) == 0 && strcmp(reply, "RSG OK\n") == 0)
+      p.model.code = _store->readSession(p.plid).getCode();
+    if (chance(options.loss)) {
+      _counts.repliesLost++;
+      return nullptr;
+    }
+    return reply;
+  }
+
+  /// @brief Asks for the trials of a game that ended and the scoreboard,
+  /// over a TCP connection that loses nothing.
+  void query(Player &p) {
+    _counts.queries += 2;
+    snprintf(_tcpBuf, sizeof(_tcpBuf), "STR %06d\n", p.plid);
+    const char *reply = _tcp->executeRequest(_tcpBuf, sizeof(_tcpBuf));
+    hash(reply);
+    strcpy(_expected, "RST FIN ");
+    if (strncmp(reply, _expected, strlen(_expected)) != 0)
+      fail(p, "STR\n", reply);
+    snprintf(_tcpBuf, sizeof(_tcpBuf), "SSB\n");
+    reply = _tcp->executeRequest(_tcpBuf, sizeof(_tcpBuf));
+    hash(reply);
+    strcpy(_expected, _wins > 0 ? "RSS OK " : "RSS EMPTY\n");
+    if (strncmp(reply, _expected, strlen(_expected)) != 0)
+      fail(p, "SSB\n", reply);
+  }
+
+  void startGame(Player &p) {
+    p.nT = 1;
+    int plan = _rng() % 10;
+    p.plan = plan < 6 ? WIN : plan < 8 ? LOSE : plan < 9 ? QUIT : TIME_OUT;
+    p.target = p.plan == WIN || p.plan == QUIT ? 1 + _rng() % 8 : 0;
+    int maxTime = MAX_TIME;
+    if (p.plan == TIME_OUT) {
+      maxTime = 1 + _rng() % 4;
+      p.target = _rng() % maxTime;
+    }
+    if (chance(50)) {
+      Trial code = Trial::fromIndex(_rng() % Trial::CODES);
+      snprintf(p.pending, sizeof(p.pending), "DBG %06d %03d %c %c %c %c\n",
+               p.plid, maxTime, code.c1(), code.c2(), code.c3(), code.c4());
+    } else {
+      snprintf(p.pending, sizeof(p.pending), "SNG %06d %03d\n", p.plid,
+               maxTime);
+    }
+  }
+
+  /// @brief Picks the next trial: the code when the player means to win
+  /// with it, otherwise a code neither tried nor the secret one, and now
+  /// and then a code tried already or a trial number out of order.
+  void nextTrial(Player &p) {
+    const Model &m = p.model;
+    Trial t;
+    int nT = p.nT;
+    if (p.plan == WIN && p.nT == p.target) {
+      t = m.code;
+    } else if (chance(options.faults) && p.nT > 1 && p.nT < 8) {
+      if (chance(50)) {
+        t = m.trials[1 + _rng() % (p.nT - 1)];
+      } else {
+        t = Trial::fromIndex(_rng() % Trial::CODES);
+        nT = p.nT + 1;
+      }
+    } else {
+      do {
+        t = Trial::fromIndex(_rng() % Trial::CODES);
+      } while (t == m.code ||
+               std::find(m.trials + 1, m.trials + p.nT, t) != m.trials + p.nT);
+    }
+    snprintf(p.pending, sizeof(p.pending), "TRY %06d %c %c %c %c %d\n",
+             p.plid, t.c1(), t.c2(), t.c3(), t.c4(), nT);
+  }
+
+  void ended(Player &p, uint64_t &outcome) {
+    outcome++;
+    _counts.games++;
+    p.playing = false;
+    if (chance(options.mix)) query(p);
+  }
+
+  /// @brief Moves a player on after a reply.
+  void received(Player &p, const char *reply) {
+    int nT, nB, nW;
+    if (strncmp(reply, "RSG OK", 6) == 0 || strncmp(reply, "RDB", 3) == 0) {
+      // A DBG resent after its reply was lost is refused, the game it
+      // started is played.
+      p.playing = true;
+    } else if (sscanf(reply, "RTR OK %d %d %d", &nT, &nB, &nW) == 3) {
+      if (nT == p.nT) p.nT++;
+      if (nB == 4) {
+        _wins++;
+        ended(p, _counts.won);
+      }
+    } else if (strncmp(reply, "RTR ENT", 7) == 0) {
+      ended(p, _counts.lost);
+    } else if (strncmp(reply, "RTR ETM", 7) == 0) {
+      ended(p, _counts.timedOut);
+    } else if (strncmp(reply, "RQT", 3) == 0 ||
+               strncmp(reply, "RTR NOK", 7) == 0 ||
+               strncmp(reply, "RSG NOK", 7) == 0) {
+      ended(p, _counts.quit);
+    }
+  }
+
+  /// @brief Makes the next request of a player, if any is due this round.
+  void act(Player &p) {
+    if (p.pending[0] == '\0') {
+      if (!p.playing) {
+        startGame(p);
+      } else if (p.plan == TIME_OUT && p.nT > p.target) {
+        // Waits for the game to run out of time, then tries once more.
+        if (utils_clock.now() - p.model.started < p.model.maxTime) return;
+        nextTrial(p);
+      } else if (p.plan == QUIT && p.nT == p.target) {
+        snprintf(p.pending, sizeof(p.pending), "QUT %06d\n", p.plid);
+      } else {
+        nextTrial(p);
+      }
+    }
+    const char *reply = send(p, p.pending);
+    if (reply == nullptr) return;
+    p.pending[0] = '\0';
+    received(p, reply);
+  }
+
+ public:
+  Simulation(unsigned seed) : _rng(seed) {}
+
+  /// @brief Plays games until the simulation has played enough, meant to
+  /// be the body of a thread of its own, whose clock it takes over.
+  void run(unsigned seed) {
+    utils_clock.set(START);
+    Trial::seed(seed);
+    _store = std::make_unique<GameStorage>();
+    _udp = std::make_unique<UDPServerParser>(*_store, _metrics);
+    _tcp = std::make_unique<TCPServerParser>(*_store, _metrics);
+    _players.resize(options.players);
+    for (int i = 0; i < options.players; i++) _players[i].plid = i + 1;
+    while (_counts.games < options.games) {
+      for (Player &p : _players) act(p);
+      utils_clock.advance(1);
+      _store->tick();
+    }
+  }
+
+  const Counts &counts() const { return _counts; }
+  const std::vector<std::string> &failures() const { return _failures; }
+  uint64_t digest() const { return _digest; }
+};
+
+int main(int argc, char **argv) {
+  // Handle CLI Flags
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+      options.threads = std::max(atoi(argv[++i]), 1);
+    else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc)
+      options.players = std::clamp(atoi(argv[++i]), 1, 999999);
+    else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc)
+      options.games = std::max(atoll(argv[++i]), 1ll);
+    else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+      options.loss = std::clamp(atoi(argv[++i]), 0, 50);
+    else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+      options.faults = std::clamp(atoi(argv[++i]), 0, 100);
+    else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+      options.mix = std::clamp(atoi(argv[++i]), 0, 100);
+    else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+      options.seed = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc)
+      options.shown = std::max(atoi(argv[++i]), 0);
+    else {
+      fprintf(stderr,
+              "Usage: %s [-t threads] [-P players] [-g games_per_thread] "
+              "[-l loss_percent] [-f fault_percent] [-m mix_percent] "
+              "[-s seed] [-e shown_failures]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  std::vector<std::unique_ptr<Simulation>> sims;
+  for (int t = 0; t < options.threads; t++)
+    sims.push_back(std::make_unique<Simulation>(options.seed + t));
+  uint64_t start = Metrics::now();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < options.threads; t++)
+    threads.emplace_back(&Simulation::run, sims[t].get(), options.seed + t);
+  for (auto &t : threads) t.join();
+  double seconds = (Metrics::now() - start) / 1e9;
+
+  Simulation::Counts total;
+  uint64_t digest = 14695981039346656037ull;
+  for (auto &s : sims) {
+    const Simulation::Counts &c = s->counts();
+    total.requests += c.requests;
+    total.games += c.games;
+    total.won += c.won;
+    total.lost += c.lost;
+    total.quit += c.quit;
+    total.timedOut += c.timedOut;
+    total.requestsLost += c.requestsLost;
+    total.repliesLost += c.repliesLost;
+    total.queries += c.queries;
+    total.failures += c.failures;
+    digest = (digest ^ s->digest()) * 1099511628211ull;
+    for (const std::string &f : s->failures()) printf("%s\n", f.c_str());
+  }
+
+  printf("%d simulations of %d players, seed %u\n", options.threads,
+         options.players, options.seed);
+  printf("  %lu games in %.2f s (%.0f games/s), %lu requests (%.0f req/s)\n",
+         (unsigned long)total.games, seconds, total.games / seconds,
+         (unsigned long)total.requests, total.requests / seconds);
+  printf("  %lu won, %lu lost, %lu quit, %lu timed out\n",
+         (unsigned long)total.won, (unsigned long)total.lost,
+         (unsigned long)total.quit, (unsigned long)total.timedOut);
+  printf("  %lu requests and %lu replies lost, %lu TCP queries\n",
+         (unsigned long)total.requestsLost, (unsigned long)total.repliesLost,
+         (unsigned long)total.queries);
+  printf("  %lu failed checks, digest %016lx\n", (unsigned long)total.failures,
+         (unsigned long)digest);
+  return total.failures == 0 ? 0 : 1;
+}